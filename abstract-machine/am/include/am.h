@@ -65,6 +65,7 @@ extern "C"
 
   // ---------- CTE: Interrupt Handling and Context Switching ----------
   bool cte_init(Context *(*handler)(Event ev, Context *ctx));
+  void cte_syscall(Context *(*handler)(Context *ctx));
   void yield(void);
   bool ienabled(void);
   void iset(bool enable);
@@ -75,6 +76,9 @@ extern "C"
   void protect(AddrSpace *as);
   void unprotect(AddrSpace *as);
   void map(AddrSpace *as, void *vaddr, void *paddr, int prot);
+  void map_range(AddrSpace *as, void *vaddr, void *const paddr[], int npages, int prot);
+  int unmap_range(AddrSpace *as, void *vaddr, int npages, void *paddr[]);
+  void map_large(AddrSpace *as, void *vaddr, void *paddr, int prot);
   Context *ucontext(AddrSpace *as, Area kstack, void *entry);
   uintptr_t *ptewalk(AddrSpace *as, uintptr_t addr);
   // ---------------------- MPE: Multi-Processing ----------------------
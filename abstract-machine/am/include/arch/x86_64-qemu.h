@@ -15,8 +15,9 @@ struct Context {
 #define GPR1 rdi
 #define GPR2 rsi
 #define GPR3 rdx
-#define GPR4 rcx
+#define GPR4 r10
 #define GPR5 r8
+#define GPR6 r9
 #define GPRx rax
 
 #endif
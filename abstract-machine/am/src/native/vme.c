@@ -120,6 +120,27 @@ void map(AddrSpace *as, void *va, void *pa, int prot) {
   }
 }
 
+void map_range(AddrSpace *as, void *vaddr, void *const paddr[], int npages, int prot) {
+  for (int i = 0; i < npages; i++) {
+    map(as, vaddr + i * __am_pgsize, paddr[i], prot);
+  }
+}
+
+// mappings are never taken down here, nothing is reported unmapped
+int unmap_range(AddrSpace *as, void *vaddr, int npages, void *paddr[]) {
+  for (int i = 0; i < npages; i++) {
+    paddr[i] = NULL;
+  }
+  return 0;
+}
+
+// no large pages here: map the 2 MiB as small pages
+void map_large(AddrSpace *as, void *va, void *pa, int prot) {
+  for (uintptr_t off = 0; off < (2 << 20); off += __am_pgsize) {
+    map(as, va + off, pa + off, prot);
+  }
+}
+
 Context* ucontext(AddrSpace *as, Area kstack, void *entry) {
   Context *c = (Context*)kstack.end - 1;
 
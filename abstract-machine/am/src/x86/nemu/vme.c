@@ -59,6 +59,20 @@ void __am_switch(Context *c) {
 void map(AddrSpace *as, void *va, void *pa, int prot) {
 }
 
+// no paging here, like map()
+void map_range(AddrSpace *as, void *vaddr, void *const paddr[], int npages, int prot) {
+}
+
+int unmap_range(AddrSpace *as, void *vaddr, int npages, void *paddr[]) {
+  for (int i = 0; i < npages; i++) {
+    paddr[i] = NULL;
+  }
+  return 0;
+}
+
+void map_large(AddrSpace *as, void *va, void *pa, int prot) {
+}
+
 Context* ucontext(AddrSpace *as, Area kstack, void *entry) {
   return NULL;
 }
@@ -1,6 +1,7 @@
 #include "x86-qemu.h"
 
 static Context *(*user_handler)(Event, Context *) = NULL;
+static Context *(*syscall_handler)(Context *) = NULL;
 #if __x86_64__
 static GateDesc64 idt[NR_IRQ];
 #define GATE GATE64
@@ -15,6 +16,7 @@ static GateDesc32 idt[NR_IRQ];
 IRQS(IRQHANDLE_DECL)
 void __am_irqall();
 void __am_kcontext_start();
+void __am_syscall_entry();
 
 void __am_irq_handle(struct trap_frame *tf)
 {
@@ -129,7 +131,7 @@ void __am_irq_handle(struct trap_frame *tf)
 
   if (ret_ctx->cr3)
   {
-    set_cr3(ret_ctx->cr3);
+    __am_switch_cr3(ret_ctx->cr3);
 #if __x86_64__
     CPU->tss.rsp0 = ret_ctx->rsp0;
 #else
@@ -141,6 +143,48 @@ void __am_irq_handle(struct trap_frame *tf)
   __am_iret(ret_ctx);
 }
 
+#if __x86_64__
+void __am_syscall_handle(Context *ctx)
+{
+  void *cr3 = (void *)get_cr3();
+  ctx->rsp0 = CPU->tss.rsp0;
+  ctx->cr3 = cr3;
+
+  // NULL from the fast handler: the call needs a full trap walk
+  Context *ret_ctx = syscall_handler ? syscall_handler(ctx) : NULL;
+  if (!ret_ctx)
+  {
+    Event ev = {
+        .event = syscall_handler ? EVENT_YIELD : EVENT_SYSCALL,
+        .cause = 0,
+        .ref = 0,
+        .msg = "syscall instruction",
+    };
+    ret_ctx = user_handler(ev, ctx);
+  }
+  panic_on(!ret_ctx, "returning to NULL context");
+
+  // execve may have rebuilt the context in place with a new address space
+  if (ret_ctx->cr3 && (ret_ctx != ctx || ret_ctx->cr3 != cr3))
+  {
+    __am_switch_cr3(ret_ctx->cr3);
+    CPU->tss.rsp0 = ret_ctx->rsp0;
+  }
+
+  // SYSRET faults in ring 0 on a non-canonical rip, leave those to iret
+  if (ret_ctx == ctx && (ctx->cs & DPL_USER) && ctx->rip < 0x800000000000ULL)
+  {
+    __am_sysret(ctx);
+  }
+  __am_iret(ret_ctx);
+}
+#endif
+
+void cte_syscall(Context *(*handler)(Context *))
+{
+  syscall_handler = handler;
+}
+
 bool cte_init(Context *(*handler)(Event, Context *))
 {
   panic_on(cpu_current() != 0, "init CTE in non-bootstrap CPU");
@@ -207,4 +251,13 @@ void __am_percpu_initirq()
   __am_ioapic_enable(IRQ_KBD, 0);
   __am_ioapic_enable(IRQ_COM1, 0);
   set_idt(idt, sizeof(idt));
+#if __x86_64__
+  // SYSRET loads cs/ss from STAR[63:48] + 16/8, SYSCALL from STAR[47:32] + 0/8
+  wrmsr(MSR_STAR, ((uint64_t)USEL(SEG_UDATA - 1) << 48) | ((uint64_t)KSEL(SEG_KCODE) << 32));
+  wrmsr(MSR_LSTAR, (uintptr_t)__am_syscall_entry);
+  wrmsr(MSR_FMASK, FL_IF | FL_TF | FL_DF | FL_AC);
+  wrmsr(MSR_GS_BASE, 0);
+  wrmsr(MSR_KGS_BASE, (uintptr_t)&CPU->tss);
+  wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+#endif
 }
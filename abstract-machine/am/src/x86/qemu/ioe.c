@@ -99,6 +99,11 @@ static void timer_uptime(AM_TIMER_UPTIME_T *upt) {
   upt->us = (rdtsc() - uptsc) / freq_mhz;
 }
 
+static void timer_tsc(AM_TIMER_TSC_T *tsc) {
+  tsc->freq_mhz = freq_mhz;
+  tsc->uptsc = uptsc;
+}
+
 // Input
 // ====================================================
 
@@ -315,6 +320,7 @@ static void *lut[128] = {
   [AM_TIMER_CONFIG] = timer_config,
   [AM_TIMER_RTC   ] = timer_rtc,
   [AM_TIMER_UPTIME] = timer_uptime,
+  [AM_TIMER_TSC   ] = timer_tsc,
   [AM_INPUT_CONFIG] = input_config,
   [AM_INPUT_KEYBRD] = input_keybrd,
   [AM_GPU_CONFIG  ] = gpu_config,
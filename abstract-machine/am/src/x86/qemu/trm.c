@@ -29,6 +29,7 @@ void __am_percpu_init() {
   __am_percpu_initgdt();
   __am_percpu_initlapic();
   __am_percpu_initirq();
+  __am_percpu_initpg();
 }
 
 void putch(char ch) {
@@ -38,6 +38,72 @@ static uintptr_t *kpt;
 static void *(*pgalloc)(int size);
 static void (*pgfree)(void *);
 
+#if __x86_64__
+// An address space's PCID lives in bits 3..11 of its ptr, so that
+// ptr (with PTE_P | PTE_U in the low bits) is directly a CR3 value
+// with a distinct hardware PCID. PCID 0 means "always flush".
+#define NR_PCID    512
+#define PCID_SHIFT 3
+static int pcid_enabled;
+static int pcid_used[NR_PCID];
+static volatile uint32_t pcid_stale[NR_PCID]; // CPUs whose TLB may hold stale entries
+
+static int pcidof(uintptr_t cr3) {
+  return (cr3 & (mmu.pgsize - 1)) >> PCID_SHIFT;
+}
+
+static int pcid_alloc() {
+  if (!pcid_enabled) return 0;
+  for (int i = 1; i < NR_PCID; i++) {
+    if (xchg(&pcid_used[i], 1) == 0) {
+      // entries left behind by the previous owner
+      __atomic_store_n(&pcid_stale[i], ~0u, __ATOMIC_SEQ_CST);
+      return i;
+    }
+  }
+  return 0;
+}
+
+static void pcid_invalidate(AddrSpace *as) {
+  int pcid = pcidof((uintptr_t)as->ptr);
+  if (pcid == 0) return;
+  uint32_t others = ~0u;
+  if (((get_cr3() ^ (uintptr_t)as->ptr) & ~(uintptr_t)(mmu.pgsize - 1)) == 0) {
+    others &= ~(1u << cpu_current()); // invlpg already handled this CPU
+  }
+  __atomic_or_fetch(&pcid_stale[pcid], others, __ATOMIC_SEQ_CST);
+}
+#endif
+
+void __am_percpu_initpg() {
+  // read-only user pages must fault on kernel writes too (copy-on-write)
+  set_cr0(get_cr0() | CR0_WP);
+#if __x86_64__
+  uint32_t eax, ebx, ecx, edx;
+  cpuid(1, &eax, &ebx, &ecx, &edx);
+  uintptr_t cr4 = get_cr4() | CR4_PGE;
+  pcid_enabled = (ecx >> 17) & 1;
+  if (pcid_enabled) {
+    cr4 |= CR4_PCIDE; // requires CR3[11:0] == 0, true for the boot PML4
+  }
+  set_cr4(cr4);
+#endif
+}
+
+void __am_switch_cr3(void *cr3) {
+#if __x86_64__
+  int pcid = pcidof((uintptr_t)cr3);
+  if (pcid_enabled && pcid != 0) {
+    uint32_t self = 1u << cpu_current();
+    if (!(__atomic_fetch_and(&pcid_stale[pcid], ~self, __ATOMIC_SEQ_CST) & self)) {
+      set_cr3((void *)((uintptr_t)cr3 | CR3_NOFLUSH));
+      return;
+    }
+  }
+#endif
+  set_cr3(cr3);
+}
+
 static void *pgallocz() {
   uintptr_t *base = pgalloc(mmu.pgsize);
   panic_on(!base, "cannot allocate page");
@@ -55,15 +121,18 @@ static uintptr_t baseof(uintptr_t addr) {
   return addr & ~(mmu.pgsize - 1);
 }
 
-static uintptr_t *ptwalk(AddrSpace *as, uintptr_t addr, int flags) {
+// Walk down to the entry for @addr in the level-@level table,
+// allocating missing tables on the way.
+static uintptr_t *ptwalk_level(AddrSpace *as, uintptr_t addr, int flags, int level) {
   uintptr_t cur = (uintptr_t)&as->ptr;
 
-  for (int i = 0; i <= mmu.ptlevels; i++) {
+  for (int i = 0; i <= level; i++) {
     const struct ptinfo *ptinfo = &mmu.pgtables[i];
     uintptr_t *pt = (uintptr_t *)cur, next_page;
     int index = indexof(addr, ptinfo);
-    if (i == mmu.ptlevels) return &pt[index];
+    if (i == level) return &pt[index];
 
+    panic_on(i >= 1 && (pt[index] & PTE_PS), "walking into a large page");
     if (!(pt[index] & PTE_P)) {
       next_page = (uintptr_t)pgallocz();
       pt[index] = next_page | PTE_P | flags;
@@ -75,10 +144,15 @@ static uintptr_t *ptwalk(AddrSpace *as, uintptr_t addr, int flags) {
   bug();
 }
 
+static uintptr_t *ptwalk(AddrSpace *as, uintptr_t addr, int flags) {
+  return ptwalk_level(as, addr, flags, mmu.ptlevels);
+}
+
 static void teardown(int level, uintptr_t *pt) {
   if (level > mmu.ptlevels) return;
   for (int index = 0; index < (1 << mmu.pgtables[level].bits); index++) {
-    if ((pt[index] & PTE_P) && (pt[index] & PTE_U)) {
+    // large pages are leaves: their frames belong to the caller
+    if ((pt[index] & PTE_P) && (pt[index] & PTE_U) && !(pt[index] & PTE_PS)) {
       teardown(level + 1, (void *)baseof(pt[index]));
     }
   }
@@ -94,6 +168,22 @@ bool vme_init(void *(*_pgalloc)(int size), void (*_pgfree)(void *)) {
 
 #if __x86_64__
   kpt = (void *)PML4_ADDR;
+  // the kernel half is shared by every address space: keep it in the
+  // TLB across CR3 writes
+  for (int i = 0; i < LENGTH(vm_areas); i++) {
+    const struct vm_area *vma = &vm_areas[i];
+    if (vma->kernel) {
+      const struct ptinfo *info = &mmu.pgtables[1];
+      for (uintptr_t cur = (uintptr_t)vma->area.start;
+           cur != (uintptr_t)vma->area.end;
+           cur += (1L << info->shift)) {
+        uintptr_t *pdpt = (void *)baseof(kpt[indexof(cur, info)]);
+        for (int j = 0; j < (1 << mmu.pgtables[2].bits); j++) {
+          if (pdpt[j] & PTE_PS) pdpt[j] |= PTE_G;
+        }
+      }
+    }
+  }
 #else
   AddrSpace as;
   as.ptr = NULL;
@@ -133,10 +223,17 @@ void protect(AddrSpace *as) {
   as->pgsize = mmu.pgsize;
   as->area   = uvm_area;
   as->ptr    = (void *)((uintptr_t)upt | PTE_P | PTE_U);
+#if __x86_64__
+  as->ptr    = (void *)((uintptr_t)as->ptr | pcid_alloc() << PCID_SHIFT);
+#endif
 }
 
 void unprotect(AddrSpace *as) {
   teardown(0, (void *)&as->ptr);
+#if __x86_64__
+  int pcid = pcidof((uintptr_t)as->ptr);
+  if (pcid != 0) xchg(&pcid_used[pcid], 0);
+#endif
 }
 
 void map(AddrSpace *as, void *va, void *pa, int prot) {
@@ -148,14 +245,99 @@ void map(AddrSpace *as, void *va, void *pa, int prot) {
   if (prot == MMAP_NONE) {
     panic_on(!(*ptentry & PTE_P), "unmapping a non-mapped page");
     *ptentry = 0;
+    invlpg((uintptr_t)va);
+#if __x86_64__
+    pcid_invalidate(as);
+#endif
   } else {
     panic_on(*ptentry & PTE_P, "remapping a mapped page");
     uintptr_t pte = (uintptr_t)pa | PTE_P | PTE_U | ((prot & MMAP_WRITE) ? PTE_W : 0);
     *ptentry = pte;
   }
-  ptwalk(as, (uintptr_t)va, PTE_W | PTE_U);
 }
 
+// Map @npages consecutive pages from @vaddr to the frames in @paddr,
+// walking the page-table hierarchy once per leaf table.
+void map_range(AddrSpace *as, void *vaddr, void *const paddr[], int npages, int prot) {
+  const struct ptinfo *leaf = &mmu.pgtables[mmu.ptlevels];
+  uintptr_t va = (uintptr_t)vaddr;
+  uintptr_t flags = PTE_P | PTE_U | ((prot & MMAP_WRITE) ? PTE_W : 0);
+  uintptr_t *pt = NULL;
+
+  panic_on(npages <= 0, "mapping an empty range");
+  panic_on(!IN_RANGE(vaddr, uvm_area) ||
+           !IN_RANGE((void *)(va + (npages - 1) * mmu.pgsize), uvm_area), "mapping an invalid address");
+  panic_on(va != ROUNDDOWN(va, mmu.pgsize), "non-page-boundary address");
+  for (int i = 0; i < npages; i++, va += mmu.pgsize) {
+    int index = indexof(va, leaf);
+    if (pt == NULL || index == 0) {
+      pt = ptwalk(as, va, PTE_W | PTE_U) - index;
+    }
+    panic_on((uintptr_t)paddr[i] != ROUNDDOWN(paddr[i], mmu.pgsize), "non-page-boundary address");
+    panic_on(pt[index] & PTE_P, "remapping a mapped page");
+    pt[index] = (uintptr_t)paddr[i] | flags;
+  }
+}
+
+// Unmap @npages consecutive pages from @vaddr, storing the frame that
+// backed each page (or NULL) in @paddr; returns the number of pages
+// that were mapped. Missing page tables are skipped, never allocated.
+int unmap_range(AddrSpace *as, void *vaddr, int npages, void *paddr[]) {
+  const struct ptinfo *leaf = &mmu.pgtables[mmu.ptlevels];
+  uintptr_t va = (uintptr_t)vaddr;
+  uintptr_t *pt = NULL;
+  int count = 0;
+
+  panic_on(va != ROUNDDOWN(va, mmu.pgsize), "non-page-boundary address");
+  for (int i = 0; i < npages; i++, va += mmu.pgsize) {
+    int index = indexof(va, leaf);
+    if (i == 0 || index == 0) {
+      pt = ptewalk(as, va);
+      pt = pt ? pt - index : NULL;
+    }
+    paddr[i] = NULL;
+    if (pt == NULL || !(pt[index] & PTE_P)) continue;
+    panic_on(pt[index] & PTE_PS, "unmapping part of a large page");
+    paddr[i] = (void *)baseof(pt[index]);
+    pt[index] = 0;
+    invlpg(va);
+    count++;
+  }
+#if __x86_64__
+  if (count > 0) pcid_invalidate(as);
+#endif
+  return count;
+}
+
+#if __x86_64__
+// Map (or, with MMAP_NONE, unmap) a 2 MiB page with one PD entry.
+void map_large(AddrSpace *as, void *va, void *pa, int prot) {
+  const struct ptinfo *pd = &mmu.pgtables[mmu.ptlevels - 1];
+  uintptr_t lpgsize = 1UL << pd->shift;
+  panic_on(!IN_RANGE(va, uvm_area), "mapping an invalid address");
+  panic_on((uintptr_t)va != ROUNDDOWN(va, lpgsize) ||
+           (uintptr_t)pa != ROUNDDOWN(pa, lpgsize), "non-large-page-boundary address");
+
+  uintptr_t *ptentry = ptwalk_level(as, (uintptr_t)va, PTE_W | PTE_U, mmu.ptlevels - 1);
+  if (prot == MMAP_NONE) {
+    panic_on(!(*ptentry & PTE_P) || !(*ptentry & PTE_PS), "unmapping a non-mapped large page");
+    *ptentry = 0;
+    invlpg((uintptr_t)va);
+    pcid_invalidate(as);
+  } else {
+    panic_on(*ptentry & PTE_P, "remapping a mapped page");
+    *ptentry = (uintptr_t)pa | PTE_P | PTE_U | PTE_PS | ((prot & MMAP_WRITE) ? PTE_W : 0);
+  }
+}
+#else
+// i386 PDEs map 4 MiB: map (or unmap) the 2 MiB as small pages
+void map_large(AddrSpace *as, void *va, void *pa, int prot) {
+  for (uintptr_t off = 0; off < (2 << 20); off += mmu.pgsize) {
+    map(as, va + off, pa + off, prot);
+  }
+}
+#endif
+
 Context *ucontext(AddrSpace *as, Area kstack, void *entry) {
   Context *ctx = kstack.end - sizeof(Context);
   *ctx = (Context) { 0 };
@@ -195,6 +377,10 @@ uintptr_t *ptewalk(AddrSpace *as, uintptr_t addr)
     {
       return NULL;
     }
+    if (i >= 1 && (pt[index] & PTE_PS))
+    {
+      return &pt[index]; // a large page is the leaf
+    }
     else
     {
       next_page = baseof(pt[index]);
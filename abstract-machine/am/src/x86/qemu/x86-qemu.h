@@ -6,12 +6,16 @@
 #define NR_SEG         6       // GDT size
 #define SEG_KCODE      1       // Kernel code
 #define SEG_KDATA      2       // Kernel data/stack
-#define SEG_UCODE      3       // User code
-#define SEG_UDATA      4       // User data/stack
+#define SEG_UDATA      3       // User data/stack
+#define SEG_UCODE      4       // User code (SYSRET wants it right above user data)
 #define SEG_TSS        5       // Global unique task state segement
 
 #define NR_IRQ         256     // IDT size
 
+// TSS64 fields used by the SYSCALL entry through %gs
+#define TSS_RSP0       4
+#define TSS_RSP2       20      // ring 2 is never used: scratch for the user rsp
+
 #ifndef __ASSEMBLER__
 
 #include <am.h>
@@ -40,6 +44,7 @@ struct vm_area {
 };
 
 void __am_iret(Context *ctx);
+void __am_sysret(Context *ctx);
 
 struct cpu_local {
   AddrSpace *uvm;
@@ -95,6 +100,8 @@ void __am_othercpu_entry();
 void __am_percpu_initirq();
 void __am_percpu_initgdt();
 void __am_percpu_initlapic();
+void __am_percpu_initpg();
+void __am_switch_cr3(void *cr3);
 void __am_stop_the_world();
 
 #endif
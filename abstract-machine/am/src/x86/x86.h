@@ -13,18 +13,35 @@
 #define STS_TG         0xf     // 32/64-bit Trap Gate
 
 // EFLAGS register
+#define FL_TF          0x00000100  // Trap Flag
 #define FL_IF          0x00000200  // Interrupt Enable
+#define FL_DF          0x00000400  // Direction Flag
+#define FL_AC          0x00040000  // Alignment Check
 
 // Control Register flags
 #define CR0_PE         0x00000001  // Protection Enable
+#define CR0_WP         0x00010000  // Write Protect
 #define CR0_PG         0x80000000  // Paging
 #define CR4_PAE        0x00000020  // Physical Address Extension
+#define CR4_PGE        0x00000080  // Page Global Enable
+#define CR4_PCIDE      0x00020000  // Process-Context Identifiers Enable
+#define CR3_NOFLUSH    (1ULL << 63) // Keep TLB entries tagged with the PCID
+
+// Model specific registers
+#define MSR_EFER       0xc0000080  // Extended Feature Enable
+#define MSR_STAR       0xc0000081  // SYSCALL/SYSRET segment selectors
+#define MSR_LSTAR      0xc0000082  // SYSCALL entry point (64-bit)
+#define MSR_FMASK      0xc0000084  // RFLAGS bits cleared by SYSCALL
+#define MSR_GS_BASE    0xc0000101
+#define MSR_KGS_BASE   0xc0000102  // GS base swapped in by SWAPGS
+#define EFER_SCE       0x00000001  // SYSCALL/SYSRET Enable
 
 // Page table/directory entry flags
 #define PTE_P          0x001   // Present
 #define PTE_W          0x002   // Writeable
 #define PTE_U          0x004   // User
 #define PTE_PS         0x080   // Large Page (1 GiB or 2 MiB)
+#define PTE_G          0x100   // Global (survives CR3 writes)
 
 // GDT selectors
 #define KSEL(seg)      (((seg) << 3) | DPL_KERN)
@@ -280,6 +297,32 @@ static inline void set_cr0(uintptr_t cr0) {
   asm volatile ("mov %0, %%cr0" : : "r"(cr0));
 }
 
+static inline uintptr_t get_cr4(void) {
+  volatile uintptr_t val;
+  asm volatile ("mov %%cr4, %0" : "=r"(val));
+  return val;
+}
+
+static inline void set_cr4(uintptr_t cr4) {
+  asm volatile ("mov %0, %%cr4" : : "r"(cr4));
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+  uint32_t lo, hi;
+  asm volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t val) {
+  asm volatile ("wrmsr" : : "c"(msr), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)));
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx,
+                         uint32_t *ecx, uint32_t *edx) {
+  asm volatile ("cpuid"
+    : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
 static inline void set_idt(void *idt, int size) {
   static volatile struct {
     int16_t size;
@@ -320,6 +363,10 @@ static inline void set_cr3(void *pdir) {
   asm volatile ("mov %0, %%cr3" : : "r"(pdir));
 }
 
+static inline void invlpg(uintptr_t va) {
+  asm volatile ("invlpg (%0)" : : "r"(va) : "memory");
+}
+
 static inline int xchg(int *addr, int newval) {
   int result;
   asm volatile ("lock xchg %0, %1":
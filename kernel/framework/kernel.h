@@ -24,6 +24,8 @@ MODULE(pmm)
   void (*init)();
   void *(*alloc)(size_t size);
   void (*free)(void *ptr);
+  void *(*alloc_large)();
+  void (*free_large)(void *ptr);
 };
 
 typedef struct task task_t;
@@ -54,6 +56,7 @@ MODULE(dev)
 // Forward declarations for file operations
 struct file;
 struct kstat;
+struct vma;
 
 typedef struct procinfo procinfo_t;
 MODULE(uproc)
@@ -63,7 +66,15 @@ MODULE(uproc)
   int (*fork)(task_t *task);
   int (*wait)(task_t *task, int pid, int *status, int options);
   int (*exit)(task_t *task, int status);
-  void *(*mmap)(task_t *task, void *addr, int length, int prot, int flags);
+  void *(*mmap)(task_t *task, void *addr, size_t length, int prot, int flags, struct file *f, off_t offset);
+  int (*munmap)(task_t *task, void *addr, size_t length);
+  int (*vdso)(task_t *task);
+  int (*mprotect)(task_t *task, void *addr, size_t length, int prot);
+  int (*madvise)(task_t *task, void *addr, size_t length, int advice);
+  int (*pgfault)(task_t *task, uintptr_t addr, int write);
+  int (*kfault)(task_t *task, uintptr_t addr, int write);
+  void *(*upage)(task_t *task, uintptr_t addr);
+  void (*release)(AddrSpace *as, struct vma *vmas);
   int (*getpid)(task_t *task);
   int (*getppid)(task_t *task);
   int (*sleep)(task_t *task, int seconds);
@@ -73,6 +84,41 @@ MODULE(uproc)
 typedef long off_t;
 typedef long ssize_t;
 
+struct page;
+MODULE(pgcache)
+{
+  void (*init)();
+  struct page *(*get)(uint64_t key, uint64_t index, struct file *f);
+  struct page *(*lookup)(void *pa);
+  void (*dup)(struct page *pg);
+  void (*put)(struct page *pg);
+  void (*mark_dirty)(struct page *pg);
+  int (*writeback)(struct page *pg, struct file *f);
+  uint64_t (*key)(struct file *f);
+  ssize_t (*read)(struct file *f, void *buf, size_t n, uint64_t off);
+  ssize_t (*write)(struct file *f, const void *buf, size_t n, uint64_t off);
+  int (*sync)(uint64_t key);
+  int (*syncfs)(uint32_t id);
+  int (*syncall)();
+  void (*truncate)(uint64_t key, uint64_t size);
+};
+
+MODULE(swapper)
+{
+  void (*init)();
+  int (*out)(void *pa);
+  void (*in)(int slot, void *pa);
+  void (*free)(int slot);
+  int (*used)();
+};
+
+MODULE(dcache)
+{
+  void (*init)();
+};
+
+struct wait_queue;
+struct poll_table;
 MODULE(vfs)
 {
   // Filesystem operations
@@ -93,11 +139,63 @@ MODULE(vfs)
   void (*close)(struct file *f);
   ssize_t (*read)(struct file *f, void *buf, size_t count);
   ssize_t (*write)(struct file *f, const void *buf, size_t count);
+  ssize_t (*readv)(struct file *f, const struct iovec *iov, int iovcnt);
+  ssize_t (*writev)(struct file *f, const struct iovec *iov, int iovcnt);
+  ssize_t (*pread)(struct file *f, void *buf, size_t count, off_t offset);
+  ssize_t (*pwrite)(struct file *f, const void *buf, size_t count, off_t offset);
+  ssize_t (*copy)(struct file *out, off_t *out_off, struct file *in, off_t *in_off, size_t count);
   off_t (*seek)(struct file *f, off_t offset, int whence);
   int (*stat)(struct file *f, struct stat *stat);
+  int (*fsync)(struct file *f);
+  int (*sync)(void);
+  int (*syncfs)(struct file *f);
+  int (*poll)(struct file *f, struct poll_table *pt);
   int (*pipe)(struct file* pipefd[2]);
 };
 
+struct fdtable;
+MODULE(fdt)
+{
+  struct fdtable *(*create)();
+  struct fdtable *(*dup)(struct fdtable *t);
+  void (*release)(struct fdtable *t);
+  struct file *(*get)(task_t *task, int fd);
+  int (*alloc)(task_t *task, struct file *f, int from);
+  struct file *(*install)(task_t *task, int fd, struct file *f);
+  struct file *(*remove)(task_t *task, int fd);
+};
+
+MODULE(poll)
+{
+  void (*init)();
+  void (*queue_init)(struct wait_queue *wq);
+  void (*wait)(struct wait_queue *wq, struct poll_table *pt);
+  void (*wake)(struct wait_queue *wq);
+  int (*poll)(task_t *task, struct pollfd *fds, int nfds, int64_t timeout_us);
+  struct file *(*epoll_create)();
+  int (*epoll_ctl)(struct file *ep, int op, int fd, struct file *f, struct epoll_event *ev);
+  int (*epoll_wait)(struct file *ep, struct epoll_event *events, int maxevents, int64_t timeout_us);
+  int (*epoll_poll)(struct file *ep, struct poll_table *pt);
+  void (*epoll_release)(void *ep);
+};
+
+struct syscall_stat;
+struct strace_rec;
+MODULE(sysstat)
+{
+  void (*init)();
+  void (*account)(task_t *task, int nr, const uint64_t args[6], uint64_t ret, uint64_t cycles);
+  int64_t (*stats)(struct syscall_stat *buf, size_t n);
+  int (*trace)(task_t *task, int on);
+  int64_t (*read)(struct strace_rec *buf, size_t n);
+};
+
+MODULE(ioring)
+{
+  int64_t (*setup)(task_t *task, uint32_t entries);
+  int64_t (*enter)(task_t *task, uint32_t to_submit, uint32_t min_complete, uint32_t flags);
+};
+
 MODULE(syscall)
 {
   uint64_t (*chdir)(task_t *task, const char *path);
@@ -116,6 +214,10 @@ MODULE(syscall)
   uint64_t (*sbrk)(task_t *task, intptr_t increment);
   uint64_t (*munmap)(task_t *task, void *addr, size_t length);
   uint64_t (*mmap)(task_t *task, void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+  uint64_t (*mprotect)(task_t *task, void *addr, size_t length, int prot);
+  uint64_t (*madvise)(task_t *task, void *addr, size_t length, int advice);
+  uint64_t (*getrlimit)(task_t *task, int resource, struct rlimit *rlim);
+  uint64_t (*setrlimit)(task_t *task, int resource, const struct rlimit *rlim);
   uint64_t (*times)(task_t *task, struct tms *buf);
   uint64_t (*uname)(task_t *task, struct utsname *buf);
   uint64_t (*sched_yield)(task_t *task);
@@ -125,5 +227,21 @@ MODULE(syscall)
   uint64_t (*execve)(task_t *task, const char *pathname, char *const argv[], char *const envp[]);
   uint64_t (*read)(task_t *task, int fd, char *buf, size_t count);
   uint64_t (*write)(task_t *task, int fd, const char *buf, size_t count);
+  uint64_t (*readv)(task_t *task, int fd, const struct iovec *iov, int iovcnt);
+  uint64_t (*writev)(task_t *task, int fd, const struct iovec *iov, int iovcnt);
+  uint64_t (*pread64)(task_t *task, int fd, char *buf, size_t count, off_t offset);
+  uint64_t (*pwrite64)(task_t *task, int fd, const char *buf, size_t count, off_t offset);
+  uint64_t (*sendfile)(task_t *task, int out_fd, int in_fd, off_t *offset, size_t count);
+  uint64_t (*copy_file_range)(task_t *task, int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len, unsigned flags);
+  uint64_t (*splice)(task_t *task, int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len, unsigned flags);
   uint64_t (*close)(task_t *task, int fd);
+  uint64_t (*ppoll)(task_t *task, struct pollfd *fds, int nfds, const struct timespec *timeout, const void *sigmask);
+  uint64_t (*pselect6)(task_t *task, int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, const struct timespec *timeout, const void *sigmask);
+  uint64_t (*epoll_create1)(task_t *task, int flags);
+  uint64_t (*epoll_ctl)(task_t *task, int epfd, int op, int fd, struct epoll_event *event);
+  uint64_t (*epoll_pwait)(task_t *task, int epfd, struct epoll_event *events, int maxevents, int timeout, const void *sigmask);
+  uint64_t (*sync)(task_t *task);
+  uint64_t (*fsync)(task_t *task, int fd);
+  uint64_t (*fdatasync)(task_t *task, int fd);
+  uint64_t (*syncfs)(task_t *task, int fd);
 };
\ No newline at end of file
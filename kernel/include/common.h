@@ -9,6 +9,17 @@
 #define TRACE_EXIT ((void)0)
 #endif
 #define PTE_ADDR(pte) ((pte) & 0x000ffffffffff000ULL)
+#define PTE_P 0x001
+#define PTE_W 0x002
+#define PTE_A 0x020
+#define PTE_D 0x040
+#define PTE_PS 0x080
+// 不在位的页表项中标记该页已换出，槽位号存放在地址字段
+#define PTE_SWAP 0x200
+// PROT_NONE 区域中不在位的页表项仍保存页框地址
+#define PTE_NONE 0x400
+#define PGSIZE 4096
+#define LPGSIZE (2 << 20)
 #define STACK_SIZE (1 << 16)
 #define FENCE_PATTERN 0xABCDABCD
 #define TASK_READY 1
@@ -21,8 +32,15 @@
 #define MAX_ARG 32
 #define UVMEND 0x108000000000
 #define UVSTART 0x100000000000
-#define NFILE 100
-#define NOFILE 16
+#define UVMMAP 0x104000000000
+#define UVMMAPEND 0x107000000000
+// 用户栈自动增长的上限
+#ifndef USTACK_LIMIT
+#define USTACK_LIMIT (8 << 20)
+#endif
+// 文件描述符表的初始大小与上限，均为 64 的倍数
+#define NOFILE 64
+#define NOFILE_MAX 1024
 #include <kernel.h>
 #include <klib.h>
 #include <klib-macros.h>
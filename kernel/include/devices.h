@@ -4,6 +4,7 @@ typedef struct devops {
     int (*init)(device_t *dev);
     int (*read)(device_t *dev, size_t offset, void *buf, int count);
     int (*write)(device_t *dev, size_t offset, const void *buf, int count);
+    int (*poll)(device_t *dev, struct poll_table *pt); // NULL: always ready
 } devops_t;
 extern devops_t tty_ops, fb_ops, sd_ops, input_ops;
 
@@ -85,6 +86,7 @@ struct tty_queue {
 
 typedef struct {
     sem_t cooked;
+    struct wait_queue wq; // pollers waiting for a cooked line
     spinlock_t lock;
     device_t *fbdev;
     int display;
@@ -99,6 +101,7 @@ typedef struct {
 // SCSI (Standard) Disk
 
 typedef struct {
+    spinlock_t lock; // one transfer at a time, buf is shared
     uint32_t blkcnt, blksz;
     uint8_t *buf;
 } sd_t;
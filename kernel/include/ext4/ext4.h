@@ -65,6 +65,31 @@ struct ext4_lock {
 	void (*unlock)(void);
 };
 
+/********************************OS NAME CACHE INTERFACE********************/
+
+/**@brief   OS name cache consulted by path walks, keyed by
+ *          (file system, parent i-node, name). One for all mount
+ *          points, @p fs telling their i-node numbers apart.*/
+struct ext4_dcache {
+
+	/**@brief   Look a name up.
+	 * @return  1 if cached with @p inode and @p imode set, 0 if cached
+	 *          as absent, -1 if not cached.*/
+	int (*lookup)(const void *fs, uint32_t parent, const char *name,
+		      uint32_t len, uint32_t *inode, uint32_t *imode);
+
+	/**@brief   Remember a name, @p inode 0 meaning it does not exist.*/
+	void (*insert)(const void *fs, uint32_t parent, const char *name,
+		       uint32_t len, uint32_t inode, uint32_t imode);
+
+	/**@brief   Forget a name, its entry is being added or removed.*/
+	void (*invalidate)(const void *fs, uint32_t parent, const char *name,
+			   uint32_t len);
+
+	/**@brief   Forget every name of a file system being unmounted.*/
+	void (*drop)(const void *fs);
+};
+
 /********************************FILE DESCRIPTOR*****************************/
 
 /**@brief   File descriptor. */
@@ -219,6 +244,11 @@ int ext4_mount_point_stats(const char *mount_point,
 int ext4_mount_setup_locks(const char *mount_point,
 			   const struct ext4_lock *locks);
 
+/**@brief   Setup the OS name cache.
+ *
+ * @param   dcache  Cache routines, NULL to walk the disk every time.*/
+void ext4_setup_dcache(const struct ext4_dcache *dcache);
+
 /**@brief   Acquire the filesystem superblock pointer of a mp.
  *
  * @param   mount_point Mount point.
@@ -388,6 +418,29 @@ uint64_t ext4_ftell(ext4_file *file);
  * @return  File size. */
 uint64_t ext4_fsize(ext4_file *file);
 
+/**@brief   Locate a file byte on the block device, e.g. for swap files.
+ *
+ * @param   file File handle.
+ * @param   pos File position.
+ * @param   dev_off Byte offset of @p pos on the block device.
+ * @param   bsize Block size; the mapping holds up to the end of the block.
+ *
+ * @return  Standard error code, ENOENT for holes. */
+int ext4_fbmap(ext4_file *file, uint64_t pos, uint64_t *dev_off, uint32_t *bsize);
+
+/**@brief   Open a file by i-node number, e.g. to write back cached
+ *          pages after every path to it was closed. The size and
+ *          link count are read into @p file.
+ *
+ * @param   file File handle.
+ * @param   mp Mount point holding the i-node.
+ * @param   ino I-node number.
+ * @param   flags O_RDONLY, O_RDWR...
+ *
+ * @return  Standard error code. */
+int ext4_fopen_ino(ext4_file *file, struct ext4_mountpoint *mp, uint32_t ino,
+		   uint32_t flags);
+
 
 /**@brief Get inode of file/directory/link.
  *
@@ -615,11 +668,37 @@ int ext4_dir_close(ext4_dir *dir);
  * @return  Directory entry id (NULL if no entry)*/
 const ext4_direntry *ext4_dir_entry_next(ext4_dir *dir);
 
+/**@brief   Callback of @ref ext4_dir_entry_fill.
+ *
+ * @param   arg Caller data.
+ * @param   de Directory entry, valid during the call only.
+ * @param   next_off Offset of the entry after it.
+ *
+ * @return  Non zero to stop before this entry.*/
+typedef int (*ext4_dir_filler)(void *arg, const ext4_direntry *de,
+			       uint64_t next_off);
+
+/**@brief   Pass directory entries to a callback under one inode
+ *          reference and lookup, until it stops or the end is reached.
+ *
+ * @param   dir Directory handle.
+ * @param   filler Callback, the entry it refuses is returned next time.
+ * @param   arg Passed to the callback.
+ *
+ * @return  Standard error code.*/
+int ext4_dir_entry_fill(ext4_dir *dir, ext4_dir_filler filler, void *arg);
+
 /**@brief   Rewine directory entry offset.
  *
  * @param   dir Directory handle.*/
 void ext4_dir_entry_rewind(ext4_dir *dir);
 
+/**@brief   Continue from an offset passed to a @ref ext4_dir_filler.
+ *
+ * @param   dir Directory handle.
+ * @param   off Entry offset.*/
+void ext4_dir_entry_seek(ext4_dir *dir, uint64_t off);
+
 
 #ifdef __cplusplus
 }
@@ -129,6 +129,11 @@ extern "C"
 #define CONFIG_BLOCK_DEV_CACHE_SIZE 8
 #endif
 
+/**@brief   Number of decoded i-nodes kept in memory.*/
+#ifndef CONFIG_INODE_CACHE_SIZE
+#define CONFIG_INODE_CACHE_SIZE 64
+#endif
+
 /**@brief   Maximum block device name*/
 #ifndef CONFIG_EXT4_MAX_BLOCKDEV_NAME
 #define CONFIG_EXT4_MAX_BLOCKDEV_NAME 32
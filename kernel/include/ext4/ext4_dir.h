@@ -219,6 +219,15 @@ void ext4_dir_write_entry(struct ext4_sblock *sb, struct ext4_dir_en *en,
 			  uint16_t entry_len, struct ext4_inode_ref *child,
 			  const char *name, size_t name_len);
 
+/**@brief Drop a name from the OS name cache, if there is one.
+ * @param fs     File system of the directory
+ * @param parent Directory i-node number
+ * @param name   Name of the entry
+ * @param name_len  Name length
+ */
+void ext4_dcache_invalidate(const struct ext4_fs *fs, uint32_t parent,
+			    const char *name, uint32_t name_len);
+
 /**@brief Add new entry to the directory.
  * @param parent Directory i-node
  * @param name   Name of new entry
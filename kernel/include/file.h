@@ -0,0 +1,14 @@
+#ifndef FILE_H
+#define FILE_H
+#include <common.h>
+
+// A process's file descriptor table, owned and touched only by its task
+struct fdtable
+{
+    int size;          // number of slots, doubled on demand up to NOFILE_MAX
+    int count;         // descriptors in use
+    struct file **fd;  // descriptor -> open file
+    uint64_t *used;    // bitmap of the descriptors in use
+};
+
+#endif // FILE_H
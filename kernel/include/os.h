@@ -28,8 +28,7 @@ struct task
     void *fence;            // 用于检测栈溢出的栅栏
     char stack[STACK_SIZE]; // 任务栈区域
 
-    // 新增的进程级文件描述符表
-    struct file *open_files[NOFILE];
+    struct fdtable *files; // 进程级文件描述符表，按需扩容
     void *chan; // 用于等待的信道
 };
 struct semaphore
@@ -39,6 +38,34 @@ struct semaphore
     spinlock_t lock;   // 信号量内部锁
     task_t *wait_list; // 等待信号量的任务列表
 };
+struct wait_entry
+{
+    void (*func)(struct wait_entry *we); // 唤醒时调用，调用时持有队列锁
+    void *priv;                          // func 的私有数据
+    struct wait_queue *wq;               // 所在的等待队列
+    struct wait_entry *next;
+};
+struct wait_queue
+{
+    spinlock_t lock;         // 队列锁
+    struct wait_entry *head; // 挂在队列上的等待者
+};
+struct poll_table
+{
+    void (*queue)(struct poll_table *pt, struct wait_queue *wq); // 把调用者挂到 wq 上
+};
+struct vma
+{
+    uintptr_t start;   // 起始地址（页对齐）
+    uintptr_t end;     // 结束地址（页对齐）
+    int prot;          // PROT_READ/PROT_WRITE/PROT_EXEC
+    int flags;         // MAP_SHARED/MAP_PRIVATE/MAP_ANONYMOUS
+    struct file *file; // 映射的文件，匿名映射为 NULL
+    off_t offset;      // 文件偏移（页对齐）
+    uint64_t key;      // 页缓存中的对象标识
+    int advice;        // madvise 记录的访问模式
+    struct vma *next;  // 按起始地址排序的链表
+};
 struct procinfo
 {
     int pid;
@@ -47,6 +74,15 @@ struct procinfo
     AddrSpace as;
     char *cwd;
     void *brk;
+    struct vma *vmas;
+    size_t rss;       // 驻留的用户页数（4K 为单位）
+    size_t ptpages;   // 页表占用的页数
+    size_t rss_limit; // 驻留页数上限，0 表示不限
+    int killed;       // 已被 OOM killer 选中，下次调度时退出
+    uintptr_t clock_hand; // 换出时时钟算法扫描到的地址
+    struct io_ring *ring; // 提交/完成环在用户空间的地址，NULL 表示未建立
+    uint32_t ring_entries; // 建立时确定的环长度，不信任用户空间中的副本
+    int traced;            // 系统调用记录到 strace 环中，fork 和 execve 后保留
 };
 struct handler_record
 {
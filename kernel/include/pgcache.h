@@ -0,0 +1,44 @@
+#ifndef PGCACHE_H
+#define PGCACHE_H
+#include <common.h>
+#define PG_DIRTY 0x1
+#define PG_ORPHAN 0x2 // dropped from its object while still referenced
+#define PGCACHE_BUCKETS 256
+// Unreferenced file pages kept for reuse, as a share of the heap
+#define PGCACHE_SHARE 8
+// Readahead windows of sequential readers grow between these, in pages
+#define PGCACHE_RA_MIN 4
+#define PGCACHE_RA_MAX 32
+// Readahead windows waiting for the readahead worker
+#define PGCACHE_RA_QUEUE 16
+// The flusher wakes this often (us), writes back pages dirty for longer
+// than PGCACHE_DIRTY_EXPIRE (us), or every dirty page once more than
+// PGCACHE_DIRTY_RATIO percent of the cached file pages are dirty
+#define PGCACHE_FLUSH_INTERVAL 1000000
+#define PGCACHE_DIRTY_EXPIRE 5000000
+#define PGCACHE_DIRTY_RATIO 10
+// Longest run of adjacent dirty pages written back at once
+#define PGCACHE_WB_MAX 32
+// File pages are keyed by the mount and the i-node number, so the
+// i-nodes of different mounts stay apart; anonymous shared objects
+// live above every file key
+#define PGCACHE_FILE_KEY(mnt, ino) ((uint64_t)(mnt) << 32 | (ino))
+#define PGCACHE_INO(key) ((uint32_t)(key))
+#define PGCACHE_ANON_KEY (1ULL << 63)
+
+// A physical page cached on behalf of a file (or an anonymous shared object)
+struct page
+{
+    uint64_t key;       // PGCACHE_FILE_KEY of a file page, or an anonymous object id
+    uint64_t index;     // page index inside the object
+    void *pa;           // backing frame
+    void *mp;           // ext4 mount point of the file, for writeback
+    int ref;            // number of mappings and I/O calls holding this page
+    int flags;          // PG_DIRTY, PG_ORPHAN
+    uint64_t dirtied;   // uptime (us) when it last became dirty
+    struct page *hnext; // (key, index) hash chain
+    struct page *pnext; // frame hash chain
+    struct page *prev, *next; // LRU list of unreferenced file pages
+};
+
+#endif // PGCACHE_H
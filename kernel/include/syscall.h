@@ -11,12 +11,28 @@
 #define SYS_getdents64 61
 #define SYS_read 63
 #define SYS_write 64
+#define SYS_readv 65
+#define SYS_writev 66
+#define SYS_pread64 67
+#define SYS_pwrite64 68
+#define SYS_sendfile 71
+#define SYS_splice 76
+#define SYS_copy_file_range 285
+#define SYS_pselect6 72
+#define SYS_ppoll 73
+#define SYS_epoll_create1 20
+#define SYS_epoll_ctl 21
+#define SYS_epoll_pwait 22
 #define SYS_linkat 37
 #define SYS_unlinkat 35
 #define SYS_mkdirat 34
 #define SYS_umount2 39
 #define SYS_mount 40
 #define SYS_fstat 80
+#define SYS_sync 81
+#define SYS_fsync 82
+#define SYS_fdatasync 83
+#define SYS_syncfs 267
 #define SYS_clone 220
 #define SYS_execve 221
 #define SYS_wait4 260
@@ -26,11 +42,21 @@
 #define SYS_sbrk 214
 #define SYS_munmap 215
 #define SYS_mmap 222
+#define SYS_mprotect 226
+#define SYS_madvise 233
 #define SYS_times 153
 #define SYS_uname 160
 #define SYS_sched_yield 124
 #define SYS_gettimeofday 169
 #define SYS_nanosleep 101
+#define SYS_getrlimit 163
+#define SYS_setrlimit 164
+#define SYS_io_uring_setup 425
+#define SYS_io_uring_enter 426
+#define SYS_sysstat 500
+#define SYS_strace 501
+#define SYS_strace_read 502
+#define NR_SYSCALL 512 // 系统调用号的上界
 
 #ifndef __ASSEMBLER__
 #ifndef __SYSCALL_H
@@ -76,6 +102,9 @@ typedef int64_t clock_t;
 #define O_NONBLOCK 04000
 #define O_DIRECTORY 0200000
 #define O_CLOEXEC 02000000
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
 
 /* mmap 相关常量 */
 #define PROT_READ 0x1
@@ -84,8 +113,23 @@ typedef int64_t clock_t;
 #define PROT_NONE 0x0
 #define MAP_SHARED 0x01
 #define MAP_PRIVATE 0x02
+#define MAP_FIXED 0x10
 #define MAP_ANONYMOUS 0x20
+#define MAP_GROWSDOWN 0x0100
 #define MAP_ANON MAP_ANONYMOUS
+#define MAP_FAILED ((void *)-1)
+#define MADV_NORMAL 0
+#define MADV_RANDOM 1
+#define MADV_SEQUENTIAL 2
+#define MADV_WILLNEED 3
+#define MADV_DONTNEED 4
+
+/* 资源限制相关常量 */
+#define RLIMIT_RSS 5
+#define RLIM_INFINITY (~0UL)
+
+/* 信号编号 */
+#define SIGKILL 9
 
 /* wait 相关常量 */
 #define WNOHANG 1
@@ -109,6 +153,76 @@ struct timespec
     long tv_nsec;
 };
 
+/* 向量 I/O 的缓冲区描述 */
+#define IOV_MAX 1024
+struct iovec
+{
+    void *iov_base;
+    size_t iov_len;
+};
+
+/* poll 事件位 */
+#define POLLIN 0x001
+#define POLLPRI 0x002
+#define POLLOUT 0x004
+#define POLLERR 0x008
+#define POLLHUP 0x010
+#define POLLNVAL 0x020
+struct pollfd
+{
+    int fd;        // 文件描述符，负数表示忽略
+    short events;  // 关心的事件
+    short revents; // 内核返回的就绪事件
+};
+
+/* select 的描述符集合 */
+#define FD_SETSIZE 1024
+typedef struct
+{
+    uint64_t fds_bits[FD_SETSIZE / 64];
+} fd_set;
+#define FD_ZERO(s) memset((s), 0, sizeof(fd_set))
+#define FD_SET(fd, s) ((s)->fds_bits[(fd) / 64] |= 1UL << ((fd) % 64))
+#define FD_CLR(fd, s) ((s)->fds_bits[(fd) / 64] &= ~(1UL << ((fd) % 64)))
+#define FD_ISSET(fd, s) (((s)->fds_bits[(fd) / 64] >> ((fd) % 64)) & 1)
+
+/* epoll 事件位与 epoll_ctl 操作，事件位与 poll 相同 */
+#define EPOLLIN POLLIN
+#define EPOLLPRI POLLPRI
+#define EPOLLOUT POLLOUT
+#define EPOLLERR POLLERR
+#define EPOLLHUP POLLHUP
+#define EPOLLONESHOT (1U << 30) // 报告一次后停用，直到 EPOLL_CTL_MOD
+#define EPOLLET (1U << 31)      // 边沿触发
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+#define EPOLL_MAX_EVENTS 1024
+typedef union epoll_data
+{
+    void *ptr;
+    int fd;
+    uint32_t u32;
+    uint64_t u64;
+} epoll_data_t;
+struct epoll_event
+{
+    uint32_t events;   // EPOLL* 事件位
+    epoll_data_t data; // 原样带回
+} __attribute__((packed));
+
+/* 时钟编号，两者都从启动时刻开始计时 */
+#define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
+
+/* 每个进程只读映射的时钟页，用户态据此用 rdtsc 计算时间 */
+#define VDSO_ADDR 0x107000000000
+struct vdso_clock
+{
+    uint32_t freq_mhz; // 每微秒的 TSC 周期数
+    uint64_t uptsc;    // 启动时的 TSC 读数
+};
+
 /* 统计信息结构体 */
 struct stat
 {
@@ -136,6 +250,68 @@ struct tms
     clock_t tms_cstime;
 };
 
+/* 提交/完成环：环头之后依次是 entries 个提交项和 entries 个完成项 */
+#define IORING_MAX_ENTRIES 4096
+#define IORING_OP_READ 0
+#define IORING_OP_WRITE 1
+#define IORING_OP_OPENAT 2
+#define IORING_OP_CLOSE 3
+#define IORING_OP_FSTAT 4
+struct io_ring
+{
+    uint32_t sq_head; // 内核取走提交项的位置
+    uint32_t sq_tail; // 用户放入提交项的位置
+    uint32_t cq_head; // 用户取走完成项的位置
+    uint32_t cq_tail; // 内核放入完成项的位置
+    uint32_t entries; // 两个队列的长度（2 的幂）
+    uint32_t pad;
+};
+struct io_sqe
+{
+    uint8_t opcode;     // IORING_OP_*
+    uint8_t pad[3];
+    int32_t fd;         // 文件描述符，openat 时为目录
+    uint64_t addr;      // 缓冲区、路径或 struct stat 的地址
+    uint64_t len;       // 读写长度，openat 时为 mode
+    uint32_t flags;     // openat 的 flags
+    uint32_t pad2;
+    uint64_t user_data; // 原样带回完成项
+};
+struct io_cqe
+{
+    uint64_t user_data;
+    int64_t res; // 对应系统调用的返回值
+};
+#define IORING_SQES(r) ((struct io_sqe *)((r) + 1))
+#define IORING_CQES(r, n) ((struct io_cqe *)(IORING_SQES(r) + (n)))
+#define IORING_SIZE(n) (sizeof(struct io_ring) + (n) * (sizeof(struct io_sqe) + sizeof(struct io_cqe)))
+
+/* 系统调用统计，sysstat 按调用号返回所有 CPU 的总和 */
+#define SYSCALL_HIST 32
+struct syscall_stat
+{
+    uint64_t count;              // 调用次数
+    uint64_t errors;             // 返回负值的次数
+    uint64_t cycles;             // 累计耗时（TSC 周期）
+    uint32_t hist[SYSCALL_HIST]; // hist[i] 统计耗时在 [2^i, 2^(i+1)) 周期内的调用
+};
+/* strace 记录 */
+struct strace_rec
+{
+    int pid;
+    int nr;
+    uint64_t args[6];
+    int64_t ret;
+    uint64_t cycles;
+};
+
+/* 资源限制结构体 */
+struct rlimit
+{
+    uint64_t rlim_cur;
+    uint64_t rlim_max;
+};
+
 /* 系统信息结构体 */
 struct utsname
 {
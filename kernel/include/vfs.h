@@ -3,6 +3,78 @@
 #include <syscall.h>
 #define VFS_SUCCESS 0
 #define VFS_ERROR -1
+#define VFS_COPY_CHUNK (16 * PGSIZE) // in-kernel copies move this much per step
+#define VFS_MOUNTS 8                 // filesystems mounted at once
+// Readahead state of an open file
+struct file_ra
+{
+    uint64_t pos;    // where a sequential reader goes on, 0 when opened
+    uint64_t ahead;  // first page not read ahead yet
+    uint32_t window; // pages of the last readahead, 0 after a seek
+};
+
+struct file;
+struct mount;
+
+// Where getdents64 packs the entries handed to dir_emit
+struct dir_context
+{
+    void *pos;   // where the next record goes
+    size_t left; // room left in the buffer
+};
+
+// What an open file or directory of a filesystem does; NULL entries fail
+struct file_ops
+{
+    bool cached; // data goes through the page cache, so it can be mmapped
+    void (*close)(struct file *f);
+    ssize_t (*read)(struct file *f, void *buf, size_t n); // at the file position
+    ssize_t (*write)(struct file *f, const void *buf, size_t n);
+    ssize_t (*pread)(struct file *f, void *buf, size_t n, uint64_t off);
+    ssize_t (*pwrite)(struct file *f, const void *buf, size_t n, uint64_t off);
+    off_t (*seek)(struct file *f, off_t off, int whence);
+    int (*readdir)(struct file *f, struct dir_context *ctx); // 1 if entries are left, 0 at the end
+    int (*stat)(struct file *f, struct stat *st);
+    int (*fsync)(struct file *f); // NULL when nothing needs writing
+};
+
+// Operations on the names of a filesystem; paths are relative to the
+// mount point, without a leading slash
+struct inode_ops
+{
+    int (*open)(struct mount *m, struct file *f, const char *path, int flags); // sets type, fops, ptr
+    int (*mkdir)(struct mount *m, const char *path);
+    int (*rmdir)(struct mount *m, const char *path);
+    int (*unlink)(struct mount *m, const char *path);
+    int (*link)(struct mount *m, const char *oldpath, const char *newpath);
+    int (*rename)(struct mount *m, const char *oldpath, const char *newpath);
+};
+
+// A filesystem type, mounted by name
+struct fs_ops
+{
+    const char *name;
+    void (*init)(void);
+    int (*mount)(struct mount *m, const char *source); // sets priv
+    int (*umount)(struct mount *m);
+    int (*sync)(struct mount *m);
+    const struct inode_ops *iops;
+};
+
+// A filesystem mounted on a directory
+struct mount
+{
+    char *path; // normalized mount point, NULL while the slot is free
+    int len;
+    uint32_t id;  // never reused, tells the i-nodes of different mounts apart
+    int ref;      // open files and path operations in flight, umount needs none
+    bool going;   // being unmounted, path lookups fail meanwhile
+    const struct fs_ops *ops;
+    void *priv;   // the filesystem's own state
+};
+
+extern const struct fs_ops ext4_fs_ops, tmpfs_fs_ops;
+
 struct file
 {
     enum
@@ -11,23 +83,22 @@ struct file
         FD_FILE,
         FD_DIR,
         FD_DEVICE,
-        FD_PIPE
+        FD_PIPE,
+        FD_EPOLL
     } type;
     int ref; // reference count
     char readable;
     char writable;
     uint32_t off;
-    char path[PATH_MAX]; // Add path to file struct
-    void *ptr;           // Pointer to ext4_file, ext4_dir, etc.
+    char *path;      // path the file was opened by, NULL for devices and pipes
+    void *ptr;       // Pointer to ext4_file, ext4_dir, etc.; free list link while unused
     spinlock_t lock; // Lock for file operations
+    struct file_ra ra;
+    const struct file_ops *fops; // set for files of a filesystem
+    struct mount *mnt;           // the mount they are on
 };
 
-// System-wide open file table
-struct file_table
-{
-    spinlock_t lock;
-    struct file file[NFILE];
-};
+int dir_emit(struct dir_context *ctx, const char *name, int len, uint32_t ino, uint8_t type, uint64_t next_off);
 
 struct pipe {
   struct spinlock lock;
@@ -36,6 +107,7 @@ struct pipe {
   uint32_t nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  struct wait_queue wq; // pollers of either end
 };
 
 #endif // VFS_H
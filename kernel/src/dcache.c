@@ -0,0 +1,184 @@
+#include <common.h>
+#include <ext4.h>
+#define DCACHE_BUCKETS 256
+#define DCACHE_SIZE 1024
+#define DNAME_INLINE 40 // longer names are not cached
+
+// A name in a directory, or the fact that it is absent
+struct dentry
+{
+    const void *fs;                // ext4 file system of the directory
+    uint32_t parent;               // directory i-node, 0 while unused
+    uint32_t inode;                // 0 for a negative entry
+    uint32_t imode;                // EXT4_INODE_MODE_* of a positive entry
+    uint32_t len;
+    char name[DNAME_INLINE];
+    struct dentry *hnext;          // hash chain
+    struct dentry *prev, *next;    // LRU list, most recently used first
+};
+
+static spinlock_t dcache_lock;
+static struct dentry dentries[DCACHE_SIZE];
+static struct dentry *buckets[DCACHE_BUCKETS];
+static struct dentry lru; // list head, lru.prev is the next victim
+
+static inline int hash_name(const void *fs, uint32_t parent, const char *name, uint32_t len)
+{
+    uint32_t h = (2166136261u ^ parent) + (uint32_t)((uintptr_t)fs >> 4);
+    for (uint32_t i = 0; i < len; i++)
+    {
+        h = (h ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return h % DCACHE_BUCKETS;
+}
+
+static void lru_unlink(struct dentry *d)
+{
+    d->prev->next = d->next;
+    d->next->prev = d->prev;
+}
+
+static void lru_push(struct dentry *d)
+{
+    d->next = lru.next;
+    d->prev = &lru;
+    lru.next->prev = d;
+    lru.next = d;
+}
+
+static struct dentry **find_dentry(const void *fs, uint32_t parent, const char *name, uint32_t len)
+{
+    struct dentry **pp;
+    for (pp = &buckets[hash_name(fs, parent, name, len)]; *pp; pp = &(*pp)->hnext)
+    {
+        struct dentry *d = *pp;
+        if (d->fs == fs && d->parent == parent && d->len == len && memcmp(d->name, name, len) == 0)
+        {
+            break;
+        }
+    }
+    return pp;
+}
+
+/**
+ * unhash the entry at @pp and make it the next victim
+ */
+static void drop_dentry(struct dentry **pp)
+{
+    struct dentry *d = *pp;
+    *pp = d->hnext;
+    d->parent = 0;
+    lru_unlink(d);
+    d->next = &lru;
+    d->prev = lru.prev;
+    lru.prev->next = d;
+    lru.prev = d;
+}
+
+static int dcache_lookup(const void *fs, uint32_t parent, const char *name, uint32_t len, uint32_t *inode, uint32_t *imode)
+{
+    if (len > DNAME_INLINE)
+    {
+        return -1;
+    }
+    kmt->spin_lock(&dcache_lock);
+    struct dentry *d = *find_dentry(fs, parent, name, len);
+    if (d == NULL)
+    {
+        kmt->spin_unlock(&dcache_lock);
+        return -1;
+    }
+    lru_unlink(d);
+    lru_push(d);
+    *inode = d->inode;
+    *imode = d->imode;
+    kmt->spin_unlock(&dcache_lock);
+    return *inode != 0;
+}
+
+static void dcache_insert(const void *fs, uint32_t parent, const char *name, uint32_t len, uint32_t inode, uint32_t imode)
+{
+    if (len > DNAME_INLINE)
+    {
+        return;
+    }
+    kmt->spin_lock(&dcache_lock);
+    struct dentry *d = *find_dentry(fs, parent, name, len);
+    if (d == NULL)
+    {
+        // recycle the least recently used entry
+        d = lru.prev;
+        if (d->parent)
+        {
+            drop_dentry(find_dentry(d->fs, d->parent, d->name, d->len));
+        }
+        d->fs = fs;
+        d->parent = parent;
+        d->len = len;
+        memcpy(d->name, name, len);
+        int h = hash_name(fs, parent, name, len);
+        d->hnext = buckets[h];
+        buckets[h] = d;
+    }
+    d->inode = inode;
+    d->imode = imode;
+    lru_unlink(d);
+    lru_push(d);
+    kmt->spin_unlock(&dcache_lock);
+}
+
+static void dcache_invalidate(const void *fs, uint32_t parent, const char *name, uint32_t len)
+{
+    if (len > DNAME_INLINE)
+    {
+        return;
+    }
+    kmt->spin_lock(&dcache_lock);
+    struct dentry **pp = find_dentry(fs, parent, name, len);
+    if (*pp)
+    {
+        drop_dentry(pp);
+    }
+    kmt->spin_unlock(&dcache_lock);
+}
+
+/**
+ * forget the names of @fs, whose i-node numbers a file system
+ * mounted later at the same place would otherwise inherit
+ */
+static void dcache_drop(const void *fs)
+{
+    kmt->spin_lock(&dcache_lock);
+    for (int i = 0; i < DCACHE_SIZE; i++)
+    {
+        struct dentry *d = &dentries[i];
+        if (d->parent && d->fs == fs)
+        {
+            drop_dentry(find_dentry(fs, d->parent, d->name, d->len));
+        }
+    }
+    kmt->spin_unlock(&dcache_lock);
+}
+
+static const struct ext4_dcache ext4_dcache_ops = {
+    .lookup = dcache_lookup,
+    .insert = dcache_insert,
+    .invalidate = dcache_invalidate,
+    .drop = dcache_drop,
+};
+
+static void dcache_init()
+{
+    kmt->spin_init(&dcache_lock, "dcache_lock");
+    lru.next = lru.prev = &lru;
+    for (int i = 0; i < DCACHE_SIZE; i++)
+    {
+        dentries[i].parent = 0;
+        lru_push(&dentries[i]);
+    }
+    ext4_setup_dcache(&ext4_dcache_ops);
+}
+
+MODULE_DEF(dcache) = {
+    .init = dcache_init,
+};
@@ -9,6 +9,7 @@ static int sd_init(device_t *dev) {
     sd->blkcnt = io_read(AM_DISK_CONFIG).blkcnt;
     sd->blksz  = io_read(AM_DISK_CONFIG).blksz;
     sd->buf    = pmm->alloc(sd->blksz);
+    kmt->spin_init(&sd->lock, dev->name);
   }
   return 0;
 }
@@ -27,6 +28,7 @@ static int sd_read(device_t *dev, size_t offset, void *buf, int count) {
   sd_t *sd = dev->ptr;
   panic_on(!sd, "no disk");
   uint32_t pos = 0;
+  kmt->spin_lock(&sd->lock);
   for (uint32_t st = ROUNDDOWN(offset, sd->blksz); pos < count; st = offset) {
     uint32_t n = sd->blksz - (offset - st);
     if (n > count - pos) n = count - pos;
@@ -35,6 +37,7 @@ static int sd_read(device_t *dev, size_t offset, void *buf, int count) {
     pos   += n;
     offset = st + sd->blksz;
   }
+  kmt->spin_unlock(&sd->lock);
   return pos;
 }
 
@@ -42,6 +45,7 @@ static int sd_write(device_t *dev, size_t offset, const void *buf, int count) {
   sd_t *sd = dev->ptr;
   panic_on(!sd, "no disk");
   uint32_t pos = 0;
+  kmt->spin_lock(&sd->lock);
   for (uint32_t st = ROUNDDOWN(offset, sd->blksz); pos < count; st = offset) {
     uint32_t n = sd->blksz - (offset - st);
     if (n > count - pos) n = count - pos;
@@ -53,6 +57,7 @@ static int sd_write(device_t *dev, size_t offset, const void *buf, int count) {
     pos   += n;
     offset = st + sd->blksz;
   }
+  kmt->spin_unlock(&sd->lock);
   return pos;
 }
 
@@ -90,6 +90,7 @@ static int tty_cook(tty_t *tty, char ch)
     tty_enqueue(q, ch);
     tty_enqueue(q, '\0');
     kmt->sem_signal(&tty->cooked);
+    poll->wake(&tty->wq);
     break;
   case '\b':
     ret = tty_pop_back(q);
@@ -271,6 +272,7 @@ static int tty_init(device_t *ttydev)
   q->end = q->buf + TTY_COOK_BUF_SZ;
   kmt->spin_init(&tty->lock, ttydev->name);
   kmt->sem_init(&tty->cooked, "tty cooked lines", 0);
+  poll->queue_init(&tty->wq);
   welcome(ttydev);
   return 0;
 }
@@ -314,10 +316,19 @@ static int tty_write(device_t *dev, size_t offset, const void *buf, int count)
   return count;
 }
 
+// readable while a cooked line is not yet claimed by a blocked reader
+static int tty_poll(device_t *dev, struct poll_table *pt)
+{
+  tty_t *tty = dev->ptr;
+  poll->wait(&tty->wq, pt);
+  return (tty->cooked.value > 0 ? POLLIN : 0) | POLLOUT;
+}
+
 devops_t tty_ops = {
     .init = tty_init,
     .read = tty_read,
     .write = tty_write,
+    .poll = tty_poll,
 };
 
 // tty daemon
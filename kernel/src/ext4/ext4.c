@@ -114,6 +114,9 @@ static struct ext4_block_devices s_bdevices[CONFIG_EXT4_BLOCKDEVS_COUNT];
 /**@brief   Mountpoints.*/
 static struct ext4_mountpoint s_mp[CONFIG_EXT4_MOUNTPOINTS_COUNT];
 
+/**@brief   OS name cache, shared by all mount points.*/
+static const struct ext4_dcache *s_dcache;
+
 int ext4_device_register(struct ext4_blockdev *bd,
 						 const char *dev_name)
 {
@@ -488,6 +491,8 @@ int ext4_umount(const char *mount_point)
 		goto Finish;
 
 	mp->mounted = 0;
+	if (s_dcache)
+		s_dcache->drop(&mp->fs);
 
 	ext4_bcache_cleanup(mp->fs.bdev->bc);
 	ext4_bcache_fini_dynamic(mp->fs.bdev->bc);
@@ -498,19 +503,22 @@ Finish:
 	return r;
 }
 
+/*Mount points nest, so the longest name prefixing the path wins*/
 static struct ext4_mountpoint *ext4_get_mount(const char *path)
 {
+	struct ext4_mountpoint *best = NULL;
 	for (size_t i = 0; i < CONFIG_EXT4_MOUNTPOINTS_COUNT; ++i)
 	{
 
 		if (!s_mp[i].mounted)
 			continue;
 
-		if (!strncmp(s_mp[i].name, path, strlen(s_mp[i].name)))
-			return &s_mp[i];
+		if (!strncmp(s_mp[i].name, path, strlen(s_mp[i].name)) &&
+		    (!best || strlen(s_mp[i].name) > strlen(best->name)))
+			best = &s_mp[i];
 	}
 
-	return NULL;
+	return best;
 }
 
 __unused static int __ext4_journal_start(const char *mount_point)
@@ -789,6 +797,25 @@ int ext4_mount_setup_locks(const char *mount_point,
 	return EOK;
 }
 
+void ext4_setup_dcache(const struct ext4_dcache *dcache)
+{
+	s_dcache = dcache;
+}
+
+void ext4_dcache_invalidate(const struct ext4_fs *fs, uint32_t parent,
+			    const char *name, uint32_t name_len)
+{
+	if (s_dcache)
+		s_dcache->invalidate(fs, parent, name, name_len);
+}
+
+/*'.' and '..' are left out, renames rewrite '..' in place*/
+static bool ext4_dcache_cacheable(const char *name, int len)
+{
+	return s_dcache && !(name[0] == '.' && (len == 1 ||
+						  (len == 2 && name[1] == '.')));
+}
+
 /********************************FILE OPERATIONS*****************************/
 
 static int ext4_path_check(const char *path, bool *is_goal)
@@ -990,6 +1017,10 @@ static int ext4_generic_open2(ext4_file *f, const char *path, int flags,
 	struct ext4_mountpoint *mp = ext4_get_mount(path);
 	struct ext4_dir_search_result result;
 	struct ext4_inode_ref ref;
+	/*i-node reached so far; ref is only loaded for it when the name
+	  cache misses or at the end of the walk*/
+	uint32_t cur = EXT4_INODE_ROOT_INDEX;
+	bool loaded = true;
 
 	f->mp = 0;
 
@@ -1032,6 +1063,26 @@ static int ext4_generic_open2(ext4_file *f, const char *path, int flags,
 			r = ENOENT;
 			break;
 		}
+
+		bool cacheable = ext4_dcache_cacheable(path, len);
+		int hit = cacheable ? s_dcache->lookup(fs, cur, path, len, &next_inode,
+											   &imode)
+							: -1;
+		if (hit == 0 && !(f->flags & O_CREAT))
+		{
+			r = ENOENT;
+			break;
+		}
+		if (hit == 1)
+			goto Found;
+
+		if (!loaded)
+		{
+			r = ext4_fs_get_inode_ref(fs, cur, &ref);
+			if (r != EOK)
+				return r;
+			loaded = true;
+		}
 		r = ext4_dir_find_entry(&result, &ref, path, len);
 		if (r != EOK)
 		{
@@ -1041,7 +1092,11 @@ static int ext4_generic_open2(ext4_file *f, const char *path, int flags,
 				break;
 
 			if (!(f->flags & O_CREAT))
+			{
+				if (cacheable)
+					s_dcache->insert(fs, cur, path, len, 0, 0);
 				break;
+			}
 
 			/*O_CREAT allows create new entry*/
 			struct ext4_inode_ref child_ref;
@@ -1070,9 +1125,6 @@ static int ext4_generic_open2(ext4_file *f, const char *path, int flags,
 			continue;
 		}
 
-		if (parent_inode)
-			*parent_inode = ref.index;
-
 		next_inode = ext4_dir_en_get_inode(result.dentry);
 		if (ext4_sb_feature_incom(sb, EXT4_FINCOM_FILETYPE))
 		{
@@ -1094,6 +1146,12 @@ static int ext4_generic_open2(ext4_file *f, const char *path, int flags,
 		r = ext4_dir_destroy_result(&ref, &result);
 		if (r != EOK)
 			break;
+		if (cacheable)
+			s_dcache->insert(fs, cur, path, len, next_inode, imode);
+
+	Found:
+		if (parent_inode)
+			*parent_inode = cur;
 
 		/*If expected file error*/
 		if (imode != EXT4_INODE_MODE_DIRECTORY && !is_goal)
@@ -1111,13 +1169,14 @@ static int ext4_generic_open2(ext4_file *f, const char *path, int flags,
 			}
 		}
 
-		r = ext4_fs_put_inode_ref(&ref);
-		if (r != EOK)
-			break;
-
-		r = ext4_fs_get_inode_ref(fs, next_inode, &ref);
-		if (r != EOK)
-			break;
+		if (loaded)
+		{
+			r = ext4_fs_put_inode_ref(&ref);
+			loaded = false;
+			if (r != EOK)
+				break;
+		}
+		cur = next_inode;
 
 		if (is_goal)
 			break;
@@ -1129,10 +1188,18 @@ static int ext4_generic_open2(ext4_file *f, const char *path, int flags,
 	}
 	if (r != EOK)
 	{
-		ext4_fs_put_inode_ref(&ref);
+		if (loaded)
+			ext4_fs_put_inode_ref(&ref);
 		return r;
 	}
 
+	if (!loaded)
+	{
+		r = ext4_fs_get_inode_ref(fs, cur, &ref);
+		if (r != EOK)
+			return r;
+	}
+
 	if (is_goal)
 	{
 
@@ -1792,6 +1859,13 @@ int ext4_fread(ext4_file *file, void *buf, size_t size, size_t *rcnt)
 	/*Sync file size*/
 	file->fsize = ext4_inode_get_size(sb, ref.inode);
 
+	/*Nothing to read at or past the end (pread beyond EOF)*/
+	if (file->fpos >= file->fsize)
+	{
+		r = EOK;
+		goto Finish;
+	}
+
 	block_size = ext4_sb_get_block_size(sb);
 	size = ((uint64_t)size > (file->fsize - file->fpos))
 			   ? ((size_t)(file->fsize - file->fpos))
@@ -2160,6 +2234,64 @@ uint64_t ext4_fsize(ext4_file *file)
 	return file->fsize;
 }
 
+int ext4_fbmap(ext4_file *file, uint64_t pos, uint64_t *dev_off, uint32_t *bsize)
+{
+	int r;
+	ext4_fsblk_t fblock;
+	struct ext4_inode_ref ref;
+
+	ext4_assert(file && file->mp && dev_off && bsize);
+
+	EXT4_MP_LOCK(file->mp);
+	struct ext4_fs *const fs = &file->mp->fs;
+	uint32_t block_size = ext4_sb_get_block_size(&fs->sb);
+
+	r = ext4_fs_get_inode_ref(fs, file->inode, &ref);
+	if (r != EOK)
+	{
+		EXT4_MP_UNLOCK(file->mp);
+		return r;
+	}
+	r = ext4_fs_get_inode_dblk_idx(&ref, (ext4_lblk_t)(pos / block_size), &fblock, true);
+	ext4_fs_put_inode_ref(&ref);
+	EXT4_MP_UNLOCK(file->mp);
+	if (r != EOK)
+		return r;
+	/* holes and unwritten extents have no fixed home on the device */
+	if (fblock == 0)
+		return ENOENT;
+
+	*dev_off = fs->bdev->part_offset + fblock * block_size + pos % block_size;
+	*bsize = block_size;
+	return EOK;
+}
+
+int ext4_fopen_ino(ext4_file *file, struct ext4_mountpoint *mp, uint32_t ino,
+		   uint32_t flags)
+{
+	int r;
+	struct ext4_inode_ref ref;
+
+	ext4_assert(file && mp);
+
+	EXT4_MP_LOCK(mp);
+	r = ext4_fs_get_inode_ref(&mp->fs, ino, &ref);
+	if (r != EOK)
+	{
+		EXT4_MP_UNLOCK(mp);
+		return r;
+	}
+	file->mp = mp;
+	file->inode = ino;
+	file->flags = flags;
+	file->fsize = ext4_inode_get_size(&mp->fs.sb, ref.inode);
+	file->fpos = 0;
+	file->refctr = ext4_inode_get_links_cnt(ref.inode);
+	ext4_fs_put_inode_ref(&ref);
+	EXT4_MP_UNLOCK(mp);
+	return EOK;
+}
+
 static int ext4_trans_get_inode_ref(const char *path,
 									struct ext4_mountpoint *mp,
 									struct ext4_inode_ref *inode_ref)
@@ -2670,18 +2802,14 @@ int ext4_readlink(const char *path, char *buf, size_t bufsize, size_t *rcnt)
 	filetype = EXT4_DE_SYMLINK;
 
 	EXT4_MP_LOCK(mp);
-	ext4_block_cache_write_back(mp->fs.bdev, 1);
 	r = ext4_generic_open2(&f, path, O_RDONLY, filetype, NULL, NULL);
-	if (r == EOK)
-		r = ext4_fread(&f, buf, bufsize, rcnt);
-	else
-		goto Finish;
+	EXT4_MP_UNLOCK(mp);
+	if (r != EOK)
+		return r;
 
+	/* ext4_fread takes the mount point lock itself */
+	r = ext4_fread(&f, buf, bufsize, rcnt);
 	ext4_fclose(&f);
-
-Finish:
-	ext4_block_cache_write_back(mp->fs.bdev, 0);
-	EXT4_MP_UNLOCK(mp);
 	return r;
 }
 
@@ -3372,11 +3500,85 @@ Finish:
 	return de;
 }
 
+int ext4_dir_entry_fill(ext4_dir *dir, ext4_dir_filler filler, void *arg)
+{
+	int r;
+	uint16_t name_length;
+	struct ext4_inode_ref dir_inode;
+	struct ext4_dir_iter it;
+
+	EXT4_MP_LOCK(dir->f.mp);
+
+	if (dir->next_off == EXT4_DIR_ENTRY_OFFSET_TERM)
+	{
+		EXT4_MP_UNLOCK(dir->f.mp);
+		return EOK;
+	}
+
+	r = ext4_fs_get_inode_ref(&dir->f.mp->fs, dir->f.inode, &dir_inode);
+	if (r != EOK)
+	{
+		goto Finish;
+	}
+
+	r = ext4_dir_iterator_init(&it, &dir_inode, dir->next_off);
+	if (r != EOK)
+	{
+		ext4_fs_put_inode_ref(&dir_inode);
+		goto Finish;
+	}
+
+	while (it.curr)
+	{
+		uint64_t off = it.curr_off;
+		bool used = ext4_dir_en_get_inode(it.curr) != 0;
+		if (used)
+		{
+			name_length = ext4_dir_en_get_name_len(&dir->f.mp->fs.sb,
+												   it.curr);
+			memcpy(&dir->de.name, it.curr->name, name_length);
+			dir->de.inode = ext4_dir_en_get_inode(it.curr);
+			dir->de.entry_length = ext4_dir_en_get_entry_len(it.curr);
+			dir->de.name_length = name_length;
+			dir->de.inode_type = ext4_dir_en_get_inode_type(
+				&dir->f.mp->fs.sb, it.curr);
+		}
+
+		r = ext4_dir_iterator_next(&it);
+		if (r != EOK)
+		{
+			break;
+		}
+
+		/* The cookie of the last entry is the directory size, where
+		 * a seek finds nothing more*/
+		if (used && filler(arg, &dir->de,
+						   it.curr ? it.curr_off : dir->f.fsize))
+		{
+			dir->next_off = off;
+			break;
+		}
+		dir->next_off = it.curr ? it.curr_off : EXT4_DIR_ENTRY_OFFSET_TERM;
+	}
+
+	ext4_dir_iterator_fini(&it);
+	ext4_fs_put_inode_ref(&dir_inode);
+
+Finish:
+	EXT4_MP_UNLOCK(dir->f.mp);
+	return r;
+}
+
 void ext4_dir_entry_rewind(ext4_dir *dir)
 {
 	dir->next_off = 0;
 }
 
+void ext4_dir_entry_seek(ext4_dir *dir, uint64_t off)
+{
+	dir->next_off = off;
+}
+
 /**
  * @}
  */
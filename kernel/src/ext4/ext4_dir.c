@@ -347,6 +347,8 @@ int ext4_dir_add_entry(struct ext4_inode_ref *parent, const char *name,
 	struct ext4_fs *fs = parent->fs;
 	struct ext4_sblock *sb = &parent->fs->sb;
 
+	ext4_dcache_invalidate(parent->fs, parent->index, name, name_len);
+
 #if CONFIG_DIR_INDEX_ENABLE
 	/* Index adding (if allowed) */
 	if ((ext4_sb_feature_com(sb, EXT4_FCOM_DIR_INDEX)) &&
@@ -532,6 +534,8 @@ int ext4_dir_remove_entry(struct ext4_inode_ref *parent, const char *name,
 	if (!ext4_inode_is_type(sb, parent->inode, EXT4_INODE_MODE_DIRECTORY))
 		return ENOTDIR;
 
+	ext4_dcache_invalidate(parent->fs, parent->index, name, name_len);
+
 	/* Try to find entry */
 	struct ext4_dir_search_result result;
 	int rc = ext4_dir_find_entry(&result, parent, name, name_len);
@@ -57,6 +57,64 @@
 
 #include <string.h>
 
+/**@brief   Largest on-disk i-node the cache holds, bigger ones are
+ *          always used in place in their i-node table block.*/
+#define EXT4_ICACHE_INODE_SIZE 256
+
+/**@brief   A decoded i-node kept across references, so opening it
+ *          again costs neither a table block read nor a checksum.
+ *          Changes stay here until the reference that made them is
+ *          put back, which copies the i-node into its table block.*/
+struct ext4_icache_entry {
+	/**@brief   File system, NULL while the entry is unused.*/
+	struct ext4_fs *fs;
+
+	/**@brief   I-node number.*/
+	uint32_t index;
+
+	/**@brief   References handed out and not yet put back.*/
+	uint32_t refctr;
+
+	/**@brief   Tick of the last use, the oldest idle entry goes.*/
+	uint32_t lru;
+
+	/**@brief   The i-node itself.*/
+	uint64_t raw[EXT4_ICACHE_INODE_SIZE / sizeof(uint64_t)];
+};
+
+static struct ext4_icache_entry ext4_icache[CONFIG_INODE_CACHE_SIZE];
+static uint32_t ext4_icache_tick;
+
+static struct ext4_icache_entry *ext4_icache_find(struct ext4_fs *fs,
+						  uint32_t index)
+{
+	for (int i = 0; i < CONFIG_INODE_CACHE_SIZE; i++)
+		if (ext4_icache[i].fs == fs && ext4_icache[i].index == index)
+			return &ext4_icache[i];
+	return NULL;
+}
+
+static struct ext4_icache_entry *ext4_icache_victim(void)
+{
+	struct ext4_icache_entry *victim = NULL;
+	for (int i = 0; i < CONFIG_INODE_CACHE_SIZE; i++) {
+		struct ext4_icache_entry *e = &ext4_icache[i];
+		if (!e->fs)
+			return e;
+		if (!e->refctr && (!victim || e->lru < victim->lru))
+			victim = e;
+	}
+	return victim;
+}
+
+/**@brief   Forget the i-nodes of @p fs, it is (re)mounted or gone.*/
+static void ext4_icache_drop(struct ext4_fs *fs)
+{
+	for (int i = 0; i < CONFIG_INODE_CACHE_SIZE; i++)
+		if (ext4_icache[i].fs == fs)
+			ext4_icache[i].fs = NULL;
+}
+
 int ext4_fs_init(struct ext4_fs *fs, struct ext4_blockdev *bdev,
 		 bool read_only)
 {
@@ -66,6 +124,7 @@ int ext4_fs_init(struct ext4_fs *fs, struct ext4_blockdev *bdev,
 
 	ext4_assert(fs && bdev);
 
+	ext4_icache_drop(fs);
 	fs->bdev = bdev;
 
 	fs->read_only = read_only;
@@ -128,6 +187,8 @@ int ext4_fs_fini(struct ext4_fs *fs)
 {
 	ext4_assert(fs);
 
+	ext4_icache_drop(fs);
+
 	/*Set superblock state*/
 	ext4_set16(&fs->sb, state, EXT4_SUPERBLOCK_STATE_VALID_FS);
 
@@ -717,10 +778,11 @@ static bool ext4_fs_verify_inode_csum(struct ext4_inode_ref *inode_ref)
 #define ext4_fs_verify_inode_csum(...) true
 #endif
 
-static int
-__ext4_fs_get_inode_ref(struct ext4_fs *fs, uint32_t index,
-			struct ext4_inode_ref *ref,
-			bool initialized)
+/**@brief   Find the i-node table block holding i-node @p index and
+ *          the i-node's offset inside it.*/
+static int ext4_fs_locate_inode(struct ext4_fs *fs, uint32_t index,
+				ext4_fsblk_t *block_id,
+				uint32_t *offset_in_block)
 {
 	/* Compute number of i-nodes, that fits in one data block */
 	uint32_t inodes_per_group = ext4_get32(&fs->sb, inodes_per_group);
@@ -757,23 +819,48 @@ __ext4_fs_get_inode_ref(struct ext4_fs *fs, uint32_t index,
 	uint32_t byte_offset_in_group = offset_in_group * inode_size;
 
 	/* Compute block address */
-	ext4_fsblk_t block_id =
-	    inode_table_start + (byte_offset_in_group / block_size);
+	*block_id = inode_table_start + (byte_offset_in_group / block_size);
+
+	/* Compute position of i-node in the data block */
+	*offset_in_block = byte_offset_in_group % block_size;
+	return EOK;
+}
+
+static int
+__ext4_fs_get_inode_ref(struct ext4_fs *fs, uint32_t index,
+			struct ext4_inode_ref *ref,
+			bool initialized)
+{
+	ext4_fsblk_t block_id;
+	uint32_t offset_in_block;
+	uint16_t inode_size = ext4_get16(&fs->sb, inode_size);
+	struct ext4_icache_entry *e = ext4_icache_find(fs, index);
+
+	ref->index = index;
+	ref->fs = fs;
+	ref->dirty = false;
+
+	if (e) {
+		/* Cached i-nodes were verified when they were loaded */
+		e->refctr++;
+		e->lru = ++ext4_icache_tick;
+		memset(&ref->block, 0, sizeof(ref->block));
+		ref->inode = (struct ext4_inode *)e->raw;
+		return EOK;
+	}
+
+	int rc = ext4_fs_locate_inode(fs, index, &block_id, &offset_in_block);
+	if (rc != EOK) {
+		return rc;
+	}
 
 	rc = ext4_trans_block_get(fs->bdev, &ref->block, block_id);
 	if (rc != EOK) {
 		return rc;
 	}
 
-	/* Compute position of i-node in the data block */
-	uint32_t offset_in_block = byte_offset_in_group % block_size;
 	ref->inode = (struct ext4_inode *)(ref->block.data + offset_in_block);
 
-	/* We need to store the original value of index in the reference */
-	ref->index = index + 1;
-	ref->fs = fs;
-	ref->dirty = false;
-
 	if (initialized && !ext4_fs_verify_inode_csum(ref)) {
 		ext4_dbg(DEBUG_FS,
 			DBG_WARN "Inode checksum failed."
@@ -781,7 +868,20 @@ __ext4_fs_get_inode_ref(struct ext4_fs *fs, uint32_t index,
 			ref->index);
 	}
 
-	return EOK;
+	/* Keep a copy; without a free entry, use the block in place */
+	e = inode_size <= EXT4_ICACHE_INODE_SIZE ? ext4_icache_victim() : NULL;
+	if (!e)
+		return EOK;
+
+	memcpy(e->raw, ref->inode, inode_size);
+	e->fs = fs;
+	e->index = index;
+	e->refctr = 1;
+	e->lru = ++ext4_icache_tick;
+	rc = ext4_block_set(fs->bdev, &ref->block);
+	memset(&ref->block, 0, sizeof(ref->block));
+	ref->inode = (struct ext4_inode *)e->raw;
+	return rc;
 }
 
 int ext4_fs_get_inode_ref(struct ext4_fs *fs, uint32_t index,
@@ -796,11 +896,37 @@ int ext4_fs_put_inode_ref(struct ext4_inode_ref *ref)
 	if (ref->dirty) {
 		/* Mark block dirty for writing changes to physical device */
 		ext4_fs_set_inode_checksum(ref);
-		ext4_trans_set_block_dirty(ref->block.buf);
+		if (ref->block.buf)
+			ext4_trans_set_block_dirty(ref->block.buf);
 	}
 
 	/* Put back block, that contains i-node */
-	return ext4_block_set(ref->fs->bdev, &ref->block);
+	if (ref->block.buf)
+		return ext4_block_set(ref->fs->bdev, &ref->block);
+
+	struct ext4_icache_entry *e = ext4_icache_find(ref->fs, ref->index);
+	ext4_assert(e && e->refctr);
+	e->refctr--;
+	if (!ref->dirty)
+		return EOK;
+
+	/* Write the cached i-node back into its table block */
+	ext4_fsblk_t block_id;
+	uint32_t offset_in_block;
+	struct ext4_block b;
+	int rc = ext4_fs_locate_inode(ref->fs, ref->index, &block_id,
+				      &offset_in_block);
+	if (rc != EOK)
+		return rc;
+
+	rc = ext4_trans_block_get(ref->fs->bdev, &b, block_id);
+	if (rc != EOK)
+		return rc;
+
+	memcpy(b.data + offset_in_block, e->raw,
+	       ext4_get16(&ref->fs->sb, inode_size));
+	ext4_trans_set_block_dirty(b.buf);
+	return ext4_block_set(ref->fs->bdev, &b);
 }
 
 void ext4_fs_inode_blocks_init(struct ext4_fs *fs,
@@ -0,0 +1,395 @@
+#include <common.h>
+#include <vfs.h>
+#include <ext4.h>
+#include <ext4_inode.h>
+#include <pgcache.h>
+
+// A mounted ext4 disk, and the names lwext4 knows it by
+struct ext4_disk
+{
+	struct ext4_blockdev_iface bi;
+	struct ext4_blockdev bd;
+	uint8_t block_buffer[4096];
+	char dev[CONFIG_EXT4_MAX_BLOCKDEV_NAME + 1];
+	char name[CONFIG_EXT4_MAX_MP_NAME + 1]; // mount point with a trailing slash, what lwext4 paths start with
+};
+
+static const struct file_ops ext4_file_fops, ext4_dir_fops;
+
+static int blockdev_open(struct ext4_blockdev *bdev) { return EOK; }
+static int blockdev_close(struct ext4_blockdev *bdev) { return EOK; }
+
+static int blockdev_bread(struct ext4_blockdev *bdev, void *buf, uint64_t blk_id, uint32_t blk_cnt)
+{
+	panic_on(!buf, "no buf");
+	size_t offset = blk_id * bdev->bdif->ph_bsize;
+	int count = blk_cnt * bdev->bdif->ph_bsize;
+	device_t *dev = (device_t *)bdev->bdif->p_user;
+	dev->ops->read(dev, offset, buf, count);
+	return EOK;
+}
+
+static int blockdev_bwrite(struct ext4_blockdev *bdev, const void *buf, uint64_t blk_id, uint32_t blk_cnt)
+{
+	panic_on(!buf, "no buf");
+	size_t offset = blk_id * bdev->bdif->ph_bsize;
+	int count = blk_cnt * bdev->bdif->ph_bsize;
+	device_t *dev = (device_t *)bdev->bdif->p_user;
+	dev->ops->write(dev, offset, buf, count);
+	return EOK;
+}
+
+static int blockdev_lock(struct ext4_blockdev *bdev)
+{
+	return EOK;
+}
+static int blockdev_unlock(struct ext4_blockdev *bdev) { return EOK; }
+
+// ext4 is entered from every CPU and by the page cache flusher; lwext4
+// keeps state shared by all its mount points, so they share the lock
+static spinlock_t ext4_lock;
+static void ext4_os_lock(void) { kmt->spin_lock(&ext4_lock); }
+static void ext4_os_unlock(void) { kmt->spin_unlock(&ext4_lock); }
+static const struct ext4_lock ext4_os_locks = {
+	.lock = ext4_os_lock,
+	.unlock = ext4_os_unlock,
+};
+
+static void ext4fs_init(void)
+{
+	kmt->spin_init(&ext4_lock, "ext4_lock");
+}
+
+/**
+ * the lwext4 path of @path on @m, allocated; NULL when out of memory
+ */
+static char *ext4_path(struct mount *m, const char *path)
+{
+	struct ext4_disk *d = m->priv;
+	char *p = pmm->alloc(strlen(d->name) + strlen(path) + 1);
+	if (p)
+	{
+		strcpy(p, d->name);
+		strcat(p, path);
+	}
+	return p;
+}
+
+/**
+ * mount the ext4 filesystem on the disk named @source
+ */
+static int ext4fs_mount(struct mount *m, const char *source)
+{
+	device_t *sd = dev->lookup(source);
+	if (sd == NULL || sd->ops != &sd_ops || strlen(source) > CONFIG_EXT4_MAX_BLOCKDEV_NAME ||
+		m->len + 1 > CONFIG_EXT4_MAX_MP_NAME)
+		return VFS_ERROR;
+	struct ext4_disk *d = pmm->alloc(sizeof(struct ext4_disk));
+	if (d == NULL)
+		return VFS_ERROR;
+	memset(d, 0, sizeof(struct ext4_disk));
+	strcpy(d->dev, source);
+	strcpy(d->name, m->path);
+	if (m->len > 1)
+		strcat(d->name, "/");
+	d->bi.open = blockdev_open;
+	d->bi.close = blockdev_close;
+	d->bi.bread = blockdev_bread;
+	d->bi.bwrite = blockdev_bwrite;
+	d->bi.lock = blockdev_lock;
+	d->bi.unlock = blockdev_unlock;
+	d->bi.ph_bsize = 4096;
+	d->bi.ph_bbuf = d->block_buffer;
+	d->bi.ph_refctr = 1;
+	d->bi.p_user = sd;
+	d->bi.ph_bcnt = ((sd_t *)sd->ptr)->blkcnt / d->bi.ph_bsize * ((sd_t *)sd->ptr)->blksz;
+	d->bd.bdif = &d->bi;
+	d->bd.part_size = d->bd.bdif->ph_bcnt * (uint64_t)d->bd.bdif->ph_bsize;
+	if (ext4_device_register(&d->bd, d->dev) != EOK)
+	{
+		pmm->free(d);
+		return VFS_ERROR;
+	}
+	if (ext4_mount(d->dev, d->name, false) != EOK)
+	{
+		ext4_device_unregister(d->dev);
+		pmm->free(d);
+		return VFS_ERROR;
+	}
+	ext4_mount_setup_locks(d->name, &ext4_os_locks);
+	m->priv = d;
+	return VFS_SUCCESS;
+}
+
+static int ext4fs_umount(struct mount *m)
+{
+	struct ext4_disk *d = m->priv;
+	// dirty pages name the lwext4 mount point they go back through
+	pgcache->syncfs(m->id);
+	if (ext4_umount(d->name) != EOK)
+		return VFS_ERROR;
+	ext4_device_unregister(d->dev);
+	pmm->free(d);
+	return VFS_SUCCESS;
+}
+
+static int ext4fs_sync(struct mount *m)
+{
+	return ext4_cache_flush(((struct ext4_disk *)m->priv)->name) == EOK ? VFS_SUCCESS : VFS_ERROR;
+}
+
+static int ext4fs_open(struct mount *m, struct file *f, const char *path, int flags)
+{
+	char *p = ext4_path(m, path);
+	if (p == NULL)
+		return VFS_ERROR;
+	ext4_dir *d = pmm->alloc(sizeof(ext4_dir));
+	if (d && ext4_dir_open(d, p) == EOK)
+	{
+		pmm->free(p);
+		f->type = FD_DIR;
+		f->fops = &ext4_dir_fops;
+		f->ptr = d;
+		return VFS_SUCCESS;
+	}
+	pmm->free(d);
+	const char *mode = "r";
+	if (flags & O_WRONLY)
+	{
+		mode = (flags & O_APPEND) ? "a" : "w";
+	}
+	else if (flags & O_RDWR)
+	{
+		if (flags & O_APPEND)
+			mode = "a+";
+		else if (flags & O_TRUNC)
+			mode = "w+";
+		else
+			mode = "r+";
+	}
+
+	int ret = VFS_ERROR;
+	ext4_file *ef = (flags & O_DIRECTORY) ? NULL : pmm->alloc(sizeof(ext4_file));
+	if (ef && ext4_fopen(ef, p, mode) == EOK)
+	{
+		f->type = FD_FILE;
+		f->fops = &ext4_file_fops;
+		f->ptr = ef;
+		if (mode[0] == 'w')
+			pgcache->truncate(pgcache->key(f), 0);
+		ret = VFS_SUCCESS;
+	}
+	else
+	{
+		pmm->free(ef);
+	}
+	pmm->free(p);
+	return ret;
+}
+
+static int ext4fs_mkdir(struct mount *m, const char *path)
+{
+	char *p = ext4_path(m, path);
+	// in fact,its performance is not the same as the mkdir in linux
+	int ret = p ? ext4_dir_mk(p) : ENOMEM;
+	pmm->free(p);
+	return (ret == EOK) ? VFS_SUCCESS : VFS_ERROR;
+}
+
+static int ext4fs_rmdir(struct mount *m, const char *path)
+{
+	char *p = ext4_path(m, path);
+	int ret = p ? ext4_dir_rm(p) : ENOMEM;
+	pmm->free(p);
+	return (ret == EOK) ? VFS_SUCCESS : VFS_ERROR;
+}
+
+static int ext4fs_unlink(struct mount *m, const char *path)
+{
+	char *p = ext4_path(m, path);
+	if (p == NULL)
+		return VFS_ERROR;
+	// the i-node goes with its last link, and so must its cached pages
+	uint32_t ino;
+	struct ext4_inode inode;
+	bool last = ext4_raw_inode_fill(p, &ino, &inode) == EOK && ext4_inode_get_links_cnt(&inode) <= 1;
+	int ret = ext4_fremove(p);
+	if (ret == EOK && last)
+		pgcache->truncate(PGCACHE_FILE_KEY(m->id, ino), 0);
+	pmm->free(p);
+	return (ret == EOK) ? VFS_SUCCESS : VFS_ERROR;
+}
+
+static int ext4fs_link(struct mount *m, const char *oldpath, const char *newpath)
+{
+	char *op = ext4_path(m, oldpath), *np = ext4_path(m, newpath);
+	int ret = (op && np) ? ext4_flink(op, np) : ENOMEM;
+	pmm->free(op);
+	pmm->free(np);
+	return (ret == EOK) ? VFS_SUCCESS : VFS_ERROR;
+}
+
+static int ext4fs_rename(struct mount *m, const char *oldpath, const char *newpath)
+{
+	char *op = ext4_path(m, oldpath), *np = ext4_path(m, newpath);
+	int ret = (op && np) ? ext4_frename(op, np) : ENOMEM;
+	pmm->free(op);
+	pmm->free(np);
+	return (ret == EOK) ? VFS_SUCCESS : VFS_ERROR;
+}
+
+static void ext4fs_close(struct file *f)
+{
+	if (f->writable)
+		pgcache->sync(pgcache->key(f));
+	ext4_fclose(f->ptr);
+	pmm->free(f->ptr);
+}
+
+static ssize_t ext4fs_read(struct file *f, void *buf, size_t n)
+{
+	ext4_file *ef = (ext4_file *)f->ptr;
+	ssize_t r = pgcache->read(f, buf, n, ef->fpos);
+	if (r > 0)
+		ef->fpos += r;
+	return r;
+}
+
+static ssize_t ext4fs_write(struct file *f, const void *buf, size_t n)
+{
+	ext4_file *ef = (ext4_file *)f->ptr;
+	ssize_t r = pgcache->write(f, buf, n, ef->fpos);
+	if (r > 0)
+		ef->fpos += r;
+	return r;
+}
+
+/**
+ * positional I/O goes to the page cache at @off, so the position
+ * shared by the owners of @f is neither used nor moved
+ */
+static ssize_t ext4fs_pread(struct file *f, void *buf, size_t n, uint64_t off)
+{
+	return pgcache->read(f, buf, n, off);
+}
+
+static ssize_t ext4fs_pwrite(struct file *f, const void *buf, size_t n, uint64_t off)
+{
+	return pgcache->write(f, buf, n, off);
+}
+
+static off_t ext4fs_seek(struct file *f, off_t offset, int whence)
+{
+	ext4_file *ef = (ext4_file *)f->ptr;
+	if (ext4_fseek(ef, offset, whence) != EOK)
+		return VFS_ERROR;
+	return ext4_ftell(ef);
+}
+
+static int ext4fs_stat(struct file *f, struct stat *st)
+{
+	// size and links as they are now, from the i-node cache
+	ext4_file *ef = (ext4_file *)f->ptr;
+	ext4_file cur;
+	if (ext4_fopen_ino(&cur, ef->mp, ef->inode, O_RDONLY) != EOK)
+		return -1;
+	st->st_mode = S_IFREG;
+	st->st_ino = ef->inode;
+	st->st_size = cur.fsize;
+	st->st_nlink = cur.refctr;
+	return 0;
+}
+
+/**
+ * make what was written to @f durable: its dirty pages reach ext4,
+ * and ext4's block cache the disk. metadata is written through by
+ * ext4 as it changes, so this also serves fdatasync
+ */
+static int ext4fs_fsync(struct file *f)
+{
+	int r = pgcache->sync(pgcache->key(f));
+	if (ext4fs_sync(f->mnt) != VFS_SUCCESS)
+		r = -1;
+	return r < 0 ? VFS_ERROR : VFS_SUCCESS;
+}
+
+static void ext4fs_dir_close(struct file *f)
+{
+	ext4_dir_close(f->ptr);
+	pmm->free(f->ptr);
+}
+
+static int filldir(void *arg, const ext4_direntry *de, uint64_t next_off)
+{
+	return dir_emit(arg, (const char *)de->name, de->name_length, de->inode, de->inode_type, next_off);
+}
+
+static int ext4fs_readdir(struct file *f, struct dir_context *ctx)
+{
+	ext4_dir *d = (ext4_dir *)f->ptr;
+	if (ext4_dir_entry_fill(d, filldir, ctx) != EOK)
+		return -1;
+	return d->next_off != (uint64_t)-1;
+}
+
+static off_t ext4fs_dir_seek(struct file *f, off_t offset, int whence)
+{
+	// directories seek to the d_off cookies handed out by getdents64
+	if (whence != SEEK_SET || offset < 0)
+		return VFS_ERROR;
+	ext4_dir_entry_seek((ext4_dir *)f->ptr, offset);
+	return offset;
+}
+
+static int ext4fs_dir_stat(struct file *f, struct stat *st)
+{
+	ext4_dir *d = (ext4_dir *)f->ptr;
+	st->st_mode = S_IFDIR;
+	st->st_ino = d->f.inode;
+	st->st_size = d->f.fsize;
+	st->st_nlink = 2; // Directories typically have a link count of at least 2 (., ..)
+	return 0;
+}
+
+static int ext4fs_dir_fsync(struct file *f)
+{
+	return ext4fs_sync(f->mnt);
+}
+
+static const struct file_ops ext4_file_fops = {
+	.cached = true,
+	.close = ext4fs_close,
+	.read = ext4fs_read,
+	.write = ext4fs_write,
+	.pread = ext4fs_pread,
+	.pwrite = ext4fs_pwrite,
+	.seek = ext4fs_seek,
+	.stat = ext4fs_stat,
+	.fsync = ext4fs_fsync,
+};
+
+static const struct file_ops ext4_dir_fops = {
+	.close = ext4fs_dir_close,
+	.seek = ext4fs_dir_seek,
+	.readdir = ext4fs_readdir,
+	.stat = ext4fs_dir_stat,
+	.fsync = ext4fs_dir_fsync,
+};
+
+static const struct inode_ops ext4_iops = {
+	.open = ext4fs_open,
+	.mkdir = ext4fs_mkdir,
+	.rmdir = ext4fs_rmdir,
+	.unlink = ext4fs_unlink,
+	.link = ext4fs_link,
+	.rename = ext4fs_rename,
+};
+
+const struct fs_ops ext4_fs_ops = {
+	.name = "ext4",
+	.init = ext4fs_init,
+	.mount = ext4fs_mount,
+	.umount = ext4fs_umount,
+	.sync = ext4fs_sync,
+	.iops = &ext4_iops,
+};
@@ -0,0 +1,206 @@
+#include <common.h>
+#include <file.h>
+#include <vfs.h>
+#define BITS 64
+
+static struct fdtable *fdt_alloc(int size)
+{
+    struct fdtable *t = pmm->alloc(sizeof(struct fdtable));
+    if (t == NULL)
+    {
+        return NULL;
+    }
+    t->fd = pmm->alloc(size * sizeof(struct file *));
+    t->used = pmm->alloc(size / BITS * sizeof(uint64_t));
+    if (t->fd == NULL || t->used == NULL)
+    {
+        pmm->free(t->fd);
+        pmm->free(t->used);
+        pmm->free(t);
+        return NULL;
+    }
+    memset(t->fd, 0, size * sizeof(struct file *));
+    memset(t->used, 0, size / BITS * sizeof(uint64_t));
+    t->size = size;
+    t->count = 0;
+    return t;
+}
+
+/**
+ * double @t until it has a slot @fd; false when that would pass
+ * NOFILE_MAX or memory runs out
+ */
+static bool fdt_grow(struct fdtable *t, int fd)
+{
+    int size = t->size;
+    while (size <= fd)
+    {
+        size *= 2;
+    }
+    if (size > NOFILE_MAX)
+    {
+        return false;
+    }
+    struct file **files = pmm->alloc(size * sizeof(struct file *));
+    uint64_t *used = pmm->alloc(size / BITS * sizeof(uint64_t));
+    if (files == NULL || used == NULL)
+    {
+        pmm->free(files);
+        pmm->free(used);
+        return false;
+    }
+    memset(files, 0, size * sizeof(struct file *));
+    memset(used, 0, size / BITS * sizeof(uint64_t));
+    memcpy(files, t->fd, t->size * sizeof(struct file *));
+    memcpy(used, t->used, t->size / BITS * sizeof(uint64_t));
+    pmm->free(t->fd);
+    pmm->free(t->used);
+    t->fd = files;
+    t->used = used;
+    t->size = size;
+    return true;
+}
+
+static void fdt_set(struct fdtable *t, int fd, struct file *f)
+{
+    t->fd[fd] = f;
+    if (f)
+    {
+        t->used[fd / BITS] |= 1ULL << (fd % BITS);
+        t->count++;
+    }
+    else
+    {
+        t->used[fd / BITS] &= ~(1ULL << (fd % BITS));
+        t->count--;
+    }
+}
+
+static struct fdtable *fdt_create()
+{
+    return fdt_alloc(NOFILE);
+}
+
+/**
+ * copy @t for a child, taking a reference on every open file
+ */
+static struct fdtable *fdt_dup(struct fdtable *t)
+{
+    struct fdtable *son = fdt_alloc(t->size);
+    if (son == NULL)
+    {
+        return NULL;
+    }
+    for (int fd = 0; fd < t->size; fd++)
+    {
+        if (t->fd[fd])
+        {
+            fdt_set(son, fd, vfs->dup(t->fd[fd]));
+        }
+    }
+    return son;
+}
+
+static void fdt_release(struct fdtable *t)
+{
+    if (t == NULL)
+    {
+        return;
+    }
+    for (int fd = 0; fd < t->size && t->count > 0; fd++)
+    {
+        if (t->fd[fd])
+        {
+            struct file *f = t->fd[fd];
+            fdt_set(t, fd, NULL);
+            vfs->close(f);
+        }
+    }
+    pmm->free(t->fd);
+    pmm->free(t->used);
+    pmm->free(t);
+}
+
+static struct file *fdt_get(task_t *task, int fd)
+{
+    struct fdtable *t = task->files;
+    if (t == NULL || fd < 0 || fd >= t->size)
+    {
+        return NULL;
+    }
+    return t->fd[fd];
+}
+
+/**
+ * give @f the lowest free descriptor not below @from, taking over
+ * the caller's reference; returns -1 when the table cannot grow
+ */
+static int fdt_alloc_fd(task_t *task, struct file *f, int from)
+{
+    struct fdtable *t = task->files;
+    if (t == NULL || from < 0 || from >= NOFILE_MAX)
+    {
+        return -1;
+    }
+    for (int w = from / BITS; w < t->size / BITS; w++)
+    {
+        uint64_t free = ~t->used[w];
+        if (w == from / BITS)
+        {
+            free &= ~0ULL << (from % BITS);
+        }
+        if (free)
+        {
+            int fd = w * BITS + __builtin_ctzll(free);
+            fdt_set(t, fd, f);
+            return fd;
+        }
+    }
+    int fd = t->size > from ? t->size : from;
+    if (!fdt_grow(t, fd))
+    {
+        return -1;
+    }
+    fdt_set(t, fd, f);
+    return fd;
+}
+
+/**
+ * put @f at @fd, returning what was there for the caller to close,
+ * or (struct file *)-1 when the table cannot grow that far
+ */
+static struct file *fdt_install(task_t *task, int fd, struct file *f)
+{
+    struct fdtable *t = task->files;
+    if (t == NULL || fd < 0 || (fd >= t->size && !fdt_grow(t, fd)))
+    {
+        return (struct file *)-1;
+    }
+    struct file *old = t->fd[fd];
+    if (old)
+    {
+        fdt_set(t, fd, NULL);
+    }
+    fdt_set(t, fd, f);
+    return old;
+}
+
+static struct file *fdt_remove(task_t *task, int fd)
+{
+    struct file *f = fdt_get(task, fd);
+    if (f)
+    {
+        fdt_set(task->files, fd, NULL);
+    }
+    return f;
+}
+
+MODULE_DEF(fdt) = {
+    .create = fdt_create,
+    .dup = fdt_dup,
+    .release = fdt_release,
+    .get = fdt_get,
+    .alloc = fdt_alloc_fd,
+    .install = fdt_install,
+    .remove = fdt_remove,
+};
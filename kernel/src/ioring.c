@@ -0,0 +1,96 @@
+#include <common.h>
+#include <syscall.h>
+
+/**
+ * map a ring of @entries (rounded up to a power of two) into @task;
+ * returns its user address, or -1
+ */
+static int64_t ioring_setup(task_t *task, uint32_t entries)
+{
+    procinfo_t *pi = task->pi;
+    if (pi->ring != NULL || entries == 0 || entries > IORING_MAX_ENTRIES)
+    {
+        return -1;
+    }
+    uint32_t n = 1;
+    while (n < entries)
+    {
+        n <<= 1;
+    }
+    struct io_ring *ring = uproc->mmap(task, NULL, IORING_SIZE(n), PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS, NULL, 0);
+    if (ring == MAP_FAILED)
+    {
+        return -1;
+    }
+    ring->sq_head = ring->sq_tail = 0;
+    ring->cq_head = ring->cq_tail = 0;
+    ring->entries = n;
+    pi->ring = ring;
+    pi->ring_entries = n;
+    return (int64_t)ring;
+}
+
+static int64_t ioring_op(task_t *task, const struct io_sqe *sqe)
+{
+    switch (sqe->opcode)
+    {
+    case IORING_OP_READ:
+        return syscall->read(task, sqe->fd, (char *)sqe->addr, sqe->len);
+    case IORING_OP_WRITE:
+        return syscall->write(task, sqe->fd, (const char *)sqe->addr, sqe->len);
+    case IORING_OP_OPENAT:
+        return syscall->openat(task, sqe->fd, (const char *)sqe->addr, sqe->flags, sqe->len);
+    case IORING_OP_CLOSE:
+        return syscall->close(task, sqe->fd);
+    case IORING_OP_FSTAT:
+        return syscall->fstat(task, sqe->fd, (struct stat *)sqe->addr);
+    default:
+        return -1;
+    }
+}
+
+/**
+ * run up to @to_submit queued operations in order, posting one
+ * completion each; stops early when the completion queue is full.
+ * operations finish before this returns, so @min_complete is
+ * always met. returns the number of operations consumed
+ */
+static int64_t ioring_enter(task_t *task, uint32_t to_submit, uint32_t min_complete, uint32_t flags)
+{
+    procinfo_t *pi = task->pi;
+    struct io_ring *ring = pi->ring;
+    if (ring == NULL || flags != 0)
+    {
+        return -1;
+    }
+    uint32_t n = pi->ring_entries;
+    struct io_sqe *sqes = IORING_SQES(ring);
+    struct io_cqe *cqes = IORING_CQES(ring, n);
+    uint32_t sq_head = ring->sq_head;
+    uint32_t sq_tail = __atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE);
+    uint32_t cq_tail = ring->cq_tail;
+    uint32_t done = 0;
+    while (done < to_submit && sq_head != sq_tail)
+    {
+        if (cq_tail - __atomic_load_n(&ring->cq_head, __ATOMIC_ACQUIRE) >= n)
+        {
+            break;
+        }
+        // copy the entry first, user space may rewrite the slot meanwhile
+        struct io_sqe sqe = sqes[sq_head & (n - 1)];
+        int64_t res = ioring_op(task, &sqe);
+        sq_head++;
+        __atomic_store_n(&ring->sq_head, sq_head, __ATOMIC_RELEASE);
+        cqes[cq_tail & (n - 1)] = (struct io_cqe){.user_data = sqe.user_data, .res = res};
+        cq_tail++;
+        __atomic_store_n(&ring->cq_tail, cq_tail, __ATOMIC_RELEASE);
+        done++;
+    }
+    return done;
+}
+
+MODULE_DEF(ioring) = {
+    .setup = ioring_setup,
+    .enter = ioring_enter,
+};
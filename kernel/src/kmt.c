@@ -31,12 +31,24 @@ static void set_current_task(task_t *task)
     task->cpu = cpu;
     TRACE_EXIT;
 }
+/*
+ a page fault taken in kernel mode hits a user address inside a syscall,
+ it is resolved in place and must neither save nor switch contexts
+*/
+static bool kernel_pgfault(Event ev, Context *ctx)
+{
+    return ev.event == EVENT_PAGEFAULT && (ctx->cs & 0x3) == 0;
+}
 /*
  to solve the data race
 */
 static Context *kmt_mark_as_free(Event ev, Context *ctx)
 {
     TRACE_ENTRY;
+    if (kernel_pgfault(ev, ctx))
+    {
+        return NULL;
+    }
     kmt->spin_lock(&task_lock);
     for (int i = 0; i < MAX_TASK; i++)
     {
@@ -66,18 +78,34 @@ static Context *kmt_mark_as_free(Event ev, Context *ctx)
 static Context *kmt_context_save(Event ev, Context *ctx)
 {
     TRACE_ENTRY;
+    if (kernel_pgfault(ev, ctx))
+    {
+        return NULL;
+    }
     task_t *current = get_current_task();
     current->context = ctx;
     TRACE_EXIT;
     return NULL;
 }
 #include "syscall.inc"
+static inline uint64_t rdtsc()
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
 static Context *kmt_syscall(Event ev, Context *ctx)
 {
-    SyscallHandler handler = syscall_table[ctx->GPRx];
+    uint64_t nr = ctx->GPRx;
+    SyscallHandler handler = nr < LENGTH(syscall_table) ? syscall_table[nr] : NULL;
     if (handler)
     {
-        ctx->GPRx = handler(ctx);
+        // execve rebuilds the context, keep the arguments for the trace
+        uint64_t args[6] = {ctx->GPR1, ctx->GPR2, ctx->GPR3, ctx->GPR4, ctx->GPR5, ctx->GPR6};
+        uint64_t start = rdtsc();
+        uint64_t ret = handler(ctx);
+        sysstat->account(get_current_task(), nr, args, ret, rdtsc() - start);
+        ctx->GPRx = ret;
     }
     else
     {
@@ -85,11 +113,39 @@ static Context *kmt_syscall(Event ev, Context *ctx)
     }
     return NULL;
 }
+/*
+ the SYSCALL fast path skips the trap walk and resumes the caller
+ directly; NULL sends the call back through a full schedule, for
+ callers that yielded, exited or got killed meanwhile
+*/
+static Context *kmt_syscall_fast(Context *ctx)
+{
+    task_t *current = get_current_task();
+    bool yield = ctx->GPRx == SYS_sched_yield;
+    current->context = ctx;
+    kmt_syscall((Event){.event = EVENT_SYSCALL}, ctx);
+    if (yield || current->status != TASK_RUNNING || (current->pi && current->pi->killed))
+    {
+        return NULL;
+    }
+    // a yield() nested in the call leaves a kernel context behind, execve a new one
+    Context *next = current->context;
+    return (next->cs & 0x3) == 0x3 ? next : ctx;
+}
 static Context *kmt_schedule(Event ev, Context *ctx)
 {
     TRACE_ENTRY;
-    kmt->spin_lock(&task_lock);
+    if (kernel_pgfault(ev, ctx))
+    {
+        return ctx;
+    }
     task_t *current = get_current_task();
+    if (current->pi && current->pi->killed && current->status == TASK_RUNNING && (ctx->cs & 0x3) == 0x3)
+    {
+        // chosen by the OOM killer while it could not be reclaimed
+        uproc->exit(current, 128 + SIGKILL);
+    }
+    kmt->spin_lock(&task_lock);
     kmt->spin_lock(&current->lock);
     if (current->status == TASK_RUNNING)
     {
@@ -189,8 +245,112 @@ void kmt_add_task(task_t *task)
     }
     kmt->spin_unlock(&task_lock);
 }
+/**
+ * pick the user process holding the most memory, init excepted, and
+ * reclaim it; a victim that is running elsewhere or inside the kernel
+ * (and @self, which may be half way through a fault) is only marked
+ * and exits the next time it is scheduled. Returns true when memory
+ * has been freed and the failed allocation is worth retrying
+ */
+bool kmt_oom_kill(procinfo_t *self)
+{
+    kmt->spin_lock(&task_lock);
+    task_t *victim = NULL;
+    size_t most = 0;
+    for (int i = 0; i < MAX_TASK; i++)
+    {
+        task_t *t = tasks[i];
+        if (t == NULL || t->pi == NULL || t->pi->pid == 1 || t->pi->killed ||
+            t->status == TASK_ZOMBIE || t->status == TASK_DEAD)
+        {
+            continue;
+        }
+        size_t pages = t->pi->rss + t->pi->ptpages;
+        if (pages > most)
+        {
+            most = pages;
+            victim = t;
+        }
+    }
+    bool freed = false;
+    if (victim)
+    {
+        kmt->spin_lock(&victim->lock);
+        printf("Out of memory: killing pid %d (%d pages)\n", victim->pi->pid, (int)most);
+        if (victim->pi != self && victim->cpu == -1 && victim->status == TASK_READY &&
+            (victim->context->cs & 0x3) == 0x3)
+        {
+            uproc->exit(victim, 128 + SIGKILL);
+            freed = true;
+        }
+        else
+        {
+            victim->pi->killed = 1;
+        }
+        kmt->spin_unlock(&victim->lock);
+    }
+    kmt->spin_unlock(&task_lock);
+    return freed;
+}
+/**
+ * offer user processes to @scan in turn, starting where the previous
+ * call stopped, until it returns true; only @self and processes
+ * not running on any CPU are offered, so the page tables scanned
+ * are never in use by another CPU meanwhile
+ */
+bool kmt_scan_idle(procinfo_t *self, bool (*scan)(procinfo_t *pi, void *arg), void *arg)
+{
+    static int hand;
+    kmt->spin_lock(&task_lock);
+    bool done = false;
+    for (int i = 0; i < MAX_TASK && !done; i++)
+    {
+        int idx = (hand + i) % MAX_TASK;
+        task_t *t = tasks[idx];
+        if (t == NULL || t->pi == NULL || t->status == TASK_ZOMBIE || t->status == TASK_DEAD)
+        {
+            continue;
+        }
+        kmt->spin_lock(&t->lock);
+        if (t->pi == self || (t->cpu == -1 && t->status != TASK_RUNNING))
+        {
+            done = scan(t->pi, arg);
+        }
+        kmt->spin_unlock(&t->lock);
+        if (done)
+        {
+            hand = idx;
+        }
+    }
+    kmt->spin_unlock(&task_lock);
+    return done;
+}
 static Context *kmt_pgfault(Event ev, Context *ctx)
 {
+    task_t *current = get_current_task();
+    if (current->pi)
+    {
+        int ret = uproc->pgfault(current, ev.ref, ev.cause & MMAP_WRITE);
+        if (ret == 0)
+        {
+            return NULL;
+        }
+        if ((ctx->cs & 0x3) == 0x3)
+        {
+            // retry the access once others had a chance to run and free memory
+            if (ret == -2 && !current->pi->killed)
+            {
+                return NULL;
+            }
+            uproc->exit(current, 128 + SIGKILL);
+            return NULL;
+        }
+        // inside a syscall: the process dies once the call returns
+        if (uproc->kfault(current, ev.ref, ev.cause & MMAP_WRITE) == 0)
+        {
+            return NULL;
+        }
+    }
     printf("rsp:%p\n", ctx->rsp);
     printf("rsp0:%p\n", ctx->rsp0);
     printf("Page fault at %p\n", ev.ref);
@@ -208,6 +368,7 @@ static void kmt_init()
     os->on_irq(INT_MAX, EVENT_NULL, kmt_schedule);
     os->on_irq(1, EVENT_SYSCALL, kmt_syscall);
     os->on_irq(1, EVENT_PAGEFAULT, kmt_pgfault);
+    cte_syscall(kmt_syscall_fast);
     for (int i = 0; i < MAX_TASK; i++)
     {
         tasks[i] = NULL;
@@ -6,9 +6,13 @@ static void os_init()
 {
     pmm->init();
     kmt->init();
+    poll->init();
+    pgcache->init();
+    sysstat->init();
     dev->init();
     uproc->init();
     vfs->init();
+    swapper->init();
 }
 static void os_run()
 {
@@ -0,0 +1,955 @@
+#include <common.h>
+#include <vfs.h>
+#include <ext4.h>
+#include <pgcache.h>
+static spinlock_t pgcache_lock;
+static struct page *pages[PGCACHE_BUCKETS];  // hashed by (key, index)
+static struct page *frames[PGCACHE_BUCKETS]; // hashed by frame address
+static struct page lru;    // list head, lru.prev is the next victim
+static int lru_pages;      // pages on the LRU list
+static int lru_limit;      // how many may stay there
+static sem_t flush_sem;    // wakes the flusher
+static bool flush_pending; // flush_sem was signalled and not yet served
+static uint64_t flush_next; // uptime (us) of the next periodic run
+
+// A readahead window left to the readahead worker
+struct ra_request
+{
+    struct mount *mnt; // pinned until the window is read
+    void *mp;
+    uint64_t key;
+    uint64_t start, count;
+};
+static struct ra_request ra_queue[PGCACHE_RA_QUEUE]; // ring under pgcache_lock
+static int ra_head, ra_len;
+static sem_t ra_sem; // counts queued requests
+
+static inline int hash_page(uint64_t key, uint64_t index)
+{
+    return (key * 31 + index) % PGCACHE_BUCKETS;
+}
+
+static inline int hash_frame(void *pa)
+{
+    return ((uintptr_t)pa / PGSIZE) % PGCACHE_BUCKETS;
+}
+
+static struct page *find_page(uint64_t key, uint64_t index)
+{
+    for (struct page *pg = pages[hash_page(key, index)]; pg; pg = pg->hnext)
+    {
+        if (pg->key == key && pg->index == index)
+        {
+            return pg;
+        }
+    }
+    return NULL;
+}
+
+static void insert_page(struct page *pg)
+{
+    int h = hash_page(pg->key, pg->index);
+    pg->hnext = pages[h];
+    pages[h] = pg;
+    int p = hash_frame(pg->pa);
+    pg->pnext = frames[p];
+    frames[p] = pg;
+}
+
+static void unhash_page(struct page *pg)
+{
+    struct page **pp;
+    for (pp = &pages[hash_page(pg->key, pg->index)]; *pp; pp = &(*pp)->hnext)
+    {
+        if (*pp == pg)
+        {
+            *pp = pg->hnext;
+            break;
+        }
+    }
+}
+
+static void unhash_frame(struct page *pg)
+{
+    struct page **pp;
+    for (pp = &frames[hash_frame(pg->pa)]; *pp; pp = &(*pp)->pnext)
+    {
+        if (*pp == pg)
+        {
+            *pp = pg->pnext;
+            break;
+        }
+    }
+}
+
+static void lru_unlink(struct page *pg)
+{
+    pg->prev->next = pg->next;
+    pg->next->prev = pg->prev;
+    lru_pages--;
+}
+
+static void lru_push(struct page *pg)
+{
+    pg->next = lru.next;
+    pg->prev = &lru;
+    lru.next->prev = pg;
+    lru.next = pg;
+    lru_pages++;
+}
+
+/**
+ * take a reference on a cached page, pulling it off the LRU list;
+ * the caller holds pgcache_lock
+ */
+static void hold_page(struct page *pg)
+{
+    if (pg->ref++ == 0 && pg->key < PGCACHE_ANON_KEY)
+    {
+        lru_unlink(pg);
+    }
+}
+
+/**
+ * drop a reference taken by hold_page; the caller holds pgcache_lock
+ */
+static void release_page(struct page *pg)
+{
+    if (--pg->ref > 0)
+    {
+        return;
+    }
+    if (pg->key < PGCACHE_ANON_KEY && !(pg->flags & PG_ORPHAN))
+    {
+        lru_push(pg);
+        return;
+    }
+    if (!(pg->flags & PG_ORPHAN))
+    {
+        unhash_page(pg);
+    }
+    unhash_frame(pg);
+    pmm->free(pg->pa);
+    pmm->free(pg);
+}
+
+/**
+ * write a page back to its file, never extending the file: data
+ * past the end only reaches the disk through ext4_fwrite. the caller
+ * holds a reference and not pgcache_lock
+ */
+static int write_page(struct page *pg)
+{
+    ext4_file cursor;
+    if (pg->mp == NULL || ext4_fopen_ino(&cursor, pg->mp, PGCACHE_INO(pg->key), O_RDWR) != EOK)
+    {
+        return -1;
+    }
+    uint64_t off = pg->index * PGSIZE;
+    if (off >= cursor.fsize)
+    {
+        return 0;
+    }
+    size_t len = cursor.fsize - off < PGSIZE ? cursor.fsize - off : PGSIZE;
+    cursor.fpos = off;
+    size_t bytes_written;
+    if (ext4_fwrite(&cursor, pg->pa, len, &bytes_written) != EOK || bytes_written != len)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * write the run of adjacent dirty pages around @pg of the same
+ * object with one ext4_fwrite, so lwext4 can hand contiguous
+ * blocks to the disk in one request. the caller holds pgcache_lock;
+ * it is dropped for the copy and the disk I/O, while the pages are
+ * held and marked clean, and they are marked dirty again on failure
+ */
+static int write_run(struct page *pg)
+{
+    struct page *run[PGCACHE_WB_MAX];
+    uint64_t first = pg->index;
+    struct page *q;
+    while (first > 0 && pg->index - first + 1 < PGCACHE_WB_MAX &&
+           (q = find_page(pg->key, first - 1)) && (q->flags & PG_DIRTY))
+    {
+        first--;
+    }
+    int n = 0;
+    while (n < PGCACHE_WB_MAX && (q = find_page(pg->key, first + n)) && (q->flags & PG_DIRTY))
+    {
+        hold_page(q);
+        q->flags &= ~PG_DIRTY;
+        run[n++] = q;
+    }
+    kmt->spin_unlock(&pgcache_lock);
+
+    int r = 0;
+    char *buf = n > 1 ? pmm->alloc(n * PGSIZE) : NULL;
+    if (buf == NULL)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            r |= write_page(run[i]);
+        }
+    }
+    else
+    {
+        for (int i = 0; i < n; i++)
+        {
+            memcpy(buf + i * PGSIZE, run[i]->pa, PGSIZE);
+        }
+        ext4_file cursor;
+        uint64_t off = first * PGSIZE;
+        if (pg->mp == NULL || ext4_fopen_ino(&cursor, pg->mp, PGCACHE_INO(pg->key), O_RDWR) != EOK)
+        {
+            r = -1;
+        }
+        else if (off < cursor.fsize)
+        {
+            size_t len = cursor.fsize - off < n * PGSIZE ? cursor.fsize - off : n * PGSIZE;
+            cursor.fpos = off;
+            size_t bytes_written;
+            if (ext4_fwrite(&cursor, buf, len, &bytes_written) != EOK || bytes_written != len)
+            {
+                r = -1;
+            }
+        }
+        pmm->free(buf);
+    }
+
+    kmt->spin_lock(&pgcache_lock);
+    for (int i = 0; i < n; i++)
+    {
+        if (r < 0 && !(run[i]->flags & PG_ORPHAN))
+        {
+            run[i]->flags |= PG_DIRTY;
+        }
+        release_page(run[i]);
+    }
+    return r;
+}
+
+/**
+ * write back the dirty pages with a key in [@lo, @hi) that became
+ * dirty at or before @dirtied, stopping at the first failure; the
+ * caller holds pgcache_lock, which write_run drops on the way
+ */
+static int flush(uint64_t lo, uint64_t hi, uint64_t dirtied)
+{
+    for (int i = 0; i < PGCACHE_BUCKETS; i++)
+    {
+        struct page *pg = pages[i];
+        while (pg)
+        {
+            if (pg->key >= lo && pg->key < hi &&
+                (pg->flags & PG_DIRTY) && pg->dirtied <= dirtied)
+            {
+                if (write_run(pg) < 0)
+                {
+                    return -1;
+                }
+                // the chain may have changed while the lock was dropped
+                pg = pages[i];
+                continue;
+            }
+            pg = pg->hnext;
+        }
+    }
+    return 0;
+}
+
+static void flusher_kick()
+{
+    if (!__sync_lock_test_and_set(&flush_pending, true))
+    {
+        kmt->sem_signal(&flush_sem);
+    }
+}
+
+/**
+ * drop unreferenced pages, least recently used first, until at
+ * most @target are left. dirty pages are left to the flusher; only
+ * when @force they are written back first. they stay cached while
+ * being written, so nobody refills them from stale blocks
+ */
+static void shrink(int target, bool force)
+{
+    struct page *pg = lru.prev;
+    while (lru_pages > target && pg != &lru)
+    {
+        struct page *prev = pg->prev;
+        if (pg->flags & PG_DIRTY)
+        {
+            if (!force)
+            {
+                pg = prev;
+                continue;
+            }
+            if (write_run(pg) < 0)
+            {
+                break;
+            }
+            // the list changed while the lock was dropped
+            pg = lru.prev;
+            continue;
+        }
+        lru_unlink(pg);
+        unhash_page(pg);
+        unhash_frame(pg);
+        pmm->free(pg->pa);
+        pmm->free(pg);
+        pg = prev;
+    }
+    if (lru_pages > target)
+    {
+        flusher_kick();
+    }
+}
+
+/**
+ * read one page of @f through a private cursor, so the
+ * file position shared by the owners of @f is left untouched
+ */
+static void fill_page(struct file *f, uint64_t index, void *pa, bool fill)
+{
+    memset(pa, 0, PGSIZE);
+    if (!fill || f == NULL || f->type != FD_FILE)
+    {
+        return;
+    }
+    ext4_file cursor = *(ext4_file *)f->ptr;
+    uint64_t off = index * PGSIZE;
+    if (off >= cursor.fsize)
+    {
+        return;
+    }
+    cursor.flags = O_RDONLY;
+    cursor.fpos = off;
+    size_t bytes_read;
+    ext4_fread(&cursor, pa, PGSIZE, &bytes_read);
+}
+
+static uint64_t pgcache_key(struct file *f)
+{
+    static uint64_t anon_key = PGCACHE_ANON_KEY;
+    if (f == NULL)
+    {
+        return __sync_fetch_and_add(&anon_key, 1);
+    }
+    panic_on(f->type != FD_FILE || !f->fops->cached, "page cache key for a file it does not cache");
+    return PGCACHE_FILE_KEY(f->mnt->id, ((ext4_file *)f->ptr)->inode);
+}
+
+static struct page *get_page(uint64_t key, uint64_t index, struct file *f, bool fill)
+{
+    kmt->spin_lock(&pgcache_lock);
+    struct page *pg = find_page(key, index);
+    if (pg)
+    {
+        hold_page(pg);
+        kmt->spin_unlock(&pgcache_lock);
+        return pg;
+    }
+    kmt->spin_unlock(&pgcache_lock);
+
+    // fill without the lock held, the disk read may be slow
+    void *pa = pmm->alloc(PGSIZE);
+    if (pa == NULL)
+    {
+        // give back what the cache holds for reuse only, then retry
+        kmt->spin_lock(&pgcache_lock);
+        shrink(0, true);
+        kmt->spin_unlock(&pgcache_lock);
+        if ((pa = pmm->alloc(PGSIZE)) == NULL)
+        {
+            return NULL;
+        }
+    }
+    fill_page(f, index, pa, fill);
+
+    kmt->spin_lock(&pgcache_lock);
+    pg = find_page(key, index);
+    if (pg)
+    {
+        // someone else filled the same page meanwhile
+        hold_page(pg);
+        kmt->spin_unlock(&pgcache_lock);
+        pmm->free(pa);
+        return pg;
+    }
+    pg = pmm->alloc(sizeof(struct page));
+    pg->key = key;
+    pg->index = index;
+    pg->pa = pa;
+    pg->mp = (f && f->type == FD_FILE) ? ((ext4_file *)f->ptr)->mp : NULL;
+    pg->ref = 1;
+    pg->flags = 0;
+    insert_page(pg);
+    kmt->spin_unlock(&pgcache_lock);
+    return pg;
+}
+
+/**
+ * return the page @index of object @key with a reference held,
+ * reading it from @f (or zero-filling it when @f is NULL) on a miss
+ */
+static struct page *pgcache_get(uint64_t key, uint64_t index, struct file *f)
+{
+    return get_page(key, index, f, true);
+}
+
+static struct page *pgcache_lookup(void *pa)
+{
+    kmt->spin_lock(&pgcache_lock);
+    struct page *pg;
+    for (pg = frames[hash_frame(pa)]; pg; pg = pg->pnext)
+    {
+        if (pg->pa == pa)
+        {
+            break;
+        }
+    }
+    kmt->spin_unlock(&pgcache_lock);
+    return pg;
+}
+
+static void pgcache_dup(struct page *pg)
+{
+    kmt->spin_lock(&pgcache_lock);
+    panic_on(pg->ref < 1, "pgcache_dup");
+    hold_page(pg);
+    kmt->spin_unlock(&pgcache_lock);
+}
+
+/**
+ * drop a reference; an unreferenced file page stays cached on the
+ * LRU list, anonymous and orphaned pages have nowhere to go back to
+ */
+static void pgcache_put(struct page *pg)
+{
+    kmt->spin_lock(&pgcache_lock);
+    panic_on(pg->ref < 1, "pgcache_put");
+    if (--pg->ref > 0)
+    {
+        kmt->spin_unlock(&pgcache_lock);
+        return;
+    }
+    if (pg->key < PGCACHE_ANON_KEY && !(pg->flags & PG_ORPHAN))
+    {
+        lru_push(pg);
+        shrink(lru_limit, false);
+        kmt->spin_unlock(&pgcache_lock);
+        return;
+    }
+    if (!(pg->flags & PG_ORPHAN))
+    {
+        unhash_page(pg);
+    }
+    unhash_frame(pg);
+    kmt->spin_unlock(&pgcache_lock);
+    pmm->free(pg->pa);
+    pmm->free(pg);
+}
+
+/**
+ * note that @pg was written to; a page cut off by truncate stays clean
+ */
+static void pgcache_mark_dirty(struct page *pg)
+{
+    kmt->spin_lock(&pgcache_lock);
+    if (!(pg->flags & (PG_DIRTY | PG_ORPHAN)))
+    {
+        pg->dirtied = io_read(AM_TIMER_UPTIME).us;
+        pg->flags |= PG_DIRTY;
+    }
+    kmt->spin_unlock(&pgcache_lock);
+}
+
+static int pgcache_writeback(struct page *pg, struct file *f)
+{
+    kmt->spin_lock(&pgcache_lock);
+    if (!(pg->flags & PG_DIRTY))
+    {
+        kmt->spin_unlock(&pgcache_lock);
+        return 0;
+    }
+    pg->flags &= ~PG_DIRTY;
+    if (pg->mp == NULL && f && f->type == FD_FILE)
+    {
+        pg->mp = ((ext4_file *)f->ptr)->mp;
+    }
+    kmt->spin_unlock(&pgcache_lock);
+    int r = write_page(pg);
+    if (r < 0)
+    {
+        kmt->spin_lock(&pgcache_lock);
+        if (!(pg->flags & PG_ORPHAN))
+        {
+            pg->flags |= PG_DIRTY;
+        }
+        kmt->spin_unlock(&pgcache_lock);
+    }
+    return r;
+}
+
+/**
+ * a fresh view of the ext4 file behind @f, its size as on disk now
+ * and not as when @f was opened; the size @f reports is refreshed
+ */
+static int file_cursor(struct file *f, ext4_file *cursor, uint32_t flags)
+{
+    ext4_file *ef = (ext4_file *)f->ptr;
+    if (ext4_fopen_ino(cursor, ef->mp, ef->inode, flags) != EOK)
+    {
+        return -1;
+    }
+    ef->fsize = cursor->fsize;
+    return 0;
+}
+
+/**
+ * read pages [@start, @start + @count) of @cursor into the cache, as
+ * unreferenced pages, with one ext4_fread: lwext4 turns each run of
+ * blocks contiguous on the disk into a single device request. the
+ * batch stops at the first page already cached, so it stays one
+ * contiguous range of the file
+ */
+static void readahead(ext4_file *cursor, uint64_t key, uint64_t start, uint64_t count)
+{
+    uint64_t end = (cursor->fsize + PGSIZE - 1) / PGSIZE;
+    kmt->spin_lock(&pgcache_lock);
+    while (start < end && find_page(key, start))
+    {
+        start++;
+    }
+    count = start + count > end ? end - start : count;
+    for (uint64_t i = 1; i < count; i++)
+    {
+        if (find_page(key, start + i))
+        {
+            count = i;
+            break;
+        }
+    }
+    kmt->spin_unlock(&pgcache_lock);
+    if (start >= end || count == 0)
+    {
+        return;
+    }
+    char *buf = pmm->alloc(count * PGSIZE);
+    if (buf == NULL)
+    {
+        return;
+    }
+    ext4_file ra = *cursor;
+    ra.fpos = start * PGSIZE;
+    size_t bytes_read = 0;
+    ext4_fread(&ra, buf, count * PGSIZE, &bytes_read);
+    memset(buf + bytes_read, 0, count * PGSIZE - bytes_read);
+
+    kmt->spin_lock(&pgcache_lock);
+    for (uint64_t i = 0; i < count && i * PGSIZE < bytes_read; i++)
+    {
+        void *pa;
+        struct page *pg;
+        if (find_page(key, start + i))
+        {
+            continue;
+        }
+        if ((pa = pmm->alloc(PGSIZE)) == NULL || (pg = pmm->alloc(sizeof(struct page))) == NULL)
+        {
+            if (pa)
+            {
+                pmm->free(pa);
+            }
+            break;
+        }
+        memcpy(pa, buf + i * PGSIZE, PGSIZE);
+        pg->key = key;
+        pg->index = start + i;
+        pg->pa = pa;
+        pg->mp = cursor->mp;
+        pg->ref = 0;
+        pg->flags = 0;
+        insert_page(pg);
+        lru_push(pg);
+    }
+    shrink(lru_limit, false);
+    kmt->spin_unlock(&pgcache_lock);
+    pmm->free(buf);
+}
+
+/**
+ * leave pages [@start, @start + @count) of @f to the readahead
+ * worker; a full queue drops the request, readahead is only a hint
+ */
+static void readahead_queue(struct file *f, ext4_file *cursor, uint64_t start, uint64_t count)
+{
+    kmt->spin_lock(&pgcache_lock);
+    if (ra_len == PGCACHE_RA_QUEUE)
+    {
+        kmt->spin_unlock(&pgcache_lock);
+        return;
+    }
+    struct ra_request *rq = &ra_queue[(ra_head + ra_len++) % PGCACHE_RA_QUEUE];
+    rq->mnt = f->mnt;
+    rq->mp = cursor->mp;
+    rq->key = pgcache_key(f);
+    rq->start = start;
+    rq->count = count;
+    // umount waits for the window like for an open file
+    __sync_fetch_and_add(&f->mnt->ref, 1);
+    kmt->spin_unlock(&pgcache_lock);
+    kmt->sem_signal(&ra_sem);
+}
+
+/**
+ * the readahead worker: reads the windows queued by sequential
+ * readers, so a reader only waits for the pages it asked for
+ */
+static void pgcache_readahead(void *arg)
+{
+    while (1)
+    {
+        kmt->sem_wait(&ra_sem);
+        kmt->spin_lock(&pgcache_lock);
+        struct ra_request rq = ra_queue[ra_head];
+        ra_head = (ra_head + 1) % PGCACHE_RA_QUEUE;
+        ra_len--;
+        kmt->spin_unlock(&pgcache_lock);
+        ext4_file cursor;
+        if (ext4_fopen_ino(&cursor, rq.mp, PGCACHE_INO(rq.key), O_RDONLY) == EOK)
+        {
+            for (uint64_t i = 0; i < rq.count; i += PGCACHE_RA_MAX)
+            {
+                readahead(&cursor, rq.key, rq.start + i, rq.count - i < PGCACHE_RA_MAX ? rq.count - i : PGCACHE_RA_MAX);
+            }
+        }
+        __sync_fetch_and_sub(&rq.mnt->ref, 1);
+    }
+}
+
+/**
+ * a read at the position where the last one stopped is sequential:
+ * read ahead once the reader is within half a window of the pages
+ * already read ahead, doubling the window each time. any other read
+ * resets the window. the pages of the read itself are read at once,
+ * in batches; the window past them goes to the readahead worker
+ */
+static void readahead_update(struct file *f, ext4_file *cursor, uint64_t off, size_t n)
+{
+    struct file_ra *ra = &f->ra;
+    if (off != ra->pos)
+    {
+        ra->window = 0;
+        ra->ahead = 0;
+        return;
+    }
+    uint64_t first = off / PGSIZE, last = (off + n - 1) / PGSIZE;
+    if (last + ra->window / 2 < ra->ahead)
+    {
+        return;
+    }
+    uint64_t start = ra->ahead > first ? ra->ahead : first;
+    ra->window = ra->window ? ra->window * 2 : PGCACHE_RA_MIN;
+    if (ra->window > PGCACHE_RA_MAX)
+    {
+        ra->window = PGCACHE_RA_MAX;
+    }
+    for (; start <= last; start += PGCACHE_RA_MAX)
+    {
+        readahead(cursor, pgcache_key(f), start, last - start + 1 < PGCACHE_RA_MAX ? last - start + 1 : PGCACHE_RA_MAX);
+    }
+    if (start * PGSIZE < cursor->fsize)
+    {
+        readahead_queue(f, cursor, start, ra->window);
+    }
+    ra->ahead = start + ra->window;
+}
+
+/**
+ * read @n bytes at @off of the regular file @f through the cache
+ */
+static ssize_t pgcache_read(struct file *f, void *buf, size_t n, uint64_t off)
+{
+    ext4_file cursor;
+    if (file_cursor(f, &cursor, O_RDONLY) < 0)
+    {
+        return -1;
+    }
+    if (off >= cursor.fsize)
+    {
+        return 0;
+    }
+    if (n > cursor.fsize - off)
+    {
+        n = cursor.fsize - off;
+    }
+    readahead_update(f, &cursor, off, n);
+    size_t done = 0;
+    while (done < n)
+    {
+        uint64_t pos = off + done;
+        size_t pgoff = pos % PGSIZE;
+        size_t chunk = PGSIZE - pgoff < n - done ? PGSIZE - pgoff : n - done;
+        struct page *pg = pgcache_get(pgcache_key(f), pos / PGSIZE, f);
+        if (pg == NULL)
+        {
+            return done ? done : -1;
+        }
+        // the copy may fault on a user buffer, never hold the lock here
+        memcpy((char *)buf + done, (char *)pg->pa + pgoff, chunk);
+        pgcache_put(pg);
+        done += chunk;
+    }
+    f->ra.pos = off + done;
+    return done;
+}
+
+/**
+ * ext4_fwrite @buf at the position of @cursor, bounced through a
+ * kernel buffer: ext4 and the disk driver hold their locks while
+ * copying, and a fault on a user buffer may need either of them
+ */
+static ssize_t write_through(ext4_file *cursor, const void *buf, size_t n)
+{
+    char *kbuf = pmm->alloc(n < VFS_COPY_CHUNK ? n : VFS_COPY_CHUNK);
+    if (kbuf == NULL)
+    {
+        return -1;
+    }
+    size_t total = 0;
+    while (total < n)
+    {
+        size_t chunk = n - total < VFS_COPY_CHUNK ? n - total : VFS_COPY_CHUNK;
+        size_t bytes_written = 0;
+        memcpy(kbuf, (const char *)buf + total, chunk);
+        int r = ext4_fwrite(cursor, kbuf, chunk, &bytes_written);
+        total += bytes_written;
+        if (r != EOK || bytes_written < chunk)
+        {
+            break;
+        }
+    }
+    pmm->free(kbuf);
+    return total;
+}
+
+/**
+ * write @n bytes at @off of the regular file @f. overwrites inside
+ * the file only dirty cached pages; a write reaching past the end
+ * needs blocks and a new size, so it goes to ext4 at once and the
+ * pages already cached are brought up to date
+ */
+static ssize_t pgcache_write(struct file *f, const void *buf, size_t n, uint64_t off)
+{
+    ext4_file cursor;
+    if (file_cursor(f, &cursor, O_RDWR) < 0)
+    {
+        return -1;
+    }
+    bool through = n > 0 && off + n > cursor.fsize;
+    if (through)
+    {
+        cursor.fpos = off;
+        ssize_t r = write_through(&cursor, buf, n);
+        ((ext4_file *)f->ptr)->fsize = cursor.fsize;
+        if (r <= 0)
+        {
+            return -1;
+        }
+        n = r;
+    }
+    size_t done = 0;
+    while (done < n)
+    {
+        uint64_t pos = off + done;
+        size_t pgoff = pos % PGSIZE;
+        size_t chunk = PGSIZE - pgoff < n - done ? PGSIZE - pgoff : n - done;
+        struct page *pg;
+        if (through)
+        {
+            kmt->spin_lock(&pgcache_lock);
+            if ((pg = find_page(pgcache_key(f), pos / PGSIZE)) != NULL)
+            {
+                hold_page(pg);
+            }
+            kmt->spin_unlock(&pgcache_lock);
+        }
+        else if ((pg = get_page(pgcache_key(f), pos / PGSIZE, f, chunk < PGSIZE)) == NULL)
+        {
+            return done ? done : -1;
+        }
+        if (pg)
+        {
+            memcpy((char *)pg->pa + pgoff, (const char *)buf + done, chunk);
+            if (!through)
+            {
+                pgcache_mark_dirty(pg);
+            }
+            pgcache_put(pg);
+        }
+        done += chunk;
+    }
+    return done;
+}
+
+/**
+ * write back every page with a key in [@lo, @hi) dirtied so far;
+ * pages dirtied again meanwhile are left to the next call
+ */
+static int sync_range(uint64_t lo, uint64_t hi)
+{
+    uint64_t now = io_read(AM_TIMER_UPTIME).us;
+    kmt->spin_lock(&pgcache_lock);
+    int r = flush(lo, hi, now);
+    kmt->spin_unlock(&pgcache_lock);
+    return r;
+}
+
+static int pgcache_sync(uint64_t key)
+{
+    return sync_range(key, key + 1);
+}
+
+/**
+ * write back the dirty pages of the files on mount @id
+ */
+static int pgcache_syncfs(uint32_t id)
+{
+    return sync_range(PGCACHE_FILE_KEY(id, 0), PGCACHE_FILE_KEY((uint64_t)id + 1, 0));
+}
+
+/**
+ * write back every dirty file page
+ */
+static int pgcache_syncall()
+{
+    return sync_range(0, PGCACHE_ANON_KEY);
+}
+
+static Context *flusher_notify(Event ev, Context *context)
+{
+    if (!flush_pending && io_read(AM_TIMER_UPTIME).us >= flush_next)
+    {
+        flusher_kick();
+    }
+    return NULL;
+}
+
+/**
+ * the flusher: woken by the timer once per PGCACHE_FLUSH_INTERVAL,
+ * or early by a shrink that found only dirty pages, it writes back
+ * pages that stayed dirty too long, or all of them once too many are
+ */
+static void pgcache_flusher(void *arg)
+{
+    while (1)
+    {
+        kmt->sem_wait(&flush_sem);
+        uint64_t now = io_read(AM_TIMER_UPTIME).us;
+        kmt->spin_lock(&pgcache_lock);
+        int cached = 0, dirty = 0;
+        for (int i = 0; i < PGCACHE_BUCKETS; i++)
+        {
+            for (struct page *pg = pages[i]; pg; pg = pg->hnext)
+            {
+                if (pg->key < PGCACHE_ANON_KEY)
+                {
+                    cached++;
+                    dirty += (pg->flags & PG_DIRTY) != 0;
+                }
+            }
+        }
+        if (dirty * 100 > cached * PGCACHE_DIRTY_RATIO || lru_pages > lru_limit)
+        {
+            flush(0, PGCACHE_ANON_KEY, now);
+        }
+        else if (now >= PGCACHE_DIRTY_EXPIRE)
+        {
+            flush(0, PGCACHE_ANON_KEY, now - PGCACHE_DIRTY_EXPIRE);
+        }
+        shrink(lru_limit, false);
+        kmt->spin_unlock(&pgcache_lock);
+        flush_next = now + PGCACHE_FLUSH_INTERVAL;
+        __sync_lock_release(&flush_pending);
+    }
+}
+
+/**
+ * forget the pages of object @key past @size, e.g. once the file
+ * was truncated or its i-node freed; pages still mapped become
+ * orphans, freed with their last reference
+ */
+static void pgcache_truncate(uint64_t key, uint64_t size)
+{
+    uint64_t first = (size + PGSIZE - 1) / PGSIZE;
+    kmt->spin_lock(&pgcache_lock);
+    for (int i = 0; i < PGCACHE_BUCKETS; i++)
+    {
+        struct page **pp = &pages[i];
+        while (*pp)
+        {
+            struct page *pg = *pp;
+            if (pg->key != key || pg->index < first)
+            {
+                if (pg->key == key && pg->index == size / PGSIZE)
+                {
+                    memset((char *)pg->pa + size % PGSIZE, 0, PGSIZE - size % PGSIZE);
+                }
+                pp = &pg->hnext;
+                continue;
+            }
+            *pp = pg->hnext;
+            pg->flags = (pg->flags & ~PG_DIRTY) | PG_ORPHAN;
+            if (pg->ref == 0)
+            {
+                lru_unlink(pg);
+                unhash_frame(pg);
+                pmm->free(pg->pa);
+                pmm->free(pg);
+            }
+        }
+    }
+    kmt->spin_unlock(&pgcache_lock);
+}
+
+static void pgcache_init()
+{
+    kmt->spin_init(&pgcache_lock, "pgcache_lock");
+    lru.next = lru.prev = &lru;
+    lru_pages = 0;
+    lru_limit = ((uintptr_t)heap.end - (uintptr_t)heap.start) / PGSIZE / PGCACHE_SHARE;
+    kmt->sem_init(&flush_sem, "pgcache_flush", 0);
+    flush_next = PGCACHE_FLUSH_INTERVAL;
+    os->on_irq(0, EVENT_IRQ_TIMER, flusher_notify);
+    kmt->create(pmm->alloc(sizeof(task_t)), "pgcache-flusher", pgcache_flusher, NULL);
+    ra_head = ra_len = 0;
+    kmt->sem_init(&ra_sem, "pgcache_readahead", 0);
+    kmt->create(pmm->alloc(sizeof(task_t)), "pgcache-readahead", pgcache_readahead, NULL);
+    for (int i = 0; i < PGCACHE_BUCKETS; i++)
+    {
+        pages[i] = NULL;
+        frames[i] = NULL;
+    }
+}
+
+MODULE_DEF(pgcache) = {
+    .init = pgcache_init,
+    .get = pgcache_get,
+    .lookup = pgcache_lookup,
+    .dup = pgcache_dup,
+    .put = pgcache_put,
+    .mark_dirty = pgcache_mark_dirty,
+    .writeback = pgcache_writeback,
+    .key = pgcache_key,
+    .read = pgcache_read,
+    .write = pgcache_write,
+    .sync = pgcache_sync,
+    .syncfs = pgcache_syncfs,
+    .syncall = pgcache_syncall,
+    .truncate = pgcache_truncate,
+};
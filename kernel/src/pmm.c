@@ -2,12 +2,19 @@
 #define MIN_BLOCK_SIZE 16 // 最小块大小
 #define MAX_ORDER 31      // 最大阶数
 #define THREAD_NUM 8        // 线程数
+#define LARGE_POOL_FRACTION 8 // 大页池占堆的比例
 uintptr_t pgsize;    
+static void *large_pages; // 空闲大页链表，链接指针存放在页首
+static uintptr_t pool_start; // 大页池起始地址，其上的伙伴分区是借来的大页
+static spinlock_t large_lock;
+static void *kalloc_large();
+static void kfree_large(void *ptr);
 struct block_t
 {
     size_t size;          
     int order;            
     int free;             
+    int owner;            // 所在分区挂在哪个空闲链表上，整个分区内的块都相同
     struct block_t *next; 
     void *start_addr;     
     size_t offset;
@@ -57,8 +64,9 @@ static block_t find_buddy(block_t block)
     uintptr_t start_addr = (uintptr_t)block->start_addr;
     uintptr_t offset = block_addr - start_addr;
     uintptr_t buddy_offset = offset ^ block->size;
+    uintptr_t span = start_addr >= pool_start ? LPGSIZE : pgsize;
 
-    if (buddy_offset < pgsize)
+    if (buddy_offset < span)
     {
         block_t buddy = (block_t)(start_addr + buddy_offset);
         if (buddy->size == block->size && buddy->order == block->order)
@@ -74,7 +82,7 @@ static block_t split_block(block_t block, int target_order)
 {
     int curr_order = block->order;
     void *start_addr = block->start_addr;
-    int tid = gettid() % THREAD_NUM;
+    int owner = block->owner;
     while (curr_order > target_order)
     {
         curr_order--;
@@ -83,8 +91,9 @@ static block_t split_block(block_t block, int target_order)
         buddy->size = new_size;
         buddy->order = curr_order;
         buddy->free = 1;
-        buddy->next = free_lists[tid][curr_order];
-        free_lists[tid][curr_order] = buddy;
+        buddy->owner = owner;
+        buddy->next = free_lists[owner][curr_order];
+        free_lists[owner][curr_order] = buddy;
         buddy->start_addr = start_addr;
         buddy->offset = 0;              
         block->size = new_size;
@@ -98,9 +107,8 @@ static void remove_from_free_list(block_t block)
 {
     if (!block || !block->free)
         return;
-    int tid = gettid() % THREAD_NUM;
     int order = block->order;
-    block_t *curr = &free_lists[tid][order];
+    block_t *curr = &free_lists[block->owner][order];
 
     while (*curr != NULL)
     {
@@ -173,11 +181,20 @@ void *kalloc(size_t size)
         order++;
     }
 
+    if (!block && total_size <= LPGSIZE && (block = kalloc_large()) != NULL)
+    {
+        // 分区用完时借一个空闲大页作为新的分区，整页释放后归还大页池
+        block->size = LPGSIZE;
+        block->order = get_order(LPGSIZE);
+        block->start_addr = block;
+        block->owner = tid;
+        order = block->order;
+    }
     if (!block)
     {
         kmt->spin_unlock(&thread_lock[tid]);
-        panic( "No free block found");
-        return NULL; 
+        // out of memory: callers on the user paths invoke the OOM killer
+        return NULL;
     }
     if (order > req_order)
     {
@@ -192,6 +209,8 @@ void *kalloc(size_t size)
         user_addr += alignment_offset;
         user_ptr = (void *)user_addr;
         block->offset = header_size + alignment_offset;
+        // 对齐留出的空隙里也记下偏移，kfree 从用户指针前一个字找回块头
+        *(size_t *)(user_addr - sizeof(size_t)) = block->offset;
     }
     else
     {
@@ -205,59 +224,72 @@ void kfree(void *ptr)
 {
     if (!ptr)
         return;
-    int tid = gettid() % THREAD_NUM;
-    block_t possible_block = (block_t)((uintptr_t)ptr - sizeof(struct block_t));
-    block_t block = NULL;
-    if (possible_block && possible_block->offset > 0 &&
-        possible_block->offset <= 1024 && // 设置一个合理的上限
-        (uintptr_t)ptr == (uintptr_t)possible_block + possible_block->offset)
+    // 用户指针前一个字是块头的 offset 字段，或 kalloc 在对齐空隙里存的副本
+    size_t offset = *(size_t *)((uintptr_t)ptr - sizeof(size_t));
+    block_t block = (block_t)((uintptr_t)ptr - offset);
+    if (offset < sizeof(struct block_t) || offset >= (1UL << MAX_ORDER) || block->offset != offset ||
+        block->free || block->order < 0 || block->order > MAX_ORDER)
     {
-        block = possible_block;
+        return;
     }
-    else
-    {
-        for (size_t offset = sizeof(struct block_t); offset <= sizeof(struct block_t) * 2; offset += 8)
-        {
-            possible_block = (block_t)((uintptr_t)ptr - offset);
-            if (possible_block && possible_block->offset == offset &&
-                possible_block->order >= 0 && possible_block->order <= MAX_ORDER)
-            {
-                block = possible_block;
-                break;
-            }
-        }
 
-        if (!block)
-        {
-            for (size_t offset = 8; offset <= 128; offset += 8)
-            {
-                possible_block = (block_t)((uintptr_t)ptr - offset);
-                if (possible_block && possible_block->offset == offset)
-                {
-                    block = possible_block;
-                    break;
-                }
-            }
-        }
-    }
-    if (!block)
+    // 块回到它所在分区的链表，伙伴只会在那里找到
+    int owner = block->owner;
+    kmt->spin_lock(&thread_lock[owner]);
+    block->free = 1;
+    block = merge_blocks(block);
+    if ((uintptr_t)block->start_addr >= pool_start && block->size == LPGSIZE)
     {
+        kmt->spin_unlock(&thread_lock[owner]);
+        kfree_large(block);
         return;
     }
+    block->next = free_lists[owner][block->order];
+    free_lists[owner][block->order] = block;
+    kmt->spin_unlock(&thread_lock[owner]);
+}
 
-    block->free = 1;
-    kmt->spin_lock(&thread_lock[tid]);
-    block = merge_blocks(block);
-    block->next = free_lists[tid][block->order];
-    free_lists[tid][block->order] = block;
-    kmt->spin_unlock(&thread_lock[tid]);
+/**
+ * 2 MiB pages come from a pool carved off the top of the heap:
+ * an in-block header would push a buddy block to 4 MiB
+ */
+static void *kalloc_large()
+{
+    kmt->spin_lock(&large_lock);
+    void *page = large_pages;
+    if (page)
+    {
+        large_pages = *(void **)page;
+    }
+    kmt->spin_unlock(&large_lock);
+    return page;
 }
 
+static void kfree_large(void *ptr)
+{
+    if (!ptr)
+        return;
+    panic_on((uintptr_t)ptr % LPGSIZE != 0, "freeing a misaligned large page");
+    kmt->spin_lock(&large_lock);
+    *(void **)ptr = large_pages;
+    large_pages = ptr;
+    kmt->spin_unlock(&large_lock);
+}
 
 static void pmm_init()
 {
     uintptr_t pmsize = ((uintptr_t)heap.end - (uintptr_t)heap.start);
-    pgsize = pmsize / THREAD_NUM;
+    kmt->spin_init(&large_lock, "pmm_large_lock");
+    // 伙伴系统的分区大小取 2 的幂，其余(至少 1/LARGE_POOL_FRACTION)作为大页池，
+    // 分区用完时 kalloc 再向大页池借页
+    pgsize = 1UL << (get_order((pmsize - pmsize / LARGE_POOL_FRACTION) / THREAD_NUM + 1) - 1);
+    pmsize = pgsize * THREAD_NUM;
+    pool_start = ROUNDUP((uintptr_t)heap.start + pmsize, LPGSIZE);
+    for (uintptr_t page = pool_start; page + LPGSIZE <= (uintptr_t)heap.end; page += LPGSIZE)
+    {
+        *(void **)page = large_pages;
+        large_pages = (void *)page;
+    }
     for (size_t i = 0; i < THREAD_NUM; i++)
     {
         kmt->spin_init(&thread_lock[i], "pmm_spinlock");
@@ -265,6 +297,7 @@ static void pmm_init()
         block->size = pgsize;
         block->order = get_order(block->size);
         block->free = 1;
+        block->owner = i;
         block->next = free_lists[i][block->order];
         block->start_addr = block;
         free_lists[i][block->order] = block;
@@ -278,4 +311,6 @@ MODULE_DEF(pmm) = {
     .init = pmm_init,
     .alloc = kalloc,
     .free = kfree,
+    .alloc_large = kalloc_large,
+    .free_large = kfree_large,
 };
@@ -0,0 +1,619 @@
+#include <common.h>
+#include <vfs.h>
+#define EP_BUCKETS 64
+
+// A poll() or epoll_wait() caller hooked on the queues it scanned
+struct poll_wqueues
+{
+    struct poll_table pt;
+    sem_t sem;                  // signalled by every hooked queue
+    int n, max;                 // entries used / available
+    struct wait_entry *entries; // one per queue
+    int64_t deadline;           // uptime (us) the timer signals sem at
+    struct poll_wqueues *tnext; // list of callers sleeping with a deadline
+};
+
+// A file watched by an epoll instance
+struct epitem
+{
+    struct wait_entry we;  // hooked on the file's queue, if it has one
+    struct eventpoll *ep;
+    struct file *f;        // held until the item is removed
+    int fd;
+    uint32_t events;       // EPOLL* bits asked for, 0 once a oneshot fired
+    epoll_data_t data;
+    bool ready;            // on the ready list
+    struct epitem *hnext;  // fd hash chain
+    struct epitem *rnext;  // ready list
+};
+
+struct eventpoll
+{
+    spinlock_t lock;
+    struct epitem *items[EP_BUCKETS];
+    struct epitem *rdlist, *rdtail; // items that may have events, FIFO
+    struct wait_queue wq;           // epoll_wait callers and pollers of the epoll fd
+};
+
+struct ep_pqueue
+{
+    struct poll_table pt;
+    struct epitem *epi;
+};
+
+static spinlock_t timer_lock;
+static struct poll_wqueues *timers; // callers waiting for a deadline
+
+static void poll_queue_init(struct wait_queue *wq)
+{
+    kmt->spin_init(&wq->lock, "wait_queue");
+    wq->head = NULL;
+}
+
+static void waitq_add(struct wait_queue *wq, struct wait_entry *we)
+{
+    kmt->spin_lock(&wq->lock);
+    we->wq = wq;
+    we->next = wq->head;
+    wq->head = we;
+    kmt->spin_unlock(&wq->lock);
+}
+
+/**
+ * unhook @we; once this returns its callback is not running anywhere
+ */
+static void waitq_del(struct wait_entry *we)
+{
+    struct wait_queue *wq = we->wq;
+    if (wq == NULL)
+    {
+        return;
+    }
+    kmt->spin_lock(&wq->lock);
+    for (struct wait_entry **pp = &wq->head; *pp; pp = &(*pp)->next)
+    {
+        if (*pp == we)
+        {
+            *pp = we->next;
+            break;
+        }
+    }
+    kmt->spin_unlock(&wq->lock);
+    we->wq = NULL;
+}
+
+static void poll_wake(struct wait_queue *wq)
+{
+    kmt->spin_lock(&wq->lock);
+    for (struct wait_entry *we = wq->head; we; we = we->next)
+    {
+        we->func(we);
+    }
+    kmt->spin_unlock(&wq->lock);
+}
+
+static void poll_wait(struct wait_queue *wq, struct poll_table *pt)
+{
+    if (wq && pt)
+    {
+        pt->queue(pt, wq);
+    }
+}
+
+static void pollwake(struct wait_entry *we)
+{
+    kmt->sem_signal((sem_t *)we->priv);
+}
+
+static void pollqueue(struct poll_table *pt, struct wait_queue *wq)
+{
+    struct poll_wqueues *pwq = (struct poll_wqueues *)pt;
+    if (pwq->n == pwq->max)
+    {
+        return;
+    }
+    struct wait_entry *we = &pwq->entries[pwq->n++];
+    we->func = pollwake;
+    we->priv = &pwq->sem;
+    waitq_add(wq, we);
+}
+
+static void poll_initwait(struct poll_wqueues *pwq, struct wait_entry *entries, int max)
+{
+    pwq->pt.queue = pollqueue;
+    pwq->n = 0;
+    pwq->max = max;
+    pwq->entries = entries;
+    kmt->sem_init(&pwq->sem, "poll", 0);
+}
+
+static void poll_freewait(struct poll_wqueues *pwq)
+{
+    for (int i = 0; i < pwq->n; i++)
+    {
+        waitq_del(&pwq->entries[i]);
+    }
+    pwq->n = 0;
+}
+
+/**
+ * take @pwq off the timer list if the timer has not done it yet
+ */
+static void timer_del(struct poll_wqueues *pwq)
+{
+    kmt->spin_lock(&timer_lock);
+    for (struct poll_wqueues **pp = &timers; *pp; pp = &(*pp)->tnext)
+    {
+        if (*pp == pwq)
+        {
+            *pp = pwq->tnext;
+            break;
+        }
+    }
+    kmt->spin_unlock(&timer_lock);
+}
+
+/**
+ * sleep until a hooked queue is woken or, when there is a @deadline,
+ * until the timer tick that finds it passed; false once it passed
+ */
+static bool poll_block(struct poll_wqueues *pwq, int64_t deadline)
+{
+    if (deadline >= 0 && io_read(AM_TIMER_UPTIME).us >= deadline)
+    {
+        return false;
+    }
+    if (deadline >= 0)
+    {
+        pwq->deadline = deadline;
+        kmt->spin_lock(&timer_lock);
+        pwq->tnext = timers;
+        timers = pwq;
+        kmt->spin_unlock(&timer_lock);
+    }
+    kmt->sem_wait(&pwq->sem);
+    if (deadline >= 0)
+    {
+        timer_del(pwq);
+    }
+    return true;
+}
+
+/**
+ * wake the callers whose deadline passed, each once: they leave the
+ * list as they are signalled
+ */
+static Context *poll_timer(Event ev, Context *context)
+{
+    if (timers == NULL)
+    {
+        return NULL;
+    }
+    int64_t now = io_read(AM_TIMER_UPTIME).us;
+    kmt->spin_lock(&timer_lock);
+    struct poll_wqueues **pp = &timers;
+    while (*pp)
+    {
+        struct poll_wqueues *pwq = *pp;
+        if (pwq->deadline <= now)
+        {
+            *pp = pwq->tnext;
+            kmt->sem_signal(&pwq->sem);
+        }
+        else
+        {
+            pp = &pwq->tnext;
+        }
+    }
+    kmt->spin_unlock(&timer_lock);
+    return NULL;
+}
+
+static int64_t poll_deadline(int64_t timeout_us)
+{
+    return timeout_us < 0 ? -1 : io_read(AM_TIMER_UPTIME).us + timeout_us;
+}
+
+static int poll_scan(task_t *task, struct pollfd *fds, int nfds, struct poll_table *pt)
+{
+    int count = 0;
+    for (int i = 0; i < nfds; i++)
+    {
+        fds[i].revents = 0;
+        if (fds[i].fd < 0)
+        {
+            continue;
+        }
+        struct file *f = fdt->get(task, fds[i].fd);
+        int mask = f ? vfs->poll(f, pt) & (fds[i].events | POLLERR | POLLHUP) : POLLNVAL;
+        if (mask)
+        {
+            fds[i].revents = mask;
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * wait up to @timeout_us (forever when negative) for one of @fds to
+ * be ready; returns how many have revents set
+ */
+static int poll_poll(task_t *task, struct pollfd *ufds, int nfds, int64_t timeout_us)
+{
+    if (nfds < 0 || nfds > NOFILE_MAX)
+    {
+        return -1;
+    }
+    struct pollfd *fds = pmm->alloc((nfds + 1) * sizeof(struct pollfd));
+    struct wait_entry *entries = pmm->alloc((nfds + 1) * sizeof(struct wait_entry));
+    if (fds == NULL || entries == NULL)
+    {
+        pmm->free(fds);
+        pmm->free(entries);
+        return -1;
+    }
+    memcpy(fds, ufds, nfds * sizeof(struct pollfd));
+    int64_t deadline = poll_deadline(timeout_us);
+    struct poll_wqueues pwq;
+    poll_initwait(&pwq, entries, nfds);
+    int count;
+    while (1)
+    {
+        // hook first and then look, so no wakeup falls in between
+        count = poll_scan(task, fds, nfds, timeout_us ? &pwq.pt : NULL);
+        bool again = count == 0 && timeout_us != 0 && poll_block(&pwq, deadline);
+        poll_freewait(&pwq);
+        if (!again)
+        {
+            break;
+        }
+        kmt->sem_init(&pwq.sem, "poll", 0);
+    }
+    for (int i = 0; i < nfds; i++)
+    {
+        ufds[i].revents = fds[i].revents;
+    }
+    pmm->free(fds);
+    pmm->free(entries);
+    return count;
+}
+
+/**
+ * queue @epi for the next epoll_wait; called with ep->lock held
+ */
+static void ep_ready(struct eventpoll *ep, struct epitem *epi)
+{
+    if (epi->ready)
+    {
+        return;
+    }
+    epi->ready = true;
+    epi->rnext = NULL;
+    if (ep->rdtail)
+    {
+        ep->rdtail->rnext = epi;
+    }
+    else
+    {
+        ep->rdlist = epi;
+    }
+    ep->rdtail = epi;
+}
+
+static void ep_unready(struct eventpoll *ep, struct epitem *epi)
+{
+    if (!epi->ready)
+    {
+        return;
+    }
+    struct epitem *prev = NULL;
+    for (struct epitem **pp = &ep->rdlist; *pp; prev = *pp, pp = &(*pp)->rnext)
+    {
+        if (*pp == epi)
+        {
+            *pp = epi->rnext;
+            if (ep->rdtail == epi)
+            {
+                ep->rdtail = prev;
+            }
+            break;
+        }
+    }
+    epi->ready = false;
+}
+
+/**
+ * woken by the watched file: only queue the item, epoll_wait asks
+ * the file again for the actual events
+ */
+static void ep_callback(struct wait_entry *we)
+{
+    struct epitem *epi = (struct epitem *)we->priv;
+    struct eventpoll *ep = epi->ep;
+    bool wake = false;
+    kmt->spin_lock(&ep->lock);
+    if (epi->events && !epi->ready)
+    {
+        ep_ready(ep, epi);
+        wake = true;
+    }
+    kmt->spin_unlock(&ep->lock);
+    if (wake)
+    {
+        poll_wake(&ep->wq);
+    }
+}
+
+static void ep_ptable_queue(struct poll_table *pt, struct wait_queue *wq)
+{
+    struct epitem *epi = ((struct ep_pqueue *)pt)->epi;
+    if (epi->we.wq)
+    {
+        return;
+    }
+    epi->we.func = ep_callback;
+    epi->we.priv = epi;
+    waitq_add(wq, &epi->we);
+}
+
+static struct epitem **ep_find(struct eventpoll *ep, int fd, struct file *f)
+{
+    struct epitem **pp;
+    for (pp = &ep->items[fd % EP_BUCKETS]; *pp; pp = &(*pp)->hnext)
+    {
+        if ((*pp)->fd == fd && (*pp)->f == f)
+        {
+            break;
+        }
+    }
+    return pp;
+}
+
+static void ep_free(struct epitem *epi)
+{
+    waitq_del(&epi->we);
+    vfs->close(epi->f);
+    pmm->free(epi);
+}
+
+static struct file *epoll_create()
+{
+    struct eventpoll *ep = pmm->alloc(sizeof(struct eventpoll));
+    if (ep == NULL)
+    {
+        return NULL;
+    }
+    memset(ep, 0, sizeof(struct eventpoll));
+    kmt->spin_init(&ep->lock, "eventpoll");
+    poll_queue_init(&ep->wq);
+    struct file *f = vfs->alloc();
+    if (f == NULL)
+    {
+        pmm->free(ep);
+        return NULL;
+    }
+    f->type = FD_EPOLL;
+    f->readable = 0;
+    f->writable = 0;
+    f->ptr = ep;
+    return f;
+}
+
+static int epoll_add(struct eventpoll *ep, int fd, struct file *f, struct epoll_event *ev)
+{
+    struct epitem *epi = pmm->alloc(sizeof(struct epitem));
+    if (epi == NULL)
+    {
+        return -1;
+    }
+    memset(epi, 0, sizeof(struct epitem));
+    epi->ep = ep;
+    epi->f = vfs->dup(f);
+    epi->fd = fd;
+    epi->events = ev->events | EPOLLERR | EPOLLHUP;
+    epi->data = ev->data;
+    // hook outside ep->lock, the file's queue lock is taken first on wakeups
+    struct ep_pqueue q = {.pt.queue = ep_ptable_queue, .epi = epi};
+    int mask = vfs->poll(f, &q.pt);
+
+    kmt->spin_lock(&ep->lock);
+    struct epitem **pp = ep_find(ep, fd, f);
+    if (*pp)
+    {
+        epi->events = 0;
+        ep_unready(ep, epi);
+        kmt->spin_unlock(&ep->lock);
+        ep_free(epi);
+        return -1;
+    }
+    *pp = epi;
+    bool wake = (mask & epi->events) && !epi->ready;
+    if (mask & epi->events)
+    {
+        ep_ready(ep, epi);
+    }
+    kmt->spin_unlock(&ep->lock);
+    if (wake)
+    {
+        poll_wake(&ep->wq);
+    }
+    return 0;
+}
+
+static int epoll_ctl(struct file *epf, int op, int fd, struct file *f, struct epoll_event *ev)
+{
+    // no nesting: a wakeup looping back through epoll fds would take a wait queue lock twice
+    if (epf->type != FD_EPOLL || f->type == FD_EPOLL)
+    {
+        return -1;
+    }
+    struct eventpoll *ep = (struct eventpoll *)epf->ptr;
+    if (op == EPOLL_CTL_ADD)
+    {
+        return epoll_add(ep, fd, f, ev);
+    }
+    kmt->spin_lock(&ep->lock);
+    struct epitem **pp = ep_find(ep, fd, f);
+    struct epitem *epi = *pp;
+    if (epi == NULL || (op != EPOLL_CTL_MOD && op != EPOLL_CTL_DEL))
+    {
+        kmt->spin_unlock(&ep->lock);
+        return -1;
+    }
+    if (op == EPOLL_CTL_DEL)
+    {
+        // a callback running meanwhile sees no events and leaves it alone
+        *pp = epi->hnext;
+        epi->events = 0;
+        ep_unready(ep, epi);
+        kmt->spin_unlock(&ep->lock);
+        ep_free(epi);
+        return 0;
+    }
+    epi->events = ev->events | EPOLLERR | EPOLLHUP;
+    epi->data = ev->data;
+    bool wake = false;
+    if ((vfs->poll(f, NULL) & epi->events) && !epi->ready)
+    {
+        ep_ready(ep, epi);
+        wake = true;
+    }
+    kmt->spin_unlock(&ep->lock);
+    if (wake)
+    {
+        poll_wake(&ep->wq);
+    }
+    return 0;
+}
+
+/**
+ * move up to @max events off the ready list into @events; level
+ * triggered items that still have events go back to its tail
+ */
+static int ep_harvest(struct eventpoll *ep, struct epoll_event *events, int max)
+{
+    int n = 0;
+    kmt->spin_lock(&ep->lock);
+    struct epitem *list = ep->rdlist;
+    ep->rdlist = ep->rdtail = NULL;
+    while (list)
+    {
+        struct epitem *epi = list;
+        list = epi->rnext;
+        epi->ready = false;
+        // the poll callbacks take no locks without a table
+        int mask = vfs->poll(epi->f, NULL) & epi->events;
+        if (mask == 0)
+        {
+            continue;
+        }
+        if (n == max)
+        {
+            ep_ready(ep, epi);
+            continue;
+        }
+        events[n].events = mask;
+        events[n].data = epi->data;
+        n++;
+        if (epi->events & EPOLLONESHOT)
+        {
+            epi->events = 0;
+        }
+        else if (!(epi->events & EPOLLET))
+        {
+            ep_ready(ep, epi);
+        }
+    }
+    kmt->spin_unlock(&ep->lock);
+    return n;
+}
+
+static int epoll_wait(struct file *epf, struct epoll_event *uevents, int maxevents, int64_t timeout_us)
+{
+    if (epf->type != FD_EPOLL || maxevents <= 0 || maxevents > EPOLL_MAX_EVENTS)
+    {
+        return -1;
+    }
+    struct eventpoll *ep = (struct eventpoll *)epf->ptr;
+    // user memory may fault, fill a kernel copy under the lock
+    struct epoll_event *events = pmm->alloc(maxevents * sizeof(struct epoll_event));
+    if (events == NULL)
+    {
+        return -1;
+    }
+    int64_t deadline = poll_deadline(timeout_us);
+    struct wait_entry entry;
+    struct poll_wqueues pwq;
+    poll_initwait(&pwq, &entry, 1);
+    int n;
+    while (1)
+    {
+        if (timeout_us != 0)
+        {
+            poll_wait(&ep->wq, &pwq.pt);
+        }
+        n = ep_harvest(ep, events, maxevents);
+        bool again = n == 0 && timeout_us != 0 && poll_block(&pwq, deadline);
+        poll_freewait(&pwq);
+        if (!again)
+        {
+            break;
+        }
+        kmt->sem_init(&pwq.sem, "poll", 0);
+    }
+    memcpy(uevents, events, n * sizeof(struct epoll_event));
+    pmm->free(events);
+    return n;
+}
+
+static int epoll_poll(struct file *epf, struct poll_table *pt)
+{
+    struct eventpoll *ep = (struct eventpoll *)epf->ptr;
+    poll_wait(&ep->wq, pt);
+    return ep->rdlist ? POLLIN : 0;
+}
+
+static void epoll_release(void *p)
+{
+    struct eventpoll *ep = (struct eventpoll *)p;
+    kmt->spin_lock(&ep->lock);
+    for (int i = 0; i < EP_BUCKETS; i++)
+    {
+        for (struct epitem *epi = ep->items[i]; epi; epi = epi->hnext)
+        {
+            epi->events = 0;
+        }
+    }
+    kmt->spin_unlock(&ep->lock);
+    for (int i = 0; i < EP_BUCKETS; i++)
+    {
+        while (ep->items[i])
+        {
+            struct epitem *epi = ep->items[i];
+            ep->items[i] = epi->hnext;
+            ep_free(epi);
+        }
+    }
+    pmm->free(ep);
+}
+
+static void poll_init()
+{
+    kmt->spin_init(&timer_lock, "poll_timer");
+    timers = NULL;
+    os->on_irq(0, EVENT_IRQ_TIMER, poll_timer);
+}
+
+MODULE_DEF(poll) = {
+    .init = poll_init,
+    .queue_init = poll_queue_init,
+    .wait = poll_wait,
+    .wake = poll_wake,
+    .poll = poll_poll,
+    .epoll_create = epoll_create,
+    .epoll_ctl = epoll_ctl,
+    .epoll_wait = epoll_wait,
+    .epoll_poll = epoll_poll,
+    .epoll_release = epoll_release,
+};
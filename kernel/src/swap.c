@@ -0,0 +1,166 @@
+#include <common.h>
+#include <devices.h>
+#include <ext4.h>
+#define SWAP_PATH "/swapfile"
+#define SWAP_PAGES 4096 // 16 MiB of swap slots
+static spinlock_t swap_lock;
+static device_t *sda;
+static uint64_t *blkoff;        // 交换文件每个块在 sda 上的字节偏移
+static uint32_t bsize;          // 文件系统块大小
+static int nslots;              // 可用的槽位数
+static bool slots[SWAP_PAGES];  // 槽位是否被占用
+static int swap_hint;           // 下一次分配从这里开始找
+static int swap_inuse;          // 被占用的槽位数
+
+/**
+ * the swap file is recreated at boot, filled so that every block
+ * is allocated, and its blocks are then accessed on sda directly:
+ * page faults may come from inside the file system, which must
+ * not be re-entered
+ */
+static void swap_init()
+{
+    kmt->spin_init(&swap_lock, "swap_lock");
+    sda = dev->lookup("sda");
+    ext4_file f;
+    if (ext4_fopen(&f, SWAP_PATH, "w+") != EOK)
+    {
+        printf("swap: cannot create %s, swapping disabled\n", SWAP_PATH);
+        return;
+    }
+    void *zero = pmm->alloc(PGSIZE);
+    if (zero == NULL)
+    {
+        ext4_fclose(&f);
+        printf("swap: out of memory, swapping disabled\n");
+        return;
+    }
+    memset(zero, 0, PGSIZE);
+    int pages = 0;
+    size_t bytes_written = PGSIZE;
+    while (pages < SWAP_PAGES && bytes_written == PGSIZE)
+    {
+        if (ext4_fwrite(&f, zero, PGSIZE, &bytes_written) == EOK && bytes_written == PGSIZE)
+        {
+            pages++;
+        }
+    }
+    pmm->free(zero);
+    uint64_t off;
+    if (pages == 0 || ext4_fbmap(&f, 0, &off, &bsize) != EOK || PGSIZE % bsize != 0)
+    {
+        ext4_fclose(&f);
+        printf("swap: cannot map %s, swapping disabled\n", SWAP_PATH);
+        return;
+    }
+    int nblocks = pages * (PGSIZE / bsize);
+    blkoff = pmm->alloc(nblocks * sizeof(uint64_t));
+    if (blkoff == NULL)
+    {
+        ext4_fclose(&f);
+        printf("swap: out of memory, swapping disabled\n");
+        return;
+    }
+    int i;
+    for (i = 0; i < nblocks; i++)
+    {
+        if (ext4_fbmap(&f, (uint64_t)i * bsize, &blkoff[i], &bsize) != EOK)
+        {
+            break;
+        }
+    }
+    ext4_fclose(&f);
+    nslots = i / (PGSIZE / bsize);
+    printf("swap: %d KiB on sda\n", nslots * PGSIZE / 1024);
+}
+
+/**
+ * transfer the page in @slot, merging blocks adjacent on the device;
+ * called without swap_lock, the slot belongs to the caller
+ */
+static void swap_io(int slot, void *pa, bool write)
+{
+    int per_page = PGSIZE / bsize;
+    uint64_t *blk = &blkoff[slot * per_page];
+    for (int i = 0; i < per_page;)
+    {
+        int n = 1;
+        while (i + n < per_page && blk[i + n] == blk[i] + n * bsize)
+        {
+            n++;
+        }
+        if (write)
+        {
+            sda->ops->write(sda, blk[i], (char *)pa + i * bsize, n * bsize);
+        }
+        else
+        {
+            sda->ops->read(sda, blk[i], (char *)pa + i * bsize, n * bsize);
+        }
+        i += n;
+    }
+}
+
+/**
+ * write the page at @pa to a free slot; returns the slot, or -1
+ * when there is no swap space left
+ */
+static int swap_out(void *pa)
+{
+    kmt->spin_lock(&swap_lock);
+    int slot = -1;
+    for (int i = 0; i < nslots; i++)
+    {
+        int s = (swap_hint + i) % nslots;
+        if (!slots[s])
+        {
+            slot = s;
+            break;
+        }
+    }
+    if (slot < 0)
+    {
+        kmt->spin_unlock(&swap_lock);
+        return -1;
+    }
+    slots[slot] = true;
+    swap_inuse++;
+    swap_hint = slot + 1;
+    kmt->spin_unlock(&swap_lock);
+    swap_io(slot, pa, true);
+    return slot;
+}
+
+static void swap_in(int slot, void *pa)
+{
+    kmt->spin_lock(&swap_lock);
+    panic_on(slot < 0 || slot >= nslots || !slots[slot], "swapping in a free slot");
+    kmt->spin_unlock(&swap_lock);
+    swap_io(slot, pa, false);
+}
+
+static void swap_free(int slot)
+{
+    kmt->spin_lock(&swap_lock);
+    panic_on(slot < 0 || slot >= nslots || !slots[slot], "freeing a free swap slot");
+    slots[slot] = false;
+    swap_inuse--;
+    if (slot < swap_hint)
+    {
+        swap_hint = slot;
+    }
+    kmt->spin_unlock(&swap_lock);
+}
+
+static int swap_used()
+{
+    return swap_inuse;
+}
+
+MODULE_DEF(swapper) = {
+    .init = swap_init,
+    .out = swap_out,
+    .in = swap_in,
+    .free = swap_free,
+    .used = swap_used,
+};
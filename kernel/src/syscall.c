@@ -3,11 +3,9 @@
 #include <vfs.h>
 #include <elf.h>
 
-static int load_elf(task_t *task, const char *elf_data, size_t file_size, void **entry_point);
-static int load_elf_segment(task_t *task, const char *elf_data, size_t file_size, Elf64_Phdr *phdr);
-static int copy_segment_data(const char *elf_data, size_t file_size, Elf64_Phdr *phdr,
-                             void *page, uintptr_t page_vaddr, uintptr_t vaddr_start,
-                             uintptr_t vaddr_end, size_t pgsize);
+static int load_elf_headers(struct file *f, Elf64_Ehdr *ehdr, Elf64_Phdr **phdr);
+static int load_elf(task_t *task, struct file *f, Elf64_Ehdr *ehdr, Elf64_Phdr *phdr, void **entry_point);
+static int load_elf_segment(task_t *task, struct file *f, Elf64_Phdr *phdr, uintptr_t prev_end);
 
 // Allocate a file descriptor for the given file. Takes over file reference.
 static int fdalloc(task_t *task, struct file *f)
@@ -16,15 +14,7 @@ static int fdalloc(task_t *task, struct file *f)
     if (!task || !task->pi)
         return -1;
 
-    for (int fd = 0; fd < NOFILE; fd++)
-    {
-        if (task->open_files[fd] == NULL)
-        {
-            task->open_files[fd] = f;
-            return fd;
-        }
-    }
-    return -1;
+    return fdt->alloc(task, f, 0);
 }
 
 static int parse_path(char *buf, task_t *task, int dirfd, const char *path)
@@ -52,8 +42,8 @@ static int parse_path(char *buf, task_t *task, int dirfd, const char *path)
     }
     else
     {
-        struct file *f = task->open_files[dirfd];
-        if (f == NULL || f->type != FD_DIR)
+        struct file *f = fdt->get(task, dirfd);
+        if (f == NULL || f->type != FD_DIR || f->path == NULL)
         {
             return -1;
         }
@@ -237,13 +227,10 @@ static uint64_t syscall_openat(task_t *task, int fd, const char *filename, int f
 
 static uint64_t syscall_close(task_t *task, int fd)
 {
-    if (fd < 0 || fd >= NOFILE)
-        return -1;
-    struct file *f = task->open_files[fd];
+    struct file *f = fdt->remove(task, fd);
     if (f == NULL)
         return -1;
 
-    task->open_files[fd] = NULL;
     vfs->close(f);
     return 0;
 }
@@ -257,7 +244,7 @@ static uint64_t syscall_pipe2(task_t *task, int pipefd[2], int flags)
     if ((fd0 = fdalloc(task, fdarray[0])) < 0 || (fd1 = fdalloc(task, fdarray[1])) < 0)
     {
         if (fd0 >= 0)
-            task->open_files[fd0] = 0;
+            fdt->remove(task, fd0);
         vfs->close(fdarray[0]);
         vfs->close(fdarray[1]);
         return -1;
@@ -269,9 +256,7 @@ static uint64_t syscall_pipe2(task_t *task, int pipefd[2], int flags)
 
 static uint64_t syscall_dup(task_t *task, int oldfd)
 {
-    if (oldfd < 0 || oldfd >= NOFILE)
-        return -1;
-    struct file *f = task->open_files[oldfd];
+    struct file *f = fdt->get(task, oldfd);
     if (f == NULL)
         return -1;
 
@@ -287,29 +272,28 @@ static uint64_t syscall_dup(task_t *task, int oldfd)
 
 static uint64_t syscall_dup3(task_t *task, int oldfd, int newfd, int flags)
 {
-    if (oldfd < 0 || oldfd >= NOFILE || newfd < 0 || newfd >= NOFILE)
+    struct file *f = fdt->get(task, oldfd);
+    if (f == NULL || newfd < 0 || newfd >= NOFILE_MAX)
         return -1;
     if (oldfd == newfd)
         return newfd;
 
-    struct file *f = task->open_files[oldfd];
-    if (f == NULL)
+    struct file *old = fdt->install(task, newfd, vfs->dup(f));
+    if (old == (struct file *)-1)
+    {
+        vfs->close(f);
         return -1;
-
-    if (task->open_files[newfd] != NULL)
+    }
+    if (old != NULL)
     {
-        syscall_close(task, newfd);
+        vfs->close(old);
     }
-
-    task->open_files[newfd] = vfs->dup(f);
     return newfd;
 }
 
 static uint64_t syscall_getdents64(task_t *task, int fd, struct dirent *buf, size_t len)
 {
-    if (fd < 0 || fd >= NOFILE)
-        return -1;
-    struct file *f = task->open_files[fd];
+    struct file *f = fdt->get(task, fd);
     if (f == NULL || f->type != FD_DIR)
         return -1;
 
@@ -372,33 +356,36 @@ static uint64_t syscall_mkdirat(task_t *task, int dirfd, const char *path, mode_
 
 static uint64_t syscall_umount2(task_t *task, const char *target, int flags)
 {
-    if (target == NULL)
+    char full_path[PATH_MAX];
+    if (target == NULL || parse_path(full_path, task, AT_FDCWD, target) < 0)
     {
         return -1;
     }
 
-    return vfs->umount(target);
+    return vfs->umount(full_path);
 }
 
 static uint64_t syscall_mount(task_t *task, const char *source, const char *target,
                               const char *filesystemtype, unsigned long mountflags,
                               const void *data)
 {
-    if (source == NULL || target == NULL || filesystemtype == NULL)
+    char full_path[PATH_MAX];
+    if (source == NULL || target == NULL || filesystemtype == NULL ||
+        parse_path(full_path, task, AT_FDCWD, target) < 0)
     {
         return -1;
     }
 
-    return vfs->mount(source, target, filesystemtype, mountflags, (void *)data);
+    return vfs->mount(source, full_path, filesystemtype, mountflags, (void *)data);
 }
 
 static uint64_t syscall_fstat(task_t *task, int fd, struct stat *statbuf)
 {
-    if (fd < 0 || fd >= NOFILE || statbuf == NULL)
+    if (statbuf == NULL)
     {
         return -1;
     }
-    struct file *f = task->open_files[fd];
+    struct file *f = fdt->get(task, fd);
     if (f == NULL)
         return -1;
 
@@ -416,10 +403,15 @@ static uint64_t syscall_sbrk(task_t *task, intptr_t increment)
     {
         return (uint64_t)current_brk;
     }
-    for (size_t i = 0; i < increment / task->pi->as.pgsize; i++)
+    if ((uintptr_t)current_brk + increment > UVMMAP)
     {
-        void *mem = pmm->alloc(task->pi->as.pgsize);
-        map(&task->pi->as, current_brk + i * task->pi->as.pgsize, mem, MMAP_READ | MMAP_WRITE);
+        return (uint64_t)-1;
+    }
+    // 堆区按需分配，首次访问时才分配物理页
+    if (uproc->mmap(task, current_brk, increment, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, NULL, 0) == MAP_FAILED)
+    {
+        return (uint64_t)-1;
     }
     task->pi->brk = (void *)((uintptr_t)current_brk + increment);
     return (uint64_t)current_brk;
@@ -431,9 +423,7 @@ static uint64_t syscall_munmap(task_t *task, void *addr, size_t length)
     {
         return -1;
     }
-
-    // 简化实现 - 实际需要取消内存映射
-    return 0;
+    return uproc->munmap(task, addr, length);
 }
 
 static uint64_t syscall_mmap(task_t *task, void *addr, size_t length, int prot, int flags, int fd, off_t offset)
@@ -442,12 +432,64 @@ static uint64_t syscall_mmap(task_t *task, void *addr, size_t length, int prot,
     {
         return (uint64_t)-1;
     }
-
-    // 调用uproc的mmap
-    void *result = uproc->mmap(task, addr, length, prot, flags);
+    struct file *f = NULL;
+    if (!(flags & MAP_ANONYMOUS))
+    {
+        f = fdt->get(task, fd);
+        if (f == NULL)
+        {
+            return (uint64_t)-1;
+        }
+    }
+    void *result = uproc->mmap(task, addr, length, prot, flags, f, offset);
     return (uint64_t)result;
 }
 
+static uint64_t syscall_mprotect(task_t *task, void *addr, size_t length, int prot)
+{
+    if (length == 0)
+    {
+        return 0;
+    }
+    return uproc->mprotect(task, addr, length, prot);
+}
+
+static uint64_t syscall_madvise(task_t *task, void *addr, size_t length, int advice)
+{
+    if (length == 0)
+    {
+        return 0;
+    }
+    return uproc->madvise(task, addr, length, advice);
+}
+
+// 只支持 RLIMIT_RSS，以字节为单位，软硬上限相同
+static uint64_t syscall_getrlimit(task_t *task, int resource, struct rlimit *rlim)
+{
+    if (rlim == NULL)
+    {
+        return -1;
+    }
+    uint64_t limit = RLIM_INFINITY;
+    if (resource == RLIMIT_RSS && task->pi->rss_limit)
+    {
+        limit = task->pi->rss_limit * PGSIZE;
+    }
+    rlim->rlim_cur = limit;
+    rlim->rlim_max = limit;
+    return 0;
+}
+
+static uint64_t syscall_setrlimit(task_t *task, int resource, const struct rlimit *rlim)
+{
+    if (rlim == NULL || resource != RLIMIT_RSS || rlim->rlim_cur > rlim->rlim_max)
+    {
+        return -1;
+    }
+    task->pi->rss_limit = rlim->rlim_cur == RLIM_INFINITY ? 0 : ROUNDUP(rlim->rlim_cur, PGSIZE) / PGSIZE;
+    return 0;
+}
+
 // 其他系统调用
 static uint64_t syscall_times(task_t *task, struct tms *buf)
 {
@@ -535,39 +577,13 @@ static uint64_t syscall_execve(task_t *task, const char *pathname, char *const a
     {
         return -1;
     }
-    struct stat stat;
-    if (vfs->stat(f, &stat) < 0)
+    Elf64_Ehdr ehdr;
+    Elf64_Phdr *phdr = NULL;
+    if (load_elf_headers(f, &ehdr, &phdr) < 0)
     {
         vfs->close(f);
         return -1;
     }
-    size_t file_size = stat.st_size;
-    if (file_size == 0 || file_size < sizeof(Elf64_Ehdr))
-    {
-        vfs->close(f);
-        return -1;
-    }
-    char *elf_data = pmm->alloc(file_size);
-    if (elf_data == NULL)
-    {
-        vfs->close(f);
-        return -1;
-    }
-    ssize_t bytes_read = vfs->read(f, elf_data, file_size);
-    vfs->close(f);
-    if (bytes_read != file_size)
-    {
-        pmm->free(elf_data);
-        return -1;
-    }
-    void *entry_point;
-    if (load_elf(task, elf_data, file_size, &entry_point) < 0)
-    {
-        printf("Failed to load ELF file: %s\n", full_path);
-        pmm->free(elf_data);
-        return -1;
-    }
-    pmm->free(elf_data);
     int argc = 0;
     int envc = 0;
     size_t args_size = 0;
@@ -589,30 +605,96 @@ static uint64_t syscall_execve(task_t *task, const char *pathname, char *const a
         }
     }
     size_t stack_needed = (argc + 1) * sizeof(char *) + (envc + 1) * sizeof(char *) + args_size + envs_size + 16;
-    panic_on(stack_needed > task->pi->as.pgsize, "Stack size exceeds limit");
-    void *mem = pmm->alloc(task->pi->as.pgsize);
-    panic_on(!mem, "Failed to allocate memory for stack");
-    map(&task->pi->as, (void *)UVMEND - task->pi->as.pgsize, mem, MMAP_READ | MMAP_WRITE);
-    task->context = ucontext(&task->pi->as, RANGE(task->stack, task->stack + STACK_SIZE), entry_point);
-    char *stack_ptr = (char *)(mem + task->pi->as.pgsize);
+    if (stack_needed > PGSIZE)
+    {
+        pmm->free(phdr);
+        vfs->close(f);
+        return -1;
+    }
+    // 参数位于旧地址空间中，销毁旧映像前先复制到内核
+    char *strs = pmm->alloc(args_size + envs_size + 1);
+    char **kargv = pmm->alloc((argc + 1) * sizeof(char *));
+    char **kenvp = pmm->alloc((envc + 1) * sizeof(char *));
     char **argv_ptrs = pmm->alloc((argc + 1) * sizeof(char *));
     char **envp_ptrs = pmm->alloc((envc + 1) * sizeof(char *));
+    if (strs == NULL || kargv == NULL || kenvp == NULL || argv_ptrs == NULL || envp_ptrs == NULL)
+    {
+        pmm->free(strs);
+        pmm->free(kargv);
+        pmm->free(kenvp);
+        pmm->free(argv_ptrs);
+        pmm->free(envp_ptrs);
+        pmm->free(phdr);
+        vfs->close(f);
+        return -1;
+    }
+    char *p = strs;
+    for (int i = 0; i < argc; i++)
+    {
+        kargv[i] = p;
+        strcpy(p, argv[i]);
+        p += strlen(p) + 1;
+    }
+    for (int i = 0; i < envc; i++)
+    {
+        kenvp[i] = p;
+        strcpy(p, envp[i]);
+        p += strlen(p) + 1;
+    }
+
+    procinfo_t *pi = task->pi;
+    AddrSpace old_as = pi->as;
+    struct vma *old_vmas = pi->vmas;
+    void *old_brk = pi->brk;
+    size_t old_rss = pi->rss, old_ptpages = pi->ptpages;
+    pi->vmas = NULL;
+    pi->rss = 0;
+    pi->ptpages = 1;
+    protect(&pi->as);
+    void *entry_point;
+    char *mem = NULL;
+    if (load_elf(task, f, &ehdr, phdr, &entry_point) == 0 &&
+        uproc->mmap(task, (void *)(UVMEND - PGSIZE), PGSIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_GROWSDOWN, NULL, 0) != MAP_FAILED &&
+        uproc->vdso(task) == 0)
+    {
+        mem = uproc->upage(task, UVMEND - PGSIZE);
+    }
+    pmm->free(phdr);
+    vfs->close(f);
+    if (mem == NULL)
+    {
+        // 加载失败，恢复旧映像
+        printf("Failed to load ELF file: %s\n", full_path);
+        uproc->release(&pi->as, pi->vmas);
+        pi->as = old_as;
+        pi->vmas = old_vmas;
+        pi->brk = old_brk;
+        pi->rss = old_rss;
+        pi->ptpages = old_ptpages;
+        pmm->free(kargv);
+        pmm->free(kenvp);
+        pmm->free(argv_ptrs);
+        pmm->free(envp_ptrs);
+        pmm->free(strs);
+        return -1;
+    }
+    task->context = ucontext(&pi->as, RANGE(task->stack, task->stack + STACK_SIZE), entry_point);
+    char *stack_ptr = (char *)(mem + PGSIZE);
     for (int i = envc - 1; i >= 0; i--)
     {
-        size_t len = strlen(envp[i]) + 1;
+        size_t len = strlen(kenvp[i]) + 1;
         stack_ptr -= len;
-        memcpy(stack_ptr, envp[i], len);
-        envp_ptrs[i] = stack_ptr - (uintptr_t)mem + UVMEND - task->pi->as.pgsize;
-        ;
+        memcpy(stack_ptr, kenvp[i], len);
+        envp_ptrs[i] = stack_ptr - (uintptr_t)mem + UVMEND - PGSIZE;
     }
 
     for (int i = argc - 1; i >= 0; i--)
     {
-        size_t len = strlen(argv[i]) + 1;
+        size_t len = strlen(kargv[i]) + 1;
         stack_ptr -= len;
-        memcpy(stack_ptr, argv[i], len);
-        argv_ptrs[i] = stack_ptr - (uintptr_t)mem + UVMEND - task->pi->as.pgsize;
-        ;
+        memcpy(stack_ptr, kargv[i], len);
+        argv_ptrs[i] = stack_ptr - (uintptr_t)mem + UVMEND - PGSIZE;
     }
     stack_ptr = (char *)((uintptr_t)stack_ptr & ~7);
     stack_ptr -= (envc + 1) * sizeof(char *);
@@ -634,26 +716,41 @@ static uint64_t syscall_execve(task_t *task, const char *pathname, char *const a
     uintptr_t final_rsp = (uintptr_t)stack_ptr & ~15;
     pmm->free(argv_ptrs);
     pmm->free(envp_ptrs);
+    pmm->free(kargv);
+    pmm->free(kenvp);
+    pmm->free(strs);
     panic_on(argv_array < (char **)mem, "argv_array is NULL");
     panic_on(envp_array < (char **)mem, "envp_array is NULL");
-    task->context->rsp = final_rsp - (uintptr_t)mem + UVMEND - task->pi->as.pgsize;
+    task->context->rsp = final_rsp - (uintptr_t)mem + UVMEND - PGSIZE;
     task->context->GPR1 = argc;
-    task->context->GPR2 = (uintptr_t)argv_array - (uintptr_t)mem + UVMEND - task->pi->as.pgsize;
-    task->context->GPR3 = (uintptr_t)envp_array - (uintptr_t)mem + UVMEND - task->pi->as.pgsize;
-
+    task->context->GPR2 = (uintptr_t)argv_array - (uintptr_t)mem + UVMEND - PGSIZE;
+    task->context->GPR3 = (uintptr_t)envp_array - (uintptr_t)mem + UVMEND - PGSIZE;
+    // 新映像就绪后才释放旧地址空间，旧映像中的提交/完成环随之失效
+    pi->ring = NULL;
+    uproc->release(&old_as, old_vmas);
     return 0;
 }
-static int load_elf(task_t *task, const char *elf_data, size_t file_size, void **entry_point)
+
+/**
+ * read and check the ELF header of @f, then its program header
+ * table into a freshly allocated *@phdr
+ */
+static int load_elf_headers(struct file *f, Elf64_Ehdr *ehdr, Elf64_Phdr **phdr)
 {
-    if (task == NULL || elf_data == NULL || entry_point == NULL)
+    struct stat stat;
+    if (vfs->stat(f, &stat) < 0)
     {
         return -1;
     }
+    size_t file_size = stat.st_size;
     if (file_size < sizeof(Elf64_Ehdr))
     {
         return -1;
     }
-    Elf64_Ehdr *ehdr = (Elf64_Ehdr *)elf_data;
+    if (vfs->read(f, ehdr, sizeof(Elf64_Ehdr)) != sizeof(Elf64_Ehdr))
+    {
+        return -1;
+    }
     if (ehdr->e_ident[EI_MAG0] != ELFMAG0 ||
         ehdr->e_ident[EI_MAG1] != ELFMAG1 ||
         ehdr->e_ident[EI_MAG2] != ELFMAG2 ||
@@ -683,19 +780,33 @@ static int load_elf(task_t *task, const char *elf_data, size_t file_size, void *
         return -1;
     }
     size_t phdr_table_size = ehdr->e_phnum * sizeof(Elf64_Phdr);
-    if (ehdr->e_phoff + phdr_table_size > file_size)
+    if (ehdr->e_phoff + phdr_table_size > file_size || phdr_table_size > PGSIZE)
+    {
+        return -1;
+    }
+    *phdr = pmm->alloc(phdr_table_size);
+    if (*phdr == NULL)
+    {
+        return -1;
+    }
+    if (vfs->seek(f, ehdr->e_phoff, SEEK_SET) < 0 ||
+        vfs->read(f, *phdr, phdr_table_size) != phdr_table_size)
     {
+        pmm->free(*phdr);
+        *phdr = NULL;
         return -1;
     }
-    Elf64_Phdr *phdr = (Elf64_Phdr *)(elf_data + ehdr->e_phoff);
-    unprotect(&task->pi->as);
-    protect(&task->pi->as);
+    return 0;
+}
+
+static int load_elf(task_t *task, struct file *f, Elf64_Ehdr *ehdr, Elf64_Phdr *phdr, void **entry_point)
+{
     uintptr_t brk_addr = 0;
     for (int i = 0; i < ehdr->e_phnum; i++)
     {
         if (phdr[i].p_type == PT_LOAD)
         {
-            if (load_elf_segment(task, elf_data, file_size, &phdr[i]) < 0)
+            if (load_elf_segment(task, f, &phdr[i], brk_addr) < 0)
             {
                 return -1;
             }
@@ -715,114 +826,339 @@ static int load_elf(task_t *task, const char *elf_data, size_t file_size, void *
     return 0;
 }
 
-static int load_elf_segment(task_t *task, const char *elf_data, size_t file_size, Elf64_Phdr *phdr)
+/**
+ * map one PT_LOAD segment: its file part becomes a private file
+ * mapping served from the page cache (read-only text pages stay
+ * shared by every process running the binary), its bss an
+ * anonymous mapping. A segment sharing its first page with the
+ * previous one (ending at @prev_end), or not congruent with its
+ * file offset, or from a file the page cache does not serve (tmpfs),
+ * is read into anonymous pages instead.
+ */
+static int load_elf_segment(task_t *task, struct file *f, Elf64_Phdr *phdr, uintptr_t prev_end)
 {
     if (phdr->p_memsz == 0)
     {
         return 0; // 空段，跳过
     }
-    size_t pgsize = task->pi->as.pgsize;
     uintptr_t vaddr_start = phdr->p_vaddr;
     uintptr_t vaddr_end = vaddr_start + phdr->p_memsz;
-    if (vaddr_start < UVSTART || vaddr_start >= UVMEND || vaddr_end > UVMEND)
+    if (vaddr_start < UVSTART || vaddr_start >= UVMEND || vaddr_end > UVMEND || phdr->p_filesz > phdr->p_memsz)
     {
         printf("Invalid virtual address range: 0x%lx - 0x%lx (valid: 0x%lx - 0x%lx)\n",
                vaddr_start, vaddr_end, (uintptr_t)UVSTART, (uintptr_t)UVMEND);
         return -1;
     }
-    uintptr_t page_start = vaddr_start & ~(pgsize - 1);
-    uintptr_t page_end = (vaddr_end + pgsize - 1) & ~(pgsize - 1);
-    size_t pages_needed = (page_end - page_start) / pgsize;
-    if (pages_needed == 0 || pages_needed > 1024) // 限制最大1024页
+    int prot = PROT_READ;
+    if (phdr->p_flags & PF_W)
     {
-        printf("Invalid page count: %zu\n", pages_needed);
-        return -1;
+        prot |= PROT_WRITE;
     }
-    for (size_t j = 0; j < pages_needed; j++)
+    if (phdr->p_flags & PF_X)
     {
-        void *page = pmm->alloc(pgsize);
-        if (page == NULL)
-        {
-            return -1;
-        }
-        memset(page, 0, pgsize);
-        uintptr_t page_vaddr = page_start + j * pgsize;
-        if (page_vaddr >= UVMEND)
+        prot |= PROT_EXEC;
+    }
+    int flags = MAP_PRIVATE | MAP_FIXED;
+    uintptr_t page_start = ROUNDDOWN(vaddr_start, PGSIZE);
+    uintptr_t page_end = ROUNDUP(vaddr_end, PGSIZE);
+    uintptr_t file_end = vaddr_start + phdr->p_filesz;
+    uintptr_t anon_start = ROUNDUP(file_end, PGSIZE);
+    if (phdr->p_filesz > 0 && f->fops && f->fops->cached && page_start >= ROUNDUP(prev_end, PGSIZE) &&
+        vaddr_start % PGSIZE == phdr->p_offset % PGSIZE)
+    {
+        if (uproc->mmap(task, (void *)page_start, anon_start - page_start, prot, flags, f,
+                        ROUNDDOWN(phdr->p_offset, PGSIZE)) == MAP_FAILED)
         {
-            printf("Invalid page virtual address: 0x%lx\n", page_vaddr);
-            pmm->free(page);
             return -1;
         }
-        if (page_vaddr < vaddr_end && (page_vaddr + pgsize) > vaddr_start)
+        if (file_end < anon_start && phdr->p_memsz > phdr->p_filesz)
         {
-            if (copy_segment_data(elf_data, file_size, phdr, page, page_vaddr, vaddr_start, vaddr_end, pgsize) < 0)
+            // the page holding the end of the file part also starts the bss
+            char *tail = uproc->upage(task, file_end);
+            if (tail == NULL)
             {
-                pmm->free(page);
                 return -1;
             }
+            memset(tail, 0, anon_start - file_end);
         }
-        int prot = MMAP_READ;
-        if (phdr->p_flags & PF_W)
-        {
-            prot |= MMAP_WRITE;
-        }
-
-        map(&task->pi->as, (void *)page_vaddr, page, prot);
     }
-
-    return 0;
-}
-
-static int copy_segment_data(const char *elf_data, size_t file_size, Elf64_Phdr *phdr,
-                             void *page, uintptr_t page_vaddr, uintptr_t vaddr_start,
-                             uintptr_t vaddr_end, size_t pgsize)
-{
-    uintptr_t copy_start = page_vaddr > vaddr_start ? page_vaddr : vaddr_start;
-    uintptr_t copy_end = (page_vaddr + pgsize) < vaddr_end ? (page_vaddr + pgsize) : vaddr_end;
-    if (copy_start < copy_end && phdr->p_filesz > 0)
+    else
     {
-        size_t file_offset = phdr->p_offset + (copy_start - vaddr_start);
-        size_t page_offset = copy_start - page_vaddr;
-        size_t copy_size = copy_end - copy_start;
-        if (phdr->p_offset >= file_size)
+        anon_start = page_start > ROUNDUP(prev_end, PGSIZE) ? page_start : ROUNDUP(prev_end, PGSIZE);
+        if (anon_start < page_end &&
+            uproc->mmap(task, (void *)anon_start, page_end - anon_start, prot,
+                        flags | MAP_ANONYMOUS, NULL, 0) == MAP_FAILED)
         {
             return -1;
         }
-        size_t max_copy_from_file = phdr->p_filesz - (copy_start - vaddr_start);
-        if (copy_size > max_copy_from_file)
-        {
-            copy_size = max_copy_from_file;
-        }
-
-        if (file_offset + copy_size <= file_size && copy_size > 0)
+        anon_start = page_end;
+        if (phdr->p_filesz > 0 && vfs->seek(f, phdr->p_offset, SEEK_SET) < 0)
         {
-            memcpy((char *)page + page_offset, elf_data + file_offset, copy_size);
+            return -1;
         }
-        else if (copy_size > 0)
+        for (uintptr_t va = vaddr_start; va < file_end;)
         {
-            return -1;
+            size_t len = ROUNDDOWN(va, PGSIZE) + PGSIZE - va;
+            len = len < file_end - va ? len : file_end - va;
+            char *dst = uproc->upage(task, va);
+            if (dst == NULL || vfs->read(f, dst, len) != len)
+            {
+                return -1;
+            }
+            va += len;
         }
     }
+    if (anon_start < page_end &&
+        uproc->mmap(task, (void *)anon_start, page_end - anon_start, prot,
+                    flags | MAP_ANONYMOUS, NULL, 0) == MAP_FAILED)
+    {
+        return -1;
+    }
     return 0;
 }
 static uint64_t syscall_read(task_t *task, int fd, char *buf, size_t count)
 {
-    if (fd < 0 || fd >= NOFILE)
-        return -1;
-    struct file *f = task->open_files[fd];
+    struct file *f = fdt->get(task, fd);
     if (f == NULL)
         return -1;
     return vfs->read(f, buf, count);
 }
 static uint64_t syscall_write(task_t *task, int fd, const char *buf, size_t count)
 {
-    if (fd < 0 || fd >= NOFILE)
-        return -1;
-    struct file *f = task->open_files[fd];
+    struct file *f = fdt->get(task, fd);
     if (f == NULL)
         return -1;
     return vfs->write(f, buf, count);
 }
+static uint64_t syscall_readv(task_t *task, int fd, const struct iovec *iov, int iovcnt)
+{
+    if (iovcnt < 0 || iovcnt > IOV_MAX)
+        return -1;
+    struct file *f = fdt->get(task, fd);
+    if (f == NULL || !f->readable)
+        return -1;
+    return vfs->readv(f, iov, iovcnt);
+}
+static uint64_t syscall_writev(task_t *task, int fd, const struct iovec *iov, int iovcnt)
+{
+    if (iovcnt < 0 || iovcnt > IOV_MAX)
+        return -1;
+    struct file *f = fdt->get(task, fd);
+    if (f == NULL || !f->writable)
+        return -1;
+    return vfs->writev(f, iov, iovcnt);
+}
+static uint64_t syscall_pread64(task_t *task, int fd, char *buf, size_t count, off_t offset)
+{
+    struct file *f = fdt->get(task, fd);
+    if (f == NULL)
+        return -1;
+    return vfs->pread(f, buf, count, offset);
+}
+static uint64_t syscall_pwrite64(task_t *task, int fd, const char *buf, size_t count, off_t offset)
+{
+    struct file *f = fdt->get(task, fd);
+    if (f == NULL)
+        return -1;
+    return vfs->pwrite(f, buf, count, offset);
+}
+
+/**
+ * look up @fd for an in-kernel copy
+ */
+static struct file *copy_file(task_t *task, int fd, bool write)
+{
+    struct file *f = fdt->get(task, fd);
+    if (f == NULL || (write ? !f->writable : !f->readable))
+        return NULL;
+    return f;
+}
+
+/**
+ * run an in-kernel copy, reading the user offsets into the kernel
+ * first and storing the advanced ones back
+ */
+static uint64_t copy_range(struct file *in, off_t *off_in, struct file *out, off_t *off_out, size_t len)
+{
+    off_t kin = off_in ? *off_in : 0;
+    off_t kout = off_out ? *off_out : 0;
+    ssize_t n = vfs->copy(out, off_out ? &kout : NULL, in, off_in ? &kin : NULL, len);
+    if (off_in)
+        *off_in = kin;
+    if (off_out)
+        *off_out = kout;
+    return n;
+}
+
+static uint64_t syscall_sendfile(task_t *task, int out_fd, int in_fd, off_t *offset, size_t count)
+{
+    struct file *in = copy_file(task, in_fd, false);
+    struct file *out = copy_file(task, out_fd, true);
+    if (in == NULL || out == NULL || (offset && in->type != FD_FILE))
+        return -1;
+    return copy_range(in, offset, out, NULL, count);
+}
+
+static uint64_t syscall_copy_file_range(task_t *task, int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len, unsigned flags)
+{
+    struct file *in = copy_file(task, fd_in, false);
+    struct file *out = copy_file(task, fd_out, true);
+    if (in == NULL || out == NULL || flags != 0 || in->type != FD_FILE || out->type != FD_FILE)
+        return -1;
+    return copy_range(in, off_in, out, off_out, len);
+}
+
+static uint64_t syscall_splice(task_t *task, int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len, unsigned flags)
+{
+    struct file *in = copy_file(task, fd_in, false);
+    struct file *out = copy_file(task, fd_out, true);
+    if (in == NULL || out == NULL || (in->type != FD_PIPE && out->type != FD_PIPE))
+        return -1;
+    // a pipe has no position to read or write at
+    if ((off_in && in->type != FD_FILE) || (off_out && out->type != FD_FILE))
+        return -1;
+    return copy_range(in, off_in, out, off_out, len);
+}
+
+static int64_t timeout_us(const struct timespec *timeout)
+{
+    if (timeout == NULL)
+        return -1;
+    return timeout->tv_sec * 1000000 + timeout->tv_nsec / 1000;
+}
+
+// signal masks are accepted and ignored, there are no signal handlers
+static uint64_t syscall_ppoll(task_t *task, struct pollfd *fds, int nfds, const struct timespec *timeout, const void *sigmask)
+{
+    return poll->poll(task, fds, nfds, timeout_us(timeout));
+}
+
+/**
+ * select on top of poll: the sets become a pollfd array and the
+ * results are folded back into them
+ */
+static uint64_t syscall_pselect6(task_t *task, int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+                                 const struct timespec *timeout, const void *sigmask)
+{
+    if (nfds < 0 || nfds > FD_SETSIZE)
+        return -1;
+    struct pollfd *fds = pmm->alloc((nfds + 1) * sizeof(struct pollfd));
+    if (fds == NULL)
+        return -1;
+    int n = 0;
+    for (int fd = 0; fd < nfds; fd++)
+    {
+        short events = 0;
+        if (readfds && FD_ISSET(fd, readfds))
+            events |= POLLIN;
+        if (writefds && FD_ISSET(fd, writefds))
+            events |= POLLOUT;
+        if (exceptfds && FD_ISSET(fd, exceptfds))
+            events |= POLLPRI;
+        if (events)
+            fds[n++] = (struct pollfd){.fd = fd, .events = events};
+    }
+    int ret = poll->poll(task, fds, n, timeout_us(timeout));
+    for (int i = 0; i < n; i++)
+    {
+        if (fds[i].revents & POLLNVAL)
+            ret = -1;
+    }
+    if (ret >= 0)
+    {
+        ret = 0;
+        for (int i = 0; i < n; i++)
+        {
+            int fd = fds[i].fd;
+            short events = fds[i].events, revents = fds[i].revents;
+            if (readfds)
+                FD_CLR(fd, readfds);
+            if (writefds)
+                FD_CLR(fd, writefds);
+            if (exceptfds)
+                FD_CLR(fd, exceptfds);
+            if ((events & POLLIN) && (revents & (POLLIN | POLLHUP | POLLERR)))
+            {
+                FD_SET(fd, readfds);
+                ret++;
+            }
+            if ((events & POLLOUT) && (revents & (POLLOUT | POLLERR)))
+            {
+                FD_SET(fd, writefds);
+                ret++;
+            }
+            if ((events & POLLPRI) && (revents & POLLPRI))
+            {
+                FD_SET(fd, exceptfds);
+                ret++;
+            }
+        }
+    }
+    pmm->free(fds);
+    return ret;
+}
+
+static uint64_t syscall_epoll_create1(task_t *task, int flags)
+{
+    struct file *f = poll->epoll_create();
+    if (f == NULL)
+        return -1;
+    int fd = fdalloc(task, f);
+    if (fd < 0)
+        vfs->close(f);
+    return fd;
+}
+
+static uint64_t syscall_epoll_ctl(task_t *task, int epfd, int op, int fd, struct epoll_event *event)
+{
+    struct file *ep = fdt->get(task, epfd);
+    struct file *f = fdt->get(task, fd);
+    if (ep == NULL || f == NULL || (op != EPOLL_CTL_DEL && event == NULL))
+        return -1;
+    struct epoll_event ev = {0};
+    if (event)
+        ev = *event;
+    return poll->epoll_ctl(ep, op, fd, f, &ev);
+}
+
+static uint64_t syscall_epoll_pwait(task_t *task, int epfd, struct epoll_event *events, int maxevents, int timeout, const void *sigmask)
+{
+    struct file *ep = fdt->get(task, epfd);
+    if (ep == NULL)
+        return -1;
+    return poll->epoll_wait(ep, events, maxevents, timeout < 0 ? -1 : (int64_t)timeout * 1000);
+}
+
+/**
+ * sync flushes every file system, syncfs only the one @fd lives on;
+ * both return once the data is on the disk
+ */
+static uint64_t syscall_sync(task_t *task)
+{
+    vfs->sync();
+    return 0;
+}
+
+static uint64_t syscall_fsync(task_t *task, int fd)
+{
+    struct file *f = fdt->get(task, fd);
+    if (f == NULL)
+        return -1;
+    return vfs->fsync(f);
+}
+
+static uint64_t syscall_fdatasync(task_t *task, int fd)
+{
+    return syscall_fsync(task, fd);
+}
+
+static uint64_t syscall_syncfs(task_t *task, int fd)
+{
+    struct file *f = fdt->get(task, fd);
+    if (f == NULL)
+        return -1;
+    return vfs->syncfs(f);
+}
 
 // Forward declaration for syscall_close
 static uint64_t syscall_close(task_t *task, int fd);
@@ -844,6 +1180,10 @@ MODULE_DEF(syscall) = {
     .sbrk = syscall_sbrk,
     .munmap = syscall_munmap,
     .mmap = syscall_mmap,
+    .mprotect = syscall_mprotect,
+    .madvise = syscall_madvise,
+    .getrlimit = syscall_getrlimit,
+    .setrlimit = syscall_setrlimit,
     .times = syscall_times,
     .uname = syscall_uname,
     .sched_yield = syscall_sched_yield,
@@ -853,5 +1193,21 @@ MODULE_DEF(syscall) = {
     .execve = syscall_execve,
     .read = syscall_read,
     .write = syscall_write,
+    .readv = syscall_readv,
+    .writev = syscall_writev,
+    .pread64 = syscall_pread64,
+    .pwrite64 = syscall_pwrite64,
+    .sendfile = syscall_sendfile,
+    .copy_file_range = syscall_copy_file_range,
+    .splice = syscall_splice,
     .close = syscall_close, // Add close to the syscall table
+    .ppoll = syscall_ppoll,
+    .pselect6 = syscall_pselect6,
+    .epoll_create1 = syscall_epoll_create1,
+    .epoll_ctl = syscall_epoll_ctl,
+    .epoll_pwait = syscall_epoll_pwait,
+    .sync = syscall_sync,
+    .fsync = syscall_fsync,
+    .fdatasync = syscall_fdatasync,
+    .syncfs = syscall_syncfs,
 };
\ No newline at end of file
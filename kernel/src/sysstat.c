@@ -0,0 +1,113 @@
+#include <common.h>
+#include <syscall.h>
+#define STRACE_RING 1024 // records kept for traced processes
+static struct syscall_stat *stats; // 每个 CPU 一组，按系统调用号索引
+static int ncpu;
+static spinlock_t strace_lock;
+static struct strace_rec ring[STRACE_RING];
+static uint64_t ring_head, ring_tail; // 读出和写入的位置，写满时覆盖最旧的记录
+
+static void sysstat_init()
+{
+    ncpu = cpu_count();
+    stats = pmm->alloc(ncpu * NR_SYSCALL * sizeof(struct syscall_stat));
+    panic_on(stats == NULL, "no memory for syscall statistics");
+    memset(stats, 0, ncpu * NR_SYSCALL * sizeof(struct syscall_stat));
+    kmt->spin_init(&strace_lock, "strace_lock");
+}
+
+/**
+ * account one finished call; runs with interrupts off, so the
+ * slot of this CPU needs no lock
+ */
+static void sysstat_account(task_t *task, int nr, const uint64_t args[6], uint64_t ret, uint64_t cycles)
+{
+    struct syscall_stat *st = &stats[cpu_current() * NR_SYSCALL + nr];
+    int bucket = 0;
+    while (bucket < SYSCALL_HIST - 1 && (cycles >> (bucket + 1)) != 0)
+    {
+        bucket++;
+    }
+    st->count++;
+    st->errors += (int64_t)ret < 0;
+    st->cycles += cycles;
+    st->hist[bucket]++;
+    if (task->pi == NULL || !task->pi->traced)
+    {
+        return;
+    }
+    kmt->spin_lock(&strace_lock);
+    if (ring_tail - ring_head == STRACE_RING)
+    {
+        ring_head++;
+    }
+    struct strace_rec *rec = &ring[ring_tail++ % STRACE_RING];
+    rec->pid = task->pi->pid;
+    rec->nr = nr;
+    memcpy(rec->args, args, sizeof(rec->args));
+    rec->ret = ret;
+    rec->cycles = cycles;
+    kmt->spin_unlock(&strace_lock);
+}
+
+/**
+ * sum the counters of all CPUs into @buf, which has room for
+ * @n entries indexed by syscall number; returns NR_SYSCALL
+ */
+static int64_t sysstat_stats(struct syscall_stat *buf, size_t n)
+{
+    if (n > NR_SYSCALL)
+    {
+        n = NR_SYSCALL;
+    }
+    for (size_t nr = 0; nr < n; nr++)
+    {
+        struct syscall_stat sum = {0};
+        for (int cpu = 0; cpu < ncpu; cpu++)
+        {
+            struct syscall_stat *st = &stats[cpu * NR_SYSCALL + nr];
+            sum.count += st->count;
+            sum.errors += st->errors;
+            sum.cycles += st->cycles;
+            for (int i = 0; i < SYSCALL_HIST; i++)
+            {
+                sum.hist[i] += st->hist[i];
+            }
+        }
+        buf[nr] = sum;
+    }
+    return NR_SYSCALL;
+}
+
+static int sysstat_trace(task_t *task, int on)
+{
+    task->pi->traced = on != 0;
+    return 0;
+}
+
+/**
+ * move up to @n of the oldest trace records into @buf
+ */
+static int64_t sysstat_read(struct strace_rec *buf, size_t n)
+{
+    size_t i = 0;
+    kmt->spin_lock(&strace_lock);
+    while (i < n && ring_head != ring_tail)
+    {
+        struct strace_rec rec = ring[ring_head++ % STRACE_RING];
+        kmt->spin_unlock(&strace_lock);
+        // the user buffer may fault, never copy into it under the lock
+        buf[i++] = rec;
+        kmt->spin_lock(&strace_lock);
+    }
+    kmt->spin_unlock(&strace_lock);
+    return i;
+}
+
+MODULE_DEF(sysstat) = {
+    .init = sysstat_init,
+    .account = sysstat_account,
+    .stats = sysstat_stats,
+    .trace = sysstat_trace,
+    .read = sysstat_read,
+};
@@ -0,0 +1,748 @@
+#include <common.h>
+#include <vfs.h>
+#include <ext4.h> // d_type values, as ext4 directories report them
+// *off value asking iwrite to append
+#define TMPFS_END ((uint64_t)-1)
+
+struct tmpfs_dirent;
+
+// A file or directory living in pmm pages only
+struct tmpfs_inode
+{
+    struct tmpfs *fs;
+    uint32_t ino;
+    uint32_t mode;                // S_IFREG or S_IFDIR
+    int nlink;                    // names pointing here
+    int ref;                      // open files
+    uint64_t size;                // bytes of a file, entries of a directory
+    void **pages;                 // file pages, NULL for holes
+    uint64_t npages;              // length of pages[]
+    struct tmpfs_dirent *entries; // directory entries, oldest first
+    uint64_t cookie;              // d_off of the last entry added
+    struct tmpfs_inode *parent;   // directory holding a directory
+};
+
+struct tmpfs_dirent
+{
+    struct tmpfs_dirent *next;
+    struct tmpfs_inode *inode;
+    uint64_t off; // readdir cookie, increasing along the list
+    int len;
+    char name[];
+};
+
+// One mount, kept in mount->priv
+struct tmpfs
+{
+    spinlock_t lock; // one lock for the whole tree
+    struct tmpfs_inode *root;
+    uint32_t next_ino;
+};
+
+// Open file state, kept in file->ptr
+struct tmpfs_file
+{
+    struct tmpfs_inode *ip;
+    uint64_t pos; // file offset, or readdir cookie of a directory
+    bool append;
+};
+
+static const struct file_ops tmpfs_file_fops, tmpfs_dir_fops;
+
+static struct tmpfs_inode *ialloc(struct tmpfs *fs, uint32_t mode)
+{
+    struct tmpfs_inode *ip = pmm->alloc(sizeof(struct tmpfs_inode));
+    if (ip == NULL)
+    {
+        return NULL;
+    }
+    memset(ip, 0, sizeof(struct tmpfs_inode));
+    ip->fs = fs;
+    ip->ino = ++fs->next_ino;
+    ip->mode = mode;
+    ip->cookie = 2; // 1 and 2 are the cookies of . and ..
+    return ip;
+}
+
+/**
+ * free the pages of @ip from page @first on
+ */
+static void free_pages(struct tmpfs_inode *ip, uint64_t first)
+{
+    for (uint64_t i = first; i < ip->npages; i++)
+    {
+        if (ip->pages[i])
+        {
+            pmm->free(ip->pages[i]);
+            ip->pages[i] = NULL;
+        }
+    }
+}
+
+/**
+ * free @ip once neither a name nor an open file refers to it
+ */
+static void iput(struct tmpfs_inode *ip)
+{
+    if (ip->nlink > 0 || ip->ref > 0)
+    {
+        return;
+    }
+    free_pages(ip, 0);
+    pmm->free(ip->pages);
+    pmm->free(ip);
+}
+
+static struct tmpfs_dirent *dir_find(struct tmpfs_inode *dir, const char *name, int len)
+{
+    for (struct tmpfs_dirent *de = dir->entries; de; de = de->next)
+    {
+        if (de->len == len && strncmp(de->name, name, len) == 0)
+        {
+            return de;
+        }
+    }
+    return NULL;
+}
+
+static int dir_add(struct tmpfs_inode *dir, const char *name, int len, struct tmpfs_inode *ip)
+{
+    struct tmpfs_dirent *de = pmm->alloc(sizeof(struct tmpfs_dirent) + len + 1);
+    if (de == NULL)
+    {
+        return -1;
+    }
+    de->next = NULL;
+    de->inode = ip;
+    de->off = ++dir->cookie;
+    de->len = len;
+    memcpy(de->name, name, len);
+    de->name[len] = '\0';
+    struct tmpfs_dirent **pp = &dir->entries;
+    while (*pp)
+    {
+        pp = &(*pp)->next;
+    }
+    *pp = de;
+    dir->size++;
+    ip->nlink++;
+    if (ip->mode == S_IFDIR)
+    {
+        ip->parent = dir;
+    }
+    return 0;
+}
+
+/**
+ * drop the entry @de of @dir; the caller puts the inode
+ */
+static void dir_remove(struct tmpfs_inode *dir, struct tmpfs_dirent *de)
+{
+    struct tmpfs_dirent **pp = &dir->entries;
+    while (*pp != de)
+    {
+        pp = &(*pp)->next;
+    }
+    *pp = de->next;
+    dir->size--;
+    de->inode->nlink--;
+    pmm->free(de);
+}
+
+/**
+ * resolve every component of @path but the last, left in @last and
+ * @len (0 for the root itself); NULL when a directory is missing
+ */
+static struct tmpfs_inode *walk(struct tmpfs *fs, const char *path, const char **last, int *len)
+{
+    struct tmpfs_inode *dir = fs->root;
+    while (*path == '/')
+    {
+        path++;
+    }
+    while (1)
+    {
+        const char *end = path;
+        while (*end && *end != '/')
+        {
+            end++;
+        }
+        const char *next = end;
+        while (*next == '/')
+        {
+            next++;
+        }
+        if (*next == '\0')
+        {
+            *last = path;
+            *len = end - path;
+            return dir;
+        }
+        struct tmpfs_dirent *de = dir_find(dir, path, end - path);
+        if (de == NULL || de->inode->mode != S_IFDIR)
+        {
+            return NULL;
+        }
+        dir = de->inode;
+        path = next;
+    }
+}
+
+static struct tmpfs_inode *namei(struct tmpfs *fs, const char *path)
+{
+    const char *name;
+    int len;
+    struct tmpfs_inode *dir = walk(fs, path, &name, &len);
+    if (dir == NULL || len == 0)
+    {
+        return dir;
+    }
+    struct tmpfs_dirent *de = dir_find(dir, name, len);
+    return de ? de->inode : NULL;
+}
+
+static void truncate(struct tmpfs_inode *ip, uint64_t size)
+{
+    free_pages(ip, (size + PGSIZE - 1) / PGSIZE);
+    if (size % PGSIZE && size / PGSIZE < ip->npages && ip->pages[size / PGSIZE])
+    {
+        memset((char *)ip->pages[size / PGSIZE] + size % PGSIZE, 0, PGSIZE - size % PGSIZE);
+    }
+    ip->size = size;
+}
+
+static int tmpfs_mount(struct mount *m, const char *source)
+{
+    struct tmpfs *fs = pmm->alloc(sizeof(struct tmpfs));
+    if (fs == NULL)
+    {
+        return VFS_ERROR;
+    }
+    kmt->spin_init(&fs->lock, "tmpfs_lock");
+    fs->next_ino = 0;
+    fs->root = ialloc(fs, S_IFDIR);
+    if (fs->root == NULL)
+    {
+        pmm->free(fs);
+        return VFS_ERROR;
+    }
+    fs->root->nlink = 1;
+    fs->root->parent = fs->root;
+    m->priv = fs;
+    return VFS_SUCCESS;
+}
+
+static void free_tree(struct tmpfs_inode *dir)
+{
+    while (dir->entries)
+    {
+        struct tmpfs_dirent *de = dir->entries;
+        struct tmpfs_inode *ip = de->inode;
+        dir_remove(dir, de);
+        if (ip->mode == S_IFDIR)
+        {
+            free_tree(ip);
+        }
+        iput(ip);
+    }
+}
+
+/**
+ * free the tree of @m, which has no open files left
+ */
+static int tmpfs_umount(struct mount *m)
+{
+    struct tmpfs *fs = m->priv;
+    kmt->spin_lock(&fs->lock);
+    free_tree(fs->root);
+    kmt->spin_unlock(&fs->lock);
+    fs->root->nlink = 0;
+    iput(fs->root);
+    pmm->free(fs);
+    return VFS_SUCCESS;
+}
+
+/**
+ * the inode at @path with the O_* @flags, created for O_CREAT and
+ * returned referenced
+ */
+static struct tmpfs_inode *iopen(struct tmpfs *fs, const char *path, int flags)
+{
+    const char *name;
+    int len;
+    struct tmpfs_inode *ip = NULL;
+    bool writable = (flags & O_WRONLY) || (flags & O_RDWR);
+    kmt->spin_lock(&fs->lock);
+    struct tmpfs_inode *dir = walk(fs, path, &name, &len);
+    if (dir == NULL)
+    {
+        goto out;
+    }
+    if (len == 0)
+    {
+        ip = dir;
+    }
+    else
+    {
+        struct tmpfs_dirent *de = dir_find(dir, name, len);
+        if (de)
+        {
+            ip = de->inode;
+        }
+        else if ((flags & O_CREAT) && (ip = ialloc(fs, S_IFREG)) != NULL && dir_add(dir, name, len, ip) < 0)
+        {
+            pmm->free(ip);
+            ip = NULL;
+        }
+    }
+    if (ip == NULL || (ip->mode == S_IFDIR && writable) || (ip->mode != S_IFDIR && (flags & O_DIRECTORY)))
+    {
+        ip = NULL;
+        goto out;
+    }
+    if ((flags & O_TRUNC) && writable)
+    {
+        truncate(ip, 0);
+    }
+    ip->ref++;
+out:
+    kmt->spin_unlock(&fs->lock);
+    return ip;
+}
+
+static void iclose(struct tmpfs_inode *ip)
+{
+    struct tmpfs *fs = ip->fs;
+    kmt->spin_lock(&fs->lock);
+    ip->ref--;
+    iput(ip);
+    kmt->spin_unlock(&fs->lock);
+}
+
+static int tmpfs_open(struct mount *m, struct file *f, const char *path, int flags)
+{
+    struct tmpfs_inode *ip = iopen(m->priv, path, flags);
+    struct tmpfs_file *tf = ip ? pmm->alloc(sizeof(struct tmpfs_file)) : NULL;
+    if (tf == NULL)
+    {
+        if (ip)
+        {
+            iclose(ip);
+        }
+        return VFS_ERROR;
+    }
+    tf->ip = ip;
+    tf->pos = 0;
+    tf->append = (flags & O_APPEND) != 0;
+    f->type = ip->mode == S_IFDIR ? FD_DIR : FD_FILE;
+    f->fops = ip->mode == S_IFDIR ? &tmpfs_dir_fops : &tmpfs_file_fops;
+    f->ptr = tf;
+    return VFS_SUCCESS;
+}
+
+static void tmpfs_close(struct file *f)
+{
+    iclose(((struct tmpfs_file *)f->ptr)->ip);
+    pmm->free(f->ptr);
+}
+
+static ssize_t iread(struct tmpfs_inode *ip, void *buf, size_t n, uint64_t off)
+{
+    kmt->spin_lock(&ip->fs->lock);
+    if (ip->mode == S_IFDIR)
+    {
+        kmt->spin_unlock(&ip->fs->lock);
+        return -1;
+    }
+    if (off >= ip->size)
+    {
+        n = 0;
+    }
+    else if (n > ip->size - off)
+    {
+        n = ip->size - off;
+    }
+    for (size_t done = 0; done < n;)
+    {
+        uint64_t pos = off + done;
+        size_t chunk = PGSIZE - pos % PGSIZE < n - done ? PGSIZE - pos % PGSIZE : n - done;
+        void *pg = pos / PGSIZE < ip->npages ? ip->pages[pos / PGSIZE] : NULL;
+        if (pg)
+        {
+            memcpy((char *)buf + done, (char *)pg + pos % PGSIZE, chunk);
+        }
+        else
+        {
+            memset((char *)buf + done, 0, chunk);
+        }
+        done += chunk;
+    }
+    kmt->spin_unlock(&ip->fs->lock);
+    return n;
+}
+
+/**
+ * write at *@off, or at the end of the file when *@off is TMPFS_END,
+ * leaving *@off just after the data
+ */
+static ssize_t iwrite(struct tmpfs_inode *ip, const void *buf, size_t n, uint64_t *off)
+{
+    kmt->spin_lock(&ip->fs->lock);
+    if (ip->mode == S_IFDIR)
+    {
+        kmt->spin_unlock(&ip->fs->lock);
+        return -1;
+    }
+    uint64_t start = *off == TMPFS_END ? ip->size : *off;
+    uint64_t need = (start + n + PGSIZE - 1) / PGSIZE;
+    if (need > ip->npages)
+    {
+        uint64_t npages = ip->npages ? ip->npages : 1;
+        while (npages < need)
+        {
+            npages *= 2;
+        }
+        void **pages = pmm->alloc(npages * sizeof(void *));
+        if (pages == NULL)
+        {
+            kmt->spin_unlock(&ip->fs->lock);
+            return -1;
+        }
+        memset(pages, 0, npages * sizeof(void *));
+        memcpy(pages, ip->pages, ip->npages * sizeof(void *));
+        pmm->free(ip->pages);
+        ip->pages = pages;
+        ip->npages = npages;
+    }
+    size_t done = 0;
+    while (done < n)
+    {
+        uint64_t pos = start + done;
+        size_t chunk = PGSIZE - pos % PGSIZE < n - done ? PGSIZE - pos % PGSIZE : n - done;
+        void **pg = &ip->pages[pos / PGSIZE];
+        if (*pg == NULL)
+        {
+            if ((*pg = pmm->alloc(PGSIZE)) == NULL)
+            {
+                break;
+            }
+            memset(*pg, 0, PGSIZE);
+        }
+        memcpy((char *)*pg + pos % PGSIZE, (const char *)buf + done, chunk);
+        done += chunk;
+    }
+    if (start + done > ip->size)
+    {
+        ip->size = start + done;
+    }
+    kmt->spin_unlock(&ip->fs->lock);
+    *off = start + done;
+    return done ? done : (n ? -1 : 0);
+}
+
+/**
+ * move @n bytes between @buf and @ip at *@off, advancing it, through
+ * a kernel buffer: the inode is copied under the tmpfs lock, and a
+ * fault on @buf must not happen under it
+ */
+static ssize_t rw(struct tmpfs_inode *ip, void *buf, size_t n, uint64_t *off, bool write)
+{
+    if (n == 0)
+    {
+        return 0;
+    }
+    char *kbuf = pmm->alloc(n < VFS_COPY_CHUNK ? n : VFS_COPY_CHUNK);
+    if (kbuf == NULL)
+    {
+        return -1;
+    }
+    ssize_t total = 0;
+    while (total < n)
+    {
+        size_t chunk = n - total < VFS_COPY_CHUNK ? n - total : VFS_COPY_CHUNK;
+        ssize_t r;
+        if (write)
+        {
+            memcpy(kbuf, (char *)buf + total, chunk);
+            r = iwrite(ip, kbuf, chunk, off);
+        }
+        else if ((r = iread(ip, kbuf, chunk, *off)) > 0)
+        {
+            memcpy((char *)buf + total, kbuf, r);
+            *off += r;
+        }
+        if (r <= 0)
+        {
+            total = total ? total : r;
+            break;
+        }
+        total += r;
+        if (r < chunk)
+        {
+            break;
+        }
+    }
+    pmm->free(kbuf);
+    return total;
+}
+
+static ssize_t tmpfs_read(struct file *f, void *buf, size_t n)
+{
+    struct tmpfs_file *tf = f->ptr;
+    return rw(tf->ip, buf, n, &tf->pos, false);
+}
+
+static ssize_t tmpfs_write(struct file *f, const void *buf, size_t n)
+{
+    struct tmpfs_file *tf = f->ptr;
+    uint64_t off = tf->append ? TMPFS_END : tf->pos;
+    ssize_t r = rw(tf->ip, (void *)buf, n, &off, true);
+    if (off != TMPFS_END)
+    {
+        tf->pos = off;
+    }
+    return r;
+}
+
+static ssize_t tmpfs_pread(struct file *f, void *buf, size_t n, uint64_t off)
+{
+    return rw(((struct tmpfs_file *)f->ptr)->ip, buf, n, &off, false);
+}
+
+static ssize_t tmpfs_pwrite(struct file *f, const void *buf, size_t n, uint64_t off)
+{
+    return rw(((struct tmpfs_file *)f->ptr)->ip, (void *)buf, n, &off, true);
+}
+
+static off_t tmpfs_seek(struct file *f, off_t offset, int whence)
+{
+    struct tmpfs_file *tf = f->ptr;
+    int64_t base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? (int64_t)tf->pos : -1;
+    if (whence == SEEK_END)
+    {
+        kmt->spin_lock(&tf->ip->fs->lock);
+        base = tf->ip->size;
+        kmt->spin_unlock(&tf->ip->fs->lock);
+    }
+    if (base < 0 || base + offset < 0)
+    {
+        return VFS_ERROR;
+    }
+    tf->pos = base + offset;
+    return tf->pos;
+}
+
+/**
+ * directories seek to the d_off cookies handed out by getdents64
+ */
+static off_t tmpfs_dir_seek(struct file *f, off_t offset, int whence)
+{
+    if (whence != SEEK_SET || offset < 0)
+    {
+        return VFS_ERROR;
+    }
+    ((struct tmpfs_file *)f->ptr)->pos = offset;
+    return offset;
+}
+
+/**
+ * hand the entries after the cookie at the file position to
+ * dir_emit, . and .. first; returns 1 when one did not fit
+ */
+static int tmpfs_readdir(struct file *f, struct dir_context *ctx)
+{
+    struct tmpfs_file *tf = f->ptr;
+    struct tmpfs_inode *ip = tf->ip;
+    int r = 0;
+    kmt->spin_lock(&ip->fs->lock);
+    if (tf->pos < 1 && (r = dir_emit(ctx, ".", 1, ip->ino, EXT4_DE_DIR, 1)) == 0)
+    {
+        tf->pos = 1;
+    }
+    if (r == 0 && tf->pos < 2 && (r = dir_emit(ctx, "..", 2, ip->parent->ino, EXT4_DE_DIR, 2)) == 0)
+    {
+        tf->pos = 2;
+    }
+    for (struct tmpfs_dirent *de = ip->entries; de && r == 0; de = de->next)
+    {
+        uint8_t type = de->inode->mode == S_IFDIR ? EXT4_DE_DIR : EXT4_DE_REG_FILE;
+        if (de->off > tf->pos && (r = dir_emit(ctx, de->name, de->len, de->inode->ino, type, de->off)) == 0)
+        {
+            tf->pos = de->off;
+        }
+    }
+    kmt->spin_unlock(&ip->fs->lock);
+    return r;
+}
+
+static int tmpfs_stat(struct file *f, struct stat *st)
+{
+    struct tmpfs_inode *ip = ((struct tmpfs_file *)f->ptr)->ip;
+    kmt->spin_lock(&ip->fs->lock);
+    st->st_mode = ip->mode;
+    st->st_ino = ip->ino;
+    st->st_size = ip->size;
+    st->st_nlink = ip->mode == S_IFDIR ? ip->nlink + 1 : ip->nlink; // directories count their .
+    kmt->spin_unlock(&ip->fs->lock);
+    return 0;
+}
+
+static int tmpfs_mkdir(struct mount *m, const char *path)
+{
+    struct tmpfs *fs = m->priv;
+    const char *name;
+    int len;
+    int r = -1;
+    kmt->spin_lock(&fs->lock);
+    struct tmpfs_inode *dir = walk(fs, path, &name, &len);
+    if (dir && len > 0 && dir_find(dir, name, len) == NULL)
+    {
+        struct tmpfs_inode *ip = ialloc(fs, S_IFDIR);
+        if (ip && (r = dir_add(dir, name, len, ip)) < 0)
+        {
+            pmm->free(ip);
+        }
+    }
+    kmt->spin_unlock(&fs->lock);
+    return r;
+}
+
+/**
+ * remove the name @path, a directory (which must be empty) when
+ * @isdir, anything else otherwise
+ */
+static int remove(struct tmpfs *fs, const char *path, bool isdir)
+{
+    const char *name;
+    int len;
+    int r = -1;
+    kmt->spin_lock(&fs->lock);
+    struct tmpfs_inode *dir = walk(fs, path, &name, &len);
+    struct tmpfs_dirent *de = (dir && len > 0) ? dir_find(dir, name, len) : NULL;
+    if (de && (de->inode->mode == S_IFDIR) == isdir && (!isdir || de->inode->entries == NULL))
+    {
+        struct tmpfs_inode *ip = de->inode;
+        dir_remove(dir, de);
+        iput(ip);
+        r = 0;
+    }
+    kmt->spin_unlock(&fs->lock);
+    return r;
+}
+
+static int tmpfs_rmdir(struct mount *m, const char *path)
+{
+    return remove(m->priv, path, true);
+}
+
+static int tmpfs_unlink(struct mount *m, const char *path)
+{
+    return remove(m->priv, path, false);
+}
+
+static int tmpfs_link(struct mount *m, const char *oldpath, const char *newpath)
+{
+    struct tmpfs *fs = m->priv;
+    const char *name;
+    int len;
+    int r = -1;
+    kmt->spin_lock(&fs->lock);
+    struct tmpfs_inode *ip = namei(fs, oldpath);
+    struct tmpfs_inode *dir = walk(fs, newpath, &name, &len);
+    if (ip && ip->mode != S_IFDIR && dir && len > 0 && dir_find(dir, name, len) == NULL)
+    {
+        r = dir_add(dir, name, len, ip);
+    }
+    kmt->spin_unlock(&fs->lock);
+    return r;
+}
+
+/**
+ * move @oldpath to @newpath, replacing a file there, or an empty
+ * directory when a directory moves; a directory cannot move into
+ * its own subtree
+ */
+static int tmpfs_rename(struct mount *m, const char *oldpath, const char *newpath)
+{
+    struct tmpfs *fs = m->priv;
+    const char *oname, *nname;
+    int olen, nlen;
+    int r = -1;
+    kmt->spin_lock(&fs->lock);
+    struct tmpfs_inode *odir = walk(fs, oldpath, &oname, &olen);
+    struct tmpfs_inode *ndir = walk(fs, newpath, &nname, &nlen);
+    struct tmpfs_dirent *ode = (odir && olen > 0) ? dir_find(odir, oname, olen) : NULL;
+    if (ode == NULL || ndir == NULL || nlen == 0)
+    {
+        goto out;
+    }
+    struct tmpfs_inode *ip = ode->inode;
+    for (struct tmpfs_inode *p = ndir; ip->mode == S_IFDIR; p = p->parent)
+    {
+        if (p == ip)
+        {
+            goto out;
+        }
+        if (p == fs->root)
+        {
+            break;
+        }
+    }
+    struct tmpfs_dirent *nde = dir_find(ndir, nname, nlen);
+    if (nde == ode)
+    {
+        r = 0;
+        goto out;
+    }
+    if (nde)
+    {
+        struct tmpfs_inode *victim = nde->inode;
+        if ((victim->mode == S_IFDIR) != (ip->mode == S_IFDIR) || victim->entries)
+        {
+            goto out;
+        }
+        dir_remove(ndir, nde);
+        iput(victim);
+    }
+    if (dir_add(ndir, nname, nlen, ip) == 0)
+    {
+        dir_remove(odir, dir_find(odir, oname, olen));
+        r = 0;
+    }
+out:
+    kmt->spin_unlock(&fs->lock);
+    return r;
+}
+
+static const struct file_ops tmpfs_file_fops = {
+    .close = tmpfs_close,
+    .read = tmpfs_read,
+    .write = tmpfs_write,
+    .pread = tmpfs_pread,
+    .pwrite = tmpfs_pwrite,
+    .seek = tmpfs_seek,
+    .stat = tmpfs_stat,
+};
+
+static const struct file_ops tmpfs_dir_fops = {
+    .close = tmpfs_close,
+    .readdir = tmpfs_readdir,
+    .seek = tmpfs_dir_seek,
+    .stat = tmpfs_stat,
+};
+
+static const struct inode_ops tmpfs_iops = {
+    .open = tmpfs_open,
+    .mkdir = tmpfs_mkdir,
+    .rmdir = tmpfs_rmdir,
+    .unlink = tmpfs_unlink,
+    .link = tmpfs_link,
+    .rename = tmpfs_rename,
+};
+
+const struct fs_ops tmpfs_fs_ops = {
+    .name = "tmpfs",
+    .mount = tmpfs_mount,
+    .umount = tmpfs_umount,
+    .iops = &tmpfs_iops,
+};
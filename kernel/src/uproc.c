@@ -2,12 +2,24 @@
 #include <string.h>
 #include <am.h>
 #include <vfs.h>
+#include <pgcache.h>
 #include "initcode.inc"
 #define MAX_PID 32767
+#define VMA_BATCH 64 // pages unmapped/mapped per range operation
+#define SWAP_BATCH 32 // pages swapped out per reclaim
+#define SWAP_SCAN 1024 // page table entries the clock examines per process visit
+#define VMA_READAHEAD 16 // pages mapped ahead of a fault in a sequential file area
+#define SWAP_ENTRY(slot) (((uintptr_t)(slot) << 12) | PTE_SWAP)
+#define SWAP_SLOT(pte) ((int)(PTE_ADDR(pte) >> 12))
 static spinlock_t uproc_lock;
 static int next_pid = 1;
 extern void kmt_add_task(task_t *task);
 extern task_t *kmt_get_son();
+extern bool kmt_oom_kill(procinfo_t *self);
+extern bool kmt_scan_idle(procinfo_t *self, bool (*scan)(procinfo_t *pi, void *arg), void *arg);
+static procinfo_t *charged[MAX_CPU]; // 各 CPU 上新页表页的记账对象
+static uint64_t vdso_key;            // 时钟页在页缓存中的对象标识
+static struct page *scratch[2];      // 内核访问失败时代替用户页：[0] 供读的零页，[1] 供写的垃圾页
 static int uproc_alloc_pid()
 {
     kmt->spin_lock(&uproc_lock);
@@ -16,6 +28,11 @@ static int uproc_alloc_pid()
     kmt->spin_unlock(&uproc_lock);
     return ret;
 }
+static void *uproc_mmap(task_t *task, void *addr, size_t length, int prot, int flags, struct file *f, off_t offset);
+static void *uproc_upage(task_t *task, uintptr_t addr);
+static void *uproc_pgalloc(int size);
+static void uproc_release(AddrSpace *as, struct vma *vmas);
+static int uproc_vdso(task_t *task);
 static void user_init()
 {
     task_t *task = pmm->alloc(sizeof(task_t));
@@ -24,15 +41,24 @@ static void user_init()
     task->pi->pid = uproc_alloc_pid();
     task->pi->cwd = pmm->alloc(PATH_MAX);
     task->pi->brk = NULL;
+    task->pi->vmas = NULL;
+    task->pi->rss = 0;
+    task->pi->ptpages = 1;
+    task->pi->rss_limit = 0;
+    task->pi->killed = 0;
+    task->pi->clock_hand = 0;
+    task->pi->ring = NULL;
+    task->pi->traced = 0;
     strcpy(task->pi->cwd, "/");
     panic_on(task->pi == NULL, "Failed to allocate procinfo for init process");
     protect(&task->pi->as);
-    char *mem = pmm->alloc(task->pi->as.pgsize);
-    map(&task->pi->as, (void *)(long)UVMEND - task->pi->as.pgsize, (void *)mem, MMAP_READ | MMAP_WRITE);
-    panic_on(_init_len > task->pi->as.pgsize, "init code too large");
-    char *entry = pmm->alloc(task->pi->as.pgsize);
-    memcpy(entry, _init, _init_len);
-    map(&task->pi->as, (void *)UVSTART, (void *)entry, MMAP_READ | MMAP_WRITE);
+    panic_on(_init_len > PGSIZE, "init code too large");
+    uproc_mmap(task, (void *)(UVMEND - PGSIZE), PGSIZE, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_GROWSDOWN, NULL, 0);
+    uproc_mmap(task, (void *)UVSTART, PGSIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, NULL, 0);
+    memcpy(uproc_upage(task, UVSTART), _init, _init_len);
+    uproc_vdso(task);
     task->fence = (void *)FENCE_PATTERN;
     Area stack_area = RANGE(task->stack, task->stack + STACK_SIZE);
     task->context = ucontext(&task->pi->as, stack_area, (void *)UVSTART);
@@ -41,43 +67,56 @@ static void user_init()
     task->cpu = -1;
     task->next = NULL;
     kmt->spin_init(&task->lock, task->name);
-    for (size_t i = 0; i < NOFILE; i++)
+    task->files = fdt->create();
+    panic_on(task->files == NULL, "no memory for the initial fd table");
+    for (size_t i = 0; i < 3; i++)
     {
-        if (task->open_files[i])
-        {
-            vfs->close(task->open_files[i]);
-            task->open_files[i] = NULL;
-        }
-    }
-    task->open_files[0] = vfs->alloc();
-    task->open_files[0]->readable = true;
-    task->open_files[0]->writable = false;
-    task->open_files[0]->ptr = dev->lookup("tty1");
-    task->open_files[0]->type = FD_DEVICE;
-    task->open_files[0]->ref = 1;
-    for (size_t i = 1; i < 3; i++)
-    {
-        task->open_files[i] = vfs->alloc();
-        task->open_files[i]->writable = true;
-        task->open_files[i]->readable = false;
-        task->open_files[i]->ptr = dev->lookup("tty1");
-        task->open_files[i]->type = FD_DEVICE;
-        task->open_files[i]->ref = 1;
+        struct file *f = vfs->alloc();
+        panic_on(f == NULL, "no memory for the initial fds");
+        f->readable = (i == 0);
+        f->writable = (i != 0);
+        f->ptr = dev->lookup("tty1");
+        f->type = FD_DEVICE;
+        fdt->alloc(task, f, 0);
     }
     kmt_add_task(task);
     TRACE_EXIT;
 }
+/**
+ * the clock page is a page cache object whose reference is never
+ * dropped, so every mapping of it shares the same frame
+ */
+static void vdso_init()
+{
+    vdso_key = pgcache->key(NULL);
+    struct page *pg = pgcache->get(vdso_key, 0, NULL);
+    panic_on(pg == NULL, "no memory for the clock page");
+    AM_TIMER_TSC_T tsc = io_read(AM_TIMER_TSC);
+    struct vdso_clock *clock = pg->pa;
+    clock->freq_mhz = tsc.freq_mhz;
+    clock->uptsc = tsc.uptsc;
+    for (int i = 0; i < 2; i++)
+    {
+        scratch[i] = pgcache->get(pgcache->key(NULL), 0, NULL);
+        panic_on(scratch[i] == NULL, "no memory for the scratch pages");
+    }
+}
 static void uproc_init()
 {
-    vme_init((void *(*)(int))pmm->alloc, pmm->free);
+    vme_init(uproc_pgalloc, pmm->free);
     kmt->spin_init(&uproc_lock, "uproc_lock");
+    vdso_init();
     user_init();
 }
 
+static int uproc_munmap(task_t *task, void *addr, size_t length);
 static int uproc_exit(task_t *task, int status)
 {
     panic_on(task == NULL, "Task is NULL");
     panic_on(task->pi == NULL, "Task procinfo is NULL");
+    uproc_munmap(task, (void *)UVSTART, UVMEND - UVSTART);
+    fdt->release(task->files);
+    task->files = NULL;
     task->pi->xstate = status;
     task->status = TASK_ZOMBIE;
     return 0;
@@ -89,93 +128,640 @@ static int uproc_kputc(task_t *task, char ch)
     return 0;
 }
 
-int uvmcopy(AddrSpace *old, AddrSpace *new, uint64_t sz)
+static struct vma *vma_find(procinfo_t *pi, uintptr_t addr)
 {
-    //maybe wrong
-    panic_on(old == NULL || new == NULL, "old or new AddrSpace is NULL");
-    uintptr_t pg_sz = old->pgsize;
-    for (uintptr_t offset = 0; offset < sz; offset += pg_sz)
+    for (struct vma *vma = pi->vmas; vma; vma = vma->next)
     {
-        uintptr_t current_va = (uintptr_t)UVSTART + offset;
-        if (current_va >= (uintptr_t)UVMEND)
+        if (vma->start <= addr && addr < vma->end)
         {
-            break;
+            return vma;
         }
-        uintptr_t *ptep = ptewalk(old, current_va);
-        if (ptep && (*ptep & PROT_READ))
+    }
+    return NULL;
+}
+
+static void vma_insert(procinfo_t *pi, struct vma *vma)
+{
+    struct vma **pp = &pi->vmas;
+    while (*pp && (*pp)->start < vma->start)
+    {
+        pp = &(*pp)->next;
+    }
+    vma->next = *pp;
+    *pp = vma;
+}
+
+/**
+ * extend the stack area just above @addr down to cover it,
+ * up to USTACK_LIMIT and never closer than a guard page to the
+ * area below it
+ */
+static struct vma *vma_grow(procinfo_t *pi, uintptr_t addr)
+{
+    uintptr_t va = ROUNDDOWN(addr, PGSIZE);
+    struct vma *prev = NULL;
+    for (struct vma *vma = pi->vmas; vma; prev = vma, vma = vma->next)
+    {
+        if (vma->start <= addr)
         {
-            int map_prot = MMAP_READ;
-            if (*ptep & PROT_WRITE)
+            continue;
+        }
+        if (!(vma->flags & MAP_GROWSDOWN) || vma->end - va > USTACK_LIMIT)
+        {
+            return NULL;
+        }
+        if (prev && prev->end + PGSIZE > va)
+        {
+            return NULL;
+        }
+        vma->start = va;
+        return vma;
+    }
+    return NULL;
+}
+
+/**
+ * pick a free range of @length bytes in the mmap area,
+ * honouring @hint when it is page aligned and free
+ */
+static uintptr_t vma_range(procinfo_t *pi, uintptr_t hint, size_t length)
+{
+    if (hint && hint % PGSIZE == 0 && hint >= UVMMAP && hint + length <= UVMMAPEND)
+    {
+        struct vma *vma;
+        for (vma = pi->vmas; vma; vma = vma->next)
+        {
+            if (vma->start < hint + length && hint < vma->end)
             {
-                map_prot |= MMAP_WRITE;
+                break;
             }
-            void *old_pa = (void *)PTE_ADDR(*ptep);
-            void *new_pa = pmm->alloc(pg_sz);
-            panic_on(new_pa == NULL, "Failed to allocate new physical page");
-            memcpy(new_pa, old_pa, pg_sz);
-            map(new, (void *)current_va, new_pa, map_prot);
-        }else{
-            break;
+        }
+        if (vma == NULL)
+        {
+            return hint;
         }
     }
-    for (uintptr_t offset = sz-pg_sz; offset >0; offset -= pg_sz)
+    uintptr_t start = UVMMAP;
+    for (struct vma *vma = pi->vmas; vma; vma = vma->next)
     {
-        uintptr_t current_va = (uintptr_t)UVSTART + offset;
-        if (current_va >= (uintptr_t)UVMEND)
+        if (vma->end <= start)
+        {
+            continue;
+        }
+        if (vma->start >= start + length)
         {
             break;
         }
-        uintptr_t *ptep = ptewalk(old, current_va);
-        if (ptep && (*ptep & PROT_READ))
+        start = vma->end;
+    }
+    return start + length <= UVMMAPEND ? start : 0;
+}
+
+/**
+ * attribute page-table pages allocated on this CPU to @pi;
+ * returns the previous owner so that callers can nest
+ */
+static procinfo_t *charge(procinfo_t *pi)
+{
+    procinfo_t *prev = charged[cpu_current()];
+    charged[cpu_current()] = pi;
+    return prev;
+}
+
+struct reclaim
+{
+    int want;  // pages still to swap out
+    bool full; // the swap area ran out
+};
+
+/**
+ * swap out the private page mapped by *@ptep at @va of @pi
+ */
+static bool vma_swap_out(procinfo_t *pi, uintptr_t va, uintptr_t *ptep)
+{
+    void *pa = (void *)PTE_ADDR(*ptep);
+    int slot = swapper->out(pa);
+    if (slot < 0)
+    {
+        return false;
+    }
+    uintptr_t writable = *ptep & PTE_W;
+    map(&pi->as, (void *)va, NULL, MMAP_NONE);
+    *ptep = SWAP_ENTRY(slot) | writable;
+    pmm->free(pa);
+    pi->rss--;
+    return true;
+}
+
+/**
+ * advance the clock hand of @pi over its private areas: pages
+ * accessed since the last sweep get a second chance, the others
+ * are swapped out until the request in @arg is met
+ */
+static bool vma_swap_scan(procinfo_t *pi, void *arg)
+{
+    struct reclaim *r = arg;
+    int budget = SWAP_SCAN;
+    uintptr_t hand = pi->clock_hand;
+    struct vma *vma = pi->vmas;
+    while (vma && vma->end <= hand)
+    {
+        vma = vma->next;
+    }
+    for (; vma; vma = vma->next)
+    {
+        uintptr_t va = vma->start > hand ? vma->start : hand;
+        for (; va < vma->end && !(vma->flags & MAP_SHARED); va += PGSIZE)
         {
-            int map_prot = MMAP_READ;
-            if (*ptep & PROT_WRITE)
+            if (budget-- == 0 || r->want == 0 || r->full)
             {
-                map_prot |= MMAP_WRITE;
+                pi->clock_hand = va;
+                return r->want == 0 || r->full;
+            }
+            uintptr_t *ptep = ptewalk(&pi->as, va);
+            if (ptep == NULL || (*ptep & PTE_PS))
+            {
+                // no page table here, or a large page that stays resident
+                va = ROUNDDOWN(va, LPGSIZE) + LPGSIZE - PGSIZE;
+                continue;
+            }
+            if (!(*ptep & PTE_P) || pgcache->lookup((void *)PTE_ADDR(*ptep)))
+            {
+                continue;
+            }
+            if (*ptep & PTE_A)
+            {
+                *ptep &= ~PTE_A;
+            }
+            else if (vma_swap_out(pi, va, ptep))
+            {
+                r->want--;
+            }
+            else
+            {
+                r->full = true;
             }
-            void *old_pa = (void *)PTE_ADDR(*ptep);
-            void *new_pa = pmm->alloc(pg_sz);
-            panic_on(new_pa == NULL, "Failed to allocate new physical page");
-            memcpy(new_pa, old_pa, pg_sz);
-            map(new, (void *)current_va, new_pa, map_prot);
-        }else{
-            break;
+        }
+    }
+    pi->clock_hand = 0;
+    return r->want == 0 || r->full;
+}
+
+/**
+ * swap out up to @npages cold pages, @self included; two sweeps
+ * at most, so that pages spared by the first can go in the second
+ */
+static bool vma_reclaim(procinfo_t *self, int npages)
+{
+    struct reclaim r = {.want = npages, .full = false};
+    for (int pass = 0; pass < 2 && r.want > 0 && !r.full; pass++)
+    {
+        kmt_scan_idle(self, vma_swap_scan, &r);
+    }
+    return r.want < npages;
+}
+
+/**
+ * make room after the allocator failed: swap cold pages out,
+ * or kill a process when nothing could be swapped
+ */
+static bool uproc_reclaim(procinfo_t *pi)
+{
+    return vma_reclaim(pi, SWAP_BATCH) || kmt_oom_kill(pi);
+}
+
+static void *uproc_pgalloc(int size)
+{
+    void *pt = pmm->alloc(size);
+    procinfo_t *pi = charged[cpu_current()];
+    if (pt == NULL && uproc_reclaim(pi))
+    {
+        pt = pmm->alloc(size);
+    }
+    if (pt && pi)
+    {
+        pi->ptpages++;
+    }
+    return pt;
+}
+
+/**
+ * allocate a user frame of @npages pages for @pi within its resident
+ * limit, swapping its own pages out to stay below it; a small frame
+ * the allocator cannot provide is retried once after reclaim
+ */
+static void *vma_alloc(procinfo_t *pi, size_t npages)
+{
+    if (pi->rss_limit && pi->rss + npages > pi->rss_limit)
+    {
+        struct reclaim r = {.want = pi->rss + npages - pi->rss_limit, .full = false};
+        if (npages > 1)
+        {
+            return NULL;
+        }
+        for (int wraps = 0; wraps < 2 && r.want > 0 && !r.full;)
+        {
+            vma_swap_scan(pi, &r);
+            wraps += pi->clock_hand == 0;
+        }
+        if (r.want > 0)
+        {
+            return NULL;
+        }
+    }
+    if (npages > 1)
+    {
+        return pmm->alloc_large();
+    }
+    void *pa = pmm->alloc(PGSIZE);
+    if (pa == NULL && uproc_reclaim(pi))
+    {
+        pa = pmm->alloc(PGSIZE);
+    }
+    return pa;
+}
+
+/**
+ * drop a frame unmapped from @vma: page cache pages lose a reference
+ * (written back first if dirtied through a shared mapping),
+ * private pages are freed
+ */
+static void vma_release_frame(procinfo_t *pi, struct vma *vma, void *pa, bool dirty)
+{
+    pi->rss--;
+    struct page *pg = pgcache->lookup(pa);
+    if (pg == NULL)
+    {
+        pmm->free(pa);
+        return;
+    }
+    if (dirty && (vma->flags & MAP_SHARED) && vma->file)
+    {
+        pgcache->mark_dirty(pg);
+        pgcache->writeback(pg, vma->file);
+    }
+    pgcache->put(pg);
+}
+
+static void vma_release_page(procinfo_t *pi, struct vma *vma, uintptr_t va)
+{
+    uintptr_t *ptep = ptewalk(&pi->as, va);
+    if (ptep == NULL || !(*ptep & PTE_P))
+    {
+        return;
+    }
+    void *pa = (void *)PTE_ADDR(*ptep);
+    bool dirty = (*ptep & PTE_D) != 0;
+    map(&pi->as, (void *)va, NULL, MMAP_NONE);
+    vma_release_frame(pi, vma, pa, dirty);
+}
+
+/**
+ * map the 2 MiB block at @base with small private copies of @src;
+ * on failure the pages copied so far stay mapped
+ */
+static int vma_map_small(procinfo_t *pi, uintptr_t base, void *src, int prot)
+{
+    procinfo_t *prev = charge(pi);
+    void *frames[VMA_BATCH];
+    int ret = 0;
+    for (uintptr_t off = 0; off < LPGSIZE && ret == 0; off += VMA_BATCH * PGSIZE)
+    {
+        int n = 0;
+        while (n < VMA_BATCH && (frames[n] = pmm->alloc(PGSIZE)) != NULL)
+        {
+            memcpy(frames[n], src + off + n * PGSIZE, PGSIZE);
+            n++;
+        }
+        if (n < VMA_BATCH)
+        {
+            ret = -1;
+        }
+        if (n > 0)
+        {
+            map_range(&pi->as, (void *)(base + off), frames, n, prot);
+        }
+    }
+    charge(prev);
+    return ret;
+}
+
+/**
+ * replace the large page mapped at @base with small private copies
+ */
+static void vma_split_large(procinfo_t *pi, uintptr_t base)
+{
+    uintptr_t *ptep = ptewalk(&pi->as, base);
+    void *pa = (void *)PTE_ADDR(*ptep);
+    int prot = (*ptep & PTE_W) ? MMAP_READ | MMAP_WRITE : MMAP_READ;
+    map_large(&pi->as, (void *)base, NULL, MMAP_NONE);
+    panic_on(vma_map_small(pi, base, pa, prot) < 0, "Out of memory splitting a large page");
+    pmm->free_large(pa);
+}
+
+/**
+ * large pages overlapping [@lo, @hi): those inside are freed,
+ * those straddling a boundary are split into small pages first
+ */
+static void vma_release_large(procinfo_t *pi, uintptr_t lo, uintptr_t hi)
+{
+    for (uintptr_t base = ROUNDDOWN(lo, LPGSIZE); base < hi; base += LPGSIZE)
+    {
+        uintptr_t *ptep = ptewalk(&pi->as, base);
+        if (ptep == NULL || !(*ptep & PTE_PS))
+        {
+            continue;
+        }
+        if (base < lo || base + LPGSIZE > hi)
+        {
+            vma_split_large(pi, base);
+            continue;
+        }
+        void *pa = (void *)PTE_ADDR(*ptep);
+        map_large(&pi->as, (void *)base, NULL, MMAP_NONE);
+        pi->rss -= LPGSIZE / PGSIZE;
+        pmm->free_large(pa);
+    }
+}
+
+/**
+ * drop the pages of [@lo, @hi) of @vma that have no present entry:
+ * the swap slots of swapped out pages, the frames of PROT_NONE pages
+ */
+static void vma_release_hidden(procinfo_t *pi, struct vma *vma, uintptr_t lo, uintptr_t hi)
+{
+    for (uintptr_t va = lo; va < hi; va += PGSIZE)
+    {
+        uintptr_t *ptep = ptewalk(&pi->as, va);
+        if (ptep == NULL)
+        {
+            va = ROUNDDOWN(va, LPGSIZE) + LPGSIZE - PGSIZE;
+            continue;
+        }
+        uintptr_t pte = *ptep;
+        if (!(pte & PTE_P) && (pte & PTE_SWAP))
+        {
+            swapper->free(SWAP_SLOT(pte));
+            *ptep = 0;
+        }
+        else if (!(pte & PTE_P) && (pte & PTE_NONE))
+        {
+            *ptep = 0;
+            vma_release_frame(pi, vma, (void *)PTE_ADDR(pte), (pte & PTE_D) != 0);
+        }
+    }
+}
+
+/**
+ * unmap [@lo, @hi) of @vma; only shared file mappings need the
+ * dirty bit of each page, everything else is unmapped in batches
+ */
+static void vma_release_range(procinfo_t *pi, struct vma *vma, uintptr_t lo, uintptr_t hi)
+{
+    if (swapper->used() > 0 || vma->prot == PROT_NONE)
+    {
+        vma_release_hidden(pi, vma, lo, hi);
+    }
+    if ((vma->flags & MAP_SHARED) && vma->file)
+    {
+        for (uintptr_t va = lo; va < hi; va += PGSIZE)
+        {
+            vma_release_page(pi, vma, va);
+        }
+        return;
+    }
+    vma_release_large(pi, lo, hi);
+    void *frames[VMA_BATCH];
+    while (lo < hi)
+    {
+        int n = (hi - lo) / PGSIZE < VMA_BATCH ? (hi - lo) / PGSIZE : VMA_BATCH;
+        if (unmap_range(&pi->as, (void *)lo, n, frames) > 0)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                if (frames[i])
+                {
+                    vma_release_frame(pi, vma, frames[i], false);
+                }
+            }
+        }
+        lo += n * PGSIZE;
+    }
+}
+
+/**
+ * bring the entries of [@lo, @hi) in line with the protection of
+ * @vma: PROT_NONE pages keep their frame in a non-present entry,
+ * large pages are split unless they stay accessible as a whole,
+ * and private page cache pages stay read-only for copy on write
+ */
+static void vma_protect_range(procinfo_t *pi, struct vma *vma, uintptr_t lo, uintptr_t hi)
+{
+    int prot = (vma->prot & PROT_WRITE) ? MMAP_READ | MMAP_WRITE : MMAP_READ;
+    for (uintptr_t base = ROUNDDOWN(lo, LPGSIZE); base < hi; base += LPGSIZE)
+    {
+        uintptr_t *ptep = ptewalk(&pi->as, base);
+        if (ptep == NULL || !(*ptep & PTE_P) || !(*ptep & PTE_PS))
+        {
+            continue;
+        }
+        if (base < lo || base + LPGSIZE > hi || vma->prot == PROT_NONE)
+        {
+            vma_split_large(pi, base);
+            continue;
+        }
+        void *pa = (void *)PTE_ADDR(*ptep);
+        map_large(&pi->as, (void *)base, NULL, MMAP_NONE);
+        map_large(&pi->as, (void *)base, pa, prot);
+    }
+    for (uintptr_t va = lo; va < hi; va += PGSIZE)
+    {
+        uintptr_t *ptep = ptewalk(&pi->as, va);
+        if (ptep == NULL || (*ptep & PTE_PS))
+        {
+            va = ROUNDDOWN(va, LPGSIZE) + LPGSIZE - PGSIZE;
+            continue;
+        }
+        uintptr_t pte = *ptep;
+        if (!(pte & (PTE_P | PTE_NONE)))
+        {
+            continue;
+        }
+        void *pa = (void *)PTE_ADDR(pte);
+        if (pte & PTE_P)
+        {
+            map(&pi->as, (void *)va, NULL, MMAP_NONE);
+        }
+        if (vma->prot == PROT_NONE)
+        {
+            *ptep = (uintptr_t)pa | PTE_NONE | (pte & PTE_D);
+            continue;
+        }
+        *ptep = 0;
+        bool cow = !(vma->flags & MAP_SHARED) && pgcache->lookup(pa);
+        map(&pi->as, (void *)va, pa, cow ? MMAP_READ : prot);
+        *ptep |= pte & PTE_D;
+    }
+}
+
+/**
+ * duplicate the areas of @old into @new: page cache pages are
+ * shared with the child, private pages are copied (swapped out
+ * ones are read back for the child); fails when
+ * memory runs out, leaving @new partially populated
+ */
+static int vma_fork(procinfo_t *old, procinfo_t *new)
+{
+    struct vma **tail = &new->vmas;
+    for (struct vma *vma = old->vmas; vma; vma = vma->next)
+    {
+        struct vma *copy = pmm->alloc(sizeof(struct vma));
+        if (copy == NULL)
+        {
+            return -1;
+        }
+        *copy = *vma;
+        copy->file = vma->file ? vfs->dup(vma->file) : NULL;
+        copy->next = NULL;
+        *tail = copy;
+        tail = &copy->next;
+        // runs of present pages with the same protection are mapped at once
+        void *frames[VMA_BATCH];
+        uintptr_t run = 0;
+        int run_prot = 0, n = 0;
+        for (uintptr_t va = vma->start; va < vma->end; va += PGSIZE)
+        {
+            uintptr_t *ptep = ptewalk(&old->as, va);
+            bool present = ptep && (*ptep & (PTE_P | PTE_SWAP | PTE_NONE));
+            bool large = present && (*ptep & PTE_P) && (*ptep & PTE_PS);
+            int prot = present && (*ptep & PTE_W) ? MMAP_READ | MMAP_WRITE : MMAP_READ;
+            if (n > 0 && (!present || large || prot != run_prot || n == VMA_BATCH))
+            {
+                map_range(&new->as, (void *)run, frames, n, run_prot);
+                new->rss += n;
+                n = 0;
+            }
+            if (!present)
+            {
+                continue;
+            }
+            if (large)
+            {
+                // falls back to small copies when the large pool is empty
+                void *src = (void *)PTE_ADDR(*ptep);
+                void *copy = vma_alloc(new, LPGSIZE / PGSIZE);
+                if (copy)
+                {
+                    memcpy(copy, src, LPGSIZE);
+                    map_large(&new->as, (void *)va, copy, prot);
+                }
+                else if (vma_map_small(new, va, src, prot) < 0)
+                {
+                    return -1;
+                }
+                new->rss += LPGSIZE / PGSIZE;
+                va += LPGSIZE - PGSIZE;
+                continue;
+            }
+            if (n == 0)
+            {
+                run = va;
+                run_prot = prot;
+            }
+            void *pa = (void *)PTE_ADDR(*ptep);
+            struct page *pg = (*ptep & PTE_SWAP) ? NULL : pgcache->lookup(pa);
+            if (pg)
+            {
+                pgcache->dup(pg);
+                frames[n++] = pa;
+                continue;
+            }
+            void *new_pa = vma_alloc(new, 1);
+            if (new_pa == NULL)
+            {
+                if (n > 0)
+                {
+                    map_range(&new->as, (void *)run, frames, n, run_prot);
+                    new->rss += n;
+                }
+                return -1;
+            }
+            // the allocation may have swapped the page out meanwhile
+            if (*ptep & PTE_SWAP)
+            {
+                swapper->in(SWAP_SLOT(*ptep), new_pa);
+            }
+            else
+            {
+                memcpy(new_pa, (void *)PTE_ADDR(*ptep), PGSIZE);
+            }
+            frames[n++] = new_pa;
+        }
+        if (n > 0)
+        {
+            map_range(&new->as, (void *)run, frames, n, run_prot);
+            new->rss += n;
+        }
+        if (copy->prot == PROT_NONE)
+        {
+            vma_protect_range(new, copy, copy->start, copy->end);
         }
     }
     return 0;
 }
+
 static int uproc_fork(task_t *task)
 {
     panic_on(task == NULL, "Task is NULL");
     int pid = uproc_alloc_pid();
     task_t *son = pmm->alloc(sizeof(task_t));
+    if (son == NULL)
+    {
+        return -1;
+    }
+    son->pi = pmm->alloc(sizeof(procinfo_t));
+    if (son->pi == NULL || (son->pi->cwd = pmm->alloc(PATH_MAX)) == NULL)
+    {
+        pmm->free(son->pi);
+        pmm->free(son);
+        return -1;
+    }
     son->name = "son";
     son->cpu = -1;
     son->next = NULL;
     son->fence = task->fence;
     kmt->spin_init(&son->lock, son->name);
     son->status = TASK_READY;
-    son->pi = pmm->alloc(sizeof(procinfo_t));
-    son->pi->cwd = pmm->alloc(PATH_MAX);
     son->pi->parent = task;
     son->pi->brk = task->pi->brk;
+    son->pi->vmas = NULL;
+    son->pi->rss = 0;
+    son->pi->ptpages = 1;
+    son->pi->rss_limit = task->pi->rss_limit;
+    son->pi->killed = 0;
+    son->pi->clock_hand = 0;
+    son->pi->ring = NULL;
+    son->pi->traced = task->pi->traced;
     strcpy(son->pi->cwd, task->pi->cwd);
     protect(&son->pi->as);
-    uvmcopy(&task->pi->as, &son->pi->as, UVMEND - UVSTART);
+    procinfo_t *prev = charge(son->pi);
+    int ret = vma_fork(task->pi, son->pi);
+    charge(prev);
+    son->files = ret < 0 ? NULL : fdt->dup(task->files);
+    if (son->files == NULL)
+    {
+        uproc_release(&son->pi->as, son->pi->vmas);
+        pmm->free(son->pi->cwd);
+        pmm->free(son->pi);
+        pmm->free(son);
+        return -1;
+    }
     son->pi->pid = pid;
     son->context = (Context *)(son->stack + STACK_SIZE - sizeof(Context));
     *son->context = *task->context;
     son->context->GPRx = 0;
     son->context->cr3 = son->pi->as.ptr;
     son->context->rsp0 = (uint64_t)son->stack + STACK_SIZE;
-    for (size_t i = 0; i < NOFILE; i++)
-    {
-        if (!task->open_files[i])
-        {
-            continue;
-        }
-        son->open_files[i] = vfs->dup(task->open_files[i]);
-    }
     kmt_add_task(son);
     return pid;
 }
@@ -264,19 +850,629 @@ static int64_t uproc_uptime(task_t *task, struct timespec *ts)
     }
     return -1;
 }
-static void *uproc_mmap(task_t *task, void *addr, int length, int prot, int flags)
+/**
+ * cut @vma in two at @addr, inserting the upper part after it;
+ * returns NULL, leaving @vma whole, when memory runs out
+ */
+static struct vma *vma_split(struct vma *vma, uintptr_t addr)
+{
+    struct vma *tail = pmm->alloc(sizeof(struct vma));
+    if (tail == NULL)
+    {
+        return NULL;
+    }
+    *tail = *vma;
+    tail->start = addr;
+    tail->offset = vma->offset + (addr - vma->start);
+    tail->file = vma->file ? vfs->dup(vma->file) : NULL;
+    vma->end = addr;
+    vma->next = tail;
+    return tail;
+}
+
+/**
+ * whether [@start, @end) is covered by areas without holes
+ */
+static bool vma_covers(procinfo_t *pi, uintptr_t start, uintptr_t end)
+{
+    for (struct vma *vma = pi->vmas; vma && start < end; vma = vma->next)
+    {
+        if (vma->end <= start)
+        {
+            continue;
+        }
+        if (vma->start > start)
+        {
+            return false;
+        }
+        start = vma->end;
+    }
+    return start >= end;
+}
+
+/**
+ * split the areas of @pi at @start and @end so that [@start, @end)
+ * is made of whole areas, the first of them left in @first; returns
+ * -1 when memory runs out (the splits made so far change nothing)
+ */
+static int vma_isolate(procinfo_t *pi, uintptr_t start, uintptr_t end, struct vma **first)
+{
+    *first = NULL;
+    for (struct vma *vma = pi->vmas; vma && vma->start < end; vma = vma->next)
+    {
+        if (vma->end <= start)
+        {
+            continue;
+        }
+        if (vma->start < start && (vma = vma_split(vma, start)) == NULL)
+        {
+            return -1;
+        }
+        if (vma->end > end && vma_split(vma, end) == NULL)
+        {
+            return -1;
+        }
+        *first = *first ? *first : vma;
+    }
+    return 0;
+}
+
+/**
+ * remove [@start, @end) from the areas of @pi,
+ * trimming or splitting the areas that only partly overlap it;
+ * returns -1 when memory for a split runs out
+ */
+static int vma_unmap(procinfo_t *pi, uintptr_t start, uintptr_t end)
+{
+    struct vma **pp = &pi->vmas;
+    while (*pp)
+    {
+        struct vma *vma = *pp;
+        if (vma->end <= start || vma->start >= end)
+        {
+            pp = &vma->next;
+            continue;
+        }
+        uintptr_t lo = vma->start > start ? vma->start : start;
+        uintptr_t hi = vma->end < end ? vma->end : end;
+        if (lo > vma->start && hi < vma->end)
+        {
+            // punching a hole splits the area in two
+            if (vma_split(vma, hi) == NULL)
+            {
+                return -1;
+            }
+            vma_release_range(pi, vma, lo, hi);
+            vma->end = lo;
+            break;
+        }
+        vma_release_range(pi, vma, lo, hi);
+        if (lo > vma->start)
+        {
+            vma->end = lo;
+            pp = &vma->next;
+        }
+        else if (hi < vma->end)
+        {
+            vma->offset += hi - vma->start;
+            vma->start = hi;
+            pp = &vma->next;
+        }
+        else
+        {
+            *pp = vma->next;
+            if (vma->file)
+            {
+                vfs->close(vma->file);
+            }
+            pmm->free(vma);
+        }
+    }
+    // io_uring_enter writes the ring, it must not outlive its mapping
+    uintptr_t ring = (uintptr_t)pi->ring;
+    if (ring && ring < end && ring + IORING_SIZE(pi->ring_entries) > start)
+    {
+        pi->ring = NULL;
+    }
+    return 0;
+}
+
+/**
+ * grow a private anonymous area ending at @start instead of
+ * creating a new one, so repeated sbrk calls keep a single area
+ */
+static bool vma_merge(procinfo_t *pi, uintptr_t start, size_t length, int prot, int flags)
+{
+    if (!(flags & MAP_ANONYMOUS) || (flags & MAP_SHARED))
+    {
+        return false;
+    }
+    for (struct vma *vma = pi->vmas; vma; vma = vma->next)
+    {
+        if (vma->end == start)
+        {
+            if (vma->file || vma->key || vma->prot != prot || vma->flags != flags || vma->advice != MADV_NORMAL)
+            {
+                return false;
+            }
+            if (vma->next && vma->next->start < start + length)
+            {
+                return false;
+            }
+            vma->end = start + length;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void *uproc_mmap(task_t *task, void *addr, size_t length, int prot, int flags, struct file *f, off_t offset)
+{
+    panic_on(task == NULL, "Task is NULL");
+    panic_on(task->pi == NULL, "Task procinfo is NULL");
+    if (length == 0 || offset < 0 || offset % PGSIZE != 0)
+    {
+        return MAP_FAILED;
+    }
+    if (!(flags & (MAP_SHARED | MAP_PRIVATE)))
+    {
+        return MAP_FAILED;
+    }
+    if (!(flags & MAP_ANONYMOUS) && (f == NULL || f->type != FD_FILE || !f->fops->cached))
+    {
+        return MAP_FAILED;
+    }
+    // as in uproc_mprotect, only a writable file may back a writable shared mapping
+    if (!(flags & MAP_ANONYMOUS) && (!f->readable || ((prot & PROT_WRITE) && (flags & MAP_SHARED) && !f->writable)))
+    {
+        return MAP_FAILED;
+    }
+    length = ROUNDUP(length, PGSIZE);
+    uintptr_t start;
+    if (flags & MAP_FIXED)
+    {
+        start = (uintptr_t)addr;
+        if (start % PGSIZE != 0 || start < UVSTART || start + length > UVMEND || start + length < start)
+        {
+            return MAP_FAILED;
+        }
+        if (vma_unmap(task->pi, start, start + length) < 0)
+        {
+            return MAP_FAILED;
+        }
+        if (vma_merge(task->pi, start, length, prot, flags))
+        {
+            return (void *)start;
+        }
+    }
+    else
+    {
+        start = vma_range(task->pi, (uintptr_t)addr, length);
+        if (start == 0)
+        {
+            return MAP_FAILED;
+        }
+    }
+    struct vma *vma = pmm->alloc(sizeof(struct vma));
+    if (vma == NULL)
+    {
+        return MAP_FAILED;
+    }
+    vma->start = start;
+    vma->end = start + length;
+    vma->prot = prot;
+    vma->flags = flags;
+    vma->file = (flags & MAP_ANONYMOUS) ? NULL : vfs->dup(f);
+    vma->offset = (flags & MAP_ANONYMOUS) ? 0 : offset;
+    // private anonymous pages never enter the page cache
+    vma->key = (vma->file || (flags & MAP_SHARED)) ? pgcache->key(vma->file) : 0;
+    vma->advice = MADV_NORMAL;
+    vma_insert(task->pi, vma);
+    return (void *)start;
+}
+
+static int uproc_munmap(task_t *task, void *addr, size_t length)
+{
+    panic_on(task == NULL, "Task is NULL");
+    panic_on(task->pi == NULL, "Task procinfo is NULL");
+    uintptr_t start = (uintptr_t)addr;
+    if (start % PGSIZE != 0 || length == 0)
+    {
+        return -1;
+    }
+    return vma_unmap(task->pi, start, start + ROUNDUP(length, PGSIZE));
+}
+
+/**
+ * map the read-only clock page at VDSO_ADDR; CR0.WP makes kernel
+ * stores through a user pointer fault on it as well, and those end
+ * in uproc_kfault instead of on the one page every process reads
+ */
+static int uproc_vdso(task_t *task)
+{
+    if (uproc_mmap(task, (void *)VDSO_ADDR, PGSIZE, PROT_READ, MAP_SHARED | MAP_ANONYMOUS | MAP_FIXED, NULL, 0) == MAP_FAILED)
+    {
+        return -1;
+    }
+    vma_find(task->pi, VDSO_ADDR)->key = vdso_key;
+    return 0;
+}
+
+/**
+ * tear down an address space detached from its process,
+ * e.g. the old image replaced by execve
+ */
+static void uproc_release(AddrSpace *as, struct vma *vmas)
+{
+    procinfo_t old = {.as = *as, .vmas = vmas};
+    vma_unmap(&old, UVSTART, UVMEND);
+    unprotect(&old.as);
+}
+
+/**
+ * back the whole 2 MiB block around @va with one large page when
+ * it lies inside a private anonymous area and holds no small pages
+ */
+static int vma_fault_large(procinfo_t *pi, struct vma *vma, uintptr_t va, int prot)
+{
+    uintptr_t base = ROUNDDOWN(va, LPGSIZE);
+    if ((vma->flags & MAP_SHARED) || base < vma->start || base + LPGSIZE > vma->end)
+    {
+        return -1;
+    }
+    if (ptewalk(&pi->as, base) != NULL)
+    {
+        return -1;
+    }
+    void *mem = vma_alloc(pi, LPGSIZE / PGSIZE);
+    if (mem == NULL)
+    {
+        return -1;
+    }
+    memset(mem, 0, LPGSIZE);
+    map_large(&pi->as, (void *)base, mem, prot);
+    pi->rss += LPGSIZE / PGSIZE;
+    return 0;
+}
+
+/**
+ * make the page at @va of @vma present, as a @write access would;
+ * the caller has already checked the access against the area.
+ * Returns -1 when the page cannot be installed for lack of memory
+ */
+static int vma_fault_page(procinfo_t *pi, struct vma *vma, uintptr_t va, int write)
+{
+    uint64_t index = (va - vma->start + vma->offset) / PGSIZE;
+    int prot = (vma->prot & PROT_WRITE) ? MMAP_READ | MMAP_WRITE : MMAP_READ;
+    uintptr_t *ptep = ptewalk(&pi->as, va);
+    if (ptep && (*ptep & PTE_P))
+    {
+        // write to a private page still shared with the page cache
+        void *old_pa = (void *)PTE_ADDR(*ptep);
+        struct page *pg = pgcache->lookup(old_pa);
+        if (!write || (vma->flags & MAP_SHARED) || pg == NULL)
+        {
+            return -1;
+        }
+        void *copy = vma_alloc(pi, 1);
+        if (copy == NULL)
+        {
+            return -1;
+        }
+        memcpy(copy, old_pa, PGSIZE);
+        map(&pi->as, (void *)va, NULL, MMAP_NONE);
+        map(&pi->as, (void *)va, copy, prot);
+        pgcache->put(pg);
+        return 0;
+    }
+    if (ptep && (*ptep & PTE_SWAP))
+    {
+        void *mem = vma_alloc(pi, 1);
+        if (mem == NULL)
+        {
+            return -1;
+        }
+        int slot = SWAP_SLOT(*ptep);
+        swapper->in(slot, mem);
+        swapper->free(slot);
+        *ptep = 0;
+        map(&pi->as, (void *)va, mem, prot);
+    }
+    else if (vma->flags & MAP_SHARED)
+    {
+        struct page *pg = pgcache->get(vma->key, index, vma->file);
+        if (pg == NULL)
+        {
+            return -1;
+        }
+        map(&pi->as, (void *)va, pg->pa, prot);
+    }
+    else if (vma->file)
+    {
+        struct page *pg = pgcache->get(vma->key, index, vma->file);
+        if (pg == NULL)
+        {
+            return -1;
+        }
+        if (write)
+        {
+            void *copy = vma_alloc(pi, 1);
+            if (copy == NULL)
+            {
+                pgcache->put(pg);
+                return -1;
+            }
+            memcpy(copy, pg->pa, PGSIZE);
+            pgcache->put(pg);
+            map(&pi->as, (void *)va, copy, prot);
+        }
+        else
+        {
+            // read-only until the first write copies it
+            map(&pi->as, (void *)va, pg->pa, MMAP_READ);
+        }
+    }
+    else if (vma_fault_large(pi, vma, va, prot) == 0)
+    {
+        return 0;
+    }
+    else
+    {
+        void *mem = vma_alloc(pi, 1);
+        if (mem == NULL)
+        {
+            return -1;
+        }
+        memset(mem, 0, PGSIZE);
+        map(&pi->as, (void *)va, mem, prot);
+    }
+    pi->rss++;
+    return 0;
+}
+
+static int vma_fault(procinfo_t *pi, struct vma *vma, uintptr_t va, int write)
+{
+    procinfo_t *prev = charge(pi);
+    int ret = vma_fault_page(pi, vma, va, write);
+    charge(prev);
+    return ret;
+}
+
+/**
+ * read fault the pages of [@lo, @hi) of @vma that have contents
+ * elsewhere (in the file or in swap) but no mapping yet; stops
+ * at the first one that cannot be brought in
+ */
+static void vma_prefault(procinfo_t *pi, struct vma *vma, uintptr_t lo, uintptr_t hi)
+{
+    if (vma->prot == PROT_NONE)
+    {
+        return;
+    }
+    for (uintptr_t va = lo; va < hi; va += PGSIZE)
+    {
+        uintptr_t *ptep = ptewalk(&pi->as, va);
+        if (ptep && (*ptep & PTE_P))
+        {
+            continue;
+        }
+        bool swapped = ptep && (*ptep & PTE_SWAP);
+        if (vma->file == NULL && !swapped)
+        {
+            // untouched anonymous memory has nothing to bring in
+            continue;
+        }
+        if (vma_fault(pi, vma, va, 0) < 0)
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * resolve a fault on a lazily mapped area; returns -1 when
+ * @addr is not covered by any area or the access is not allowed,
+ * -2 when memory (or the resident limit of @task) ran out
+ */
+static int uproc_pgfault(task_t *task, uintptr_t addr, int write)
 {
     panic_on(task == NULL, "Task is NULL");
     panic_on(task->pi == NULL, "Task procinfo is NULL");
-    if (addr == NULL)
+    struct vma *vma = vma_find(task->pi, addr);
+    if (vma == NULL)
+    {
+        vma = vma_grow(task->pi, addr);
+    }
+    if (vma == NULL)
+    {
+        return -1;
+    }
+    if (write ? !(vma->prot & PROT_WRITE) : !(vma->prot & (PROT_READ | PROT_EXEC)))
     {
-        addr = (void *)UVSTART;
+        return -1;
     }
-    if (length <= 0)
+    if (vma_fault(task->pi, vma, ROUNDDOWN(addr, PGSIZE), write) == 0)
+    {
+        if (vma->advice == MADV_SEQUENTIAL && vma->file)
+        {
+            uintptr_t next = ROUNDDOWN(addr, PGSIZE) + PGSIZE;
+            uintptr_t end = next + VMA_READAHEAD * PGSIZE;
+            vma_prefault(task->pi, vma, next, end < vma->end ? end : vma->end);
+        }
+        return 0;
+    }
+    // over its own resident limit the process cannot make progress
+    procinfo_t *pi = task->pi;
+    return pi->rss_limit && pi->rss >= pi->rss_limit ? -1 : -2;
+}
+
+/**
+ * a syscall touched user memory at @addr that cannot be provided
+ * (out of memory, or no mapping allows the access), and a syscall
+ * cannot be unwound half way: the process is killed and the access
+ * goes on against a scratch page, zeros for reads and a sink for
+ * writes, until the syscall returns and the process exits.
+ * returns -1 for an address outside user space
+ */
+static int uproc_kfault(task_t *task, uintptr_t addr, int write)
+{
+    panic_on(task == NULL, "Task is NULL");
+    panic_on(task->pi == NULL, "Task procinfo is NULL");
+    procinfo_t *pi = task->pi;
+    uintptr_t va = ROUNDDOWN(addr, PGSIZE);
+    if (va < UVSTART || va >= UVMEND)
+    {
+        return -1;
+    }
+    pi->killed = 1;
+    struct vma *vma = vma_find(pi, va);
+    if (vma)
+    {
+        vma_release_range(pi, vma, va, va + PGSIZE);
+        pi->rss++;
+    }
+    struct page *pg = scratch[write != 0];
+    pgcache->dup(pg);
+    procinfo_t *prev = charge(pi);
+    map(&pi->as, (void *)va, pg->pa, write ? MMAP_READ | MMAP_WRITE : MMAP_READ);
+    charge(prev);
+    return 0;
+}
+
+/**
+ * change the protection of the whole pages of [@addr, @addr+@length),
+ * which must be mapped throughout
+ */
+static int uproc_mprotect(task_t *task, void *addr, size_t length, int prot)
+{
+    panic_on(task == NULL, "Task is NULL");
+    panic_on(task->pi == NULL, "Task procinfo is NULL");
+    procinfo_t *pi = task->pi;
+    uintptr_t start = (uintptr_t)addr;
+    uintptr_t end = start + ROUNDUP(length, PGSIZE);
+    if (start % PGSIZE != 0 || (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) || !vma_covers(pi, start, end))
+    {
+        return -1;
+    }
+    for (struct vma *vma = pi->vmas; vma && vma->start < end; vma = vma->next)
+    {
+        // a shared file mapping may only be made writable through a writable file
+        if (vma->end > start && (prot & PROT_WRITE) && (vma->flags & MAP_SHARED) && vma->file && !vma->file->writable)
+        {
+            return -1;
+        }
+        // the clock page is shared by every process
+        if (vma->end > start && (prot & PROT_WRITE) && vma->key == vdso_key)
+        {
+            return -1;
+        }
+    }
+    struct vma *first;
+    if (vma_isolate(pi, start, end, &first) < 0)
+    {
+        return -1;
+    }
+    for (struct vma *vma = first; vma && vma->start < end; vma = vma->next)
+    {
+        if (vma->prot != prot)
+        {
+            vma->prot = prot;
+            vma_protect_range(pi, vma, vma->start, vma->end);
+        }
+    }
+    return 0;
+}
+
+/**
+ * act on advice about the use of [@addr, @addr+@length), which must be
+ * mapped throughout: MADV_DONTNEED drops the pages (private ones read
+ * back as zeros or from the file), MADV_WILLNEED brings in file and
+ * swapped out pages ahead of use, the access patterns are recorded
+ * for the fault path
+ */
+static int uproc_madvise(task_t *task, void *addr, size_t length, int advice)
+{
+    panic_on(task == NULL, "Task is NULL");
+    panic_on(task->pi == NULL, "Task procinfo is NULL");
+    procinfo_t *pi = task->pi;
+    uintptr_t start = (uintptr_t)addr;
+    uintptr_t end = start + ROUNDUP(length, PGSIZE);
+    if (start % PGSIZE != 0 || !vma_covers(pi, start, end))
+    {
+        return -1;
+    }
+    struct vma *first;
+    switch (advice)
+    {
+    case MADV_NORMAL:
+    case MADV_RANDOM:
+    case MADV_SEQUENTIAL:
+        if (vma_isolate(pi, start, end, &first) < 0)
+        {
+            return -1;
+        }
+        for (struct vma *vma = first; vma && vma->start < end; vma = vma->next)
+        {
+            vma->advice = advice;
+        }
+        return 0;
+    case MADV_WILLNEED:
+    case MADV_DONTNEED:
+        for (struct vma *vma = pi->vmas; vma && vma->start < end; vma = vma->next)
+        {
+            uintptr_t lo = vma->start > start ? vma->start : start;
+            uintptr_t hi = vma->end < end ? vma->end : end;
+            if (lo >= hi)
+            {
+                continue;
+            }
+            if (advice == MADV_WILLNEED)
+            {
+                vma_prefault(pi, vma, lo, hi);
+            }
+            else if (vma->file || !(vma->flags & MAP_SHARED))
+            {
+                // shared anonymous pages only live in the page cache: keep them
+                vma_release_range(pi, vma, lo, hi);
+            }
+        }
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+/**
+ * kernel address of user byte @addr, backed by a page private to
+ * @task (copied out of the page cache if needed) whatever the
+ * protection of its area; used to fill images built by the kernel
+ */
+static void *uproc_upage(task_t *task, uintptr_t addr)
+{
+    panic_on(task == NULL, "Task is NULL");
+    panic_on(task->pi == NULL, "Task procinfo is NULL");
+    procinfo_t *pi = task->pi;
+    struct vma *vma = vma_find(pi, addr);
+    if (vma == NULL)
     {
         return NULL;
     }
-    return NULL;
+    uintptr_t va = ROUNDDOWN(addr, PGSIZE);
+    uintptr_t *ptep = ptewalk(&pi->as, va);
+    bool present = ptep && (*ptep & PTE_P);
+    if (!present || (!(vma->flags & MAP_SHARED) && pgcache->lookup((void *)PTE_ADDR(*ptep))))
+    {
+        if (vma_fault(pi, vma, va, 1) < 0)
+        {
+            return NULL;
+        }
+        ptep = ptewalk(&pi->as, va);
+    }
+    if (*ptep & PTE_PS)
+    {
+        return (void *)(PTE_ADDR(*ptep) + addr % LPGSIZE);
+    }
+    return (void *)(PTE_ADDR(*ptep) + (addr - va));
 }
 // Define the uproc module structure with pointers to implemented functions
 MODULE_DEF(uproc) = {
@@ -289,4 +1485,12 @@ MODULE_DEF(uproc) = {
     .sleep = uproc_sleep,
     .uptime = uproc_uptime,
     .getppid = uproc_getppid,
-    .mmap = uproc_mmap};
+    .mmap = uproc_mmap,
+    .vdso = uproc_vdso,
+    .munmap = uproc_munmap,
+    .mprotect = uproc_mprotect,
+    .madvise = uproc_madvise,
+    .pgfault = uproc_pgfault,
+    .kfault = uproc_kfault,
+    .upage = uproc_upage,
+    .release = uproc_release};
@@ -1,36 +1,77 @@
 #include <common.h>
 #include <vfs.h>
-#include <ext4.h>
-static struct file_table ftable;
+#include <pgcache.h>
+#define FILE_ADDR_MASK ((1ULL << 48) - 1)
+// Free struct files, linked through f->ptr. The low 48 bits hold the
+// head, the high 16 bits a generation count bumped by every update so
+// that a compare-and-swap racing with a pop and re-push of the same
+// head fails instead of corrupting the list.
+static uint64_t file_free;
+
+static void file_push(struct file *f)
+{
+	uint64_t old, new;
+	do
+	{
+		old = file_free;
+		f->ptr = (void *)(old & FILE_ADDR_MASK);
+		new = (uintptr_t)f | ((old & ~FILE_ADDR_MASK) + (1ULL << 48));
+	} while (!__sync_bool_compare_and_swap(&file_free, old, new));
+}
 
-static struct file *filealloc(void)
+/**
+ * pop a free struct file; reading the link of a head that was taken
+ * meanwhile is harmless since slab pages are never given back
+ */
+static struct file *file_pop(void)
 {
+	uint64_t old, new;
 	struct file *f;
-	kmt->spin_lock(&ftable.lock);
-	for (f = ftable.file; f < ftable.file + NFILE; f++)
-	{
-		if (f->ref == 0)
-		{
-			f->ref = 1;
-			kmt->spin_init(&f->lock, "file_lock");
-			kmt->spin_unlock(&ftable.lock);
-			return f;
-		}
-	}
-	kmt->spin_unlock(&ftable.lock);
-	return NULL;
+	do
+	{
+		old = file_free;
+		f = (struct file *)(old & FILE_ADDR_MASK);
+		if (f == NULL)
+			return NULL;
+		new = (uintptr_t)f->ptr | ((old & ~FILE_ADDR_MASK) + (1ULL << 48));
+	} while (!__sync_bool_compare_and_swap(&file_free, old, new));
+	return f;
+}
+
+static struct file *filealloc(void)
+{
+	struct file *f = file_pop();
+	if (f == NULL)
+	{
+		// carve a fresh page, keep the first object and free the rest
+		char *slab = pmm->alloc(PGSIZE);
+		if (slab == NULL)
+			return NULL;
+		for (int i = 1; i < PGSIZE / sizeof(struct file); i++)
+			file_push((struct file *)slab + i);
+		f = (struct file *)slab;
+	}
+	memset(f, 0, sizeof(struct file));
+	f->ref = 1;
+	kmt->spin_init(&f->lock, "file_lock");
+	return f;
 }
 
 static struct file *filedup(struct file *f)
 {
-	kmt->spin_lock(&ftable.lock);
-	if (f->ref < 1)
+	if (__sync_fetch_and_add(&f->ref, 1) < 1)
 		panic("filedup");
-	f->ref++;
-	kmt->spin_unlock(&ftable.lock);
 	return f;
 }
 
+static char *pathdup(const char *path)
+{
+	char *p = pmm->alloc(strlen(path) + 1);
+	if (p)
+		strcpy(p, path);
+	return p;
+}
+
 void pipeclose(struct pipe *pi, int writable)
 {
 	kmt->spin_lock(&pi->lock);
@@ -44,6 +85,7 @@ void pipeclose(struct pipe *pi, int writable)
 		pi->readopen = 0;
 		kmt->wakeup(&pi->nwrite);
 	}
+	poll->wake(&pi->wq);
 	if (pi->readopen == 0 && pi->writeopen == 0)
 	{
 		kmt->spin_unlock(&pi->lock);
@@ -53,100 +95,137 @@ void pipeclose(struct pipe *pi, int writable)
 		kmt->spin_unlock(&pi->lock);
 }
 
+static void mount_put(struct mount *m);
+
 static void fileclose(struct file *f)
 {
 	struct file ff;
-	kmt->spin_lock(&ftable.lock);
-	if (f->ref < 1)
+	int ref = __sync_sub_and_fetch(&f->ref, 1);
+	if (ref < 0)
 		panic("fileclose");
-	if (--f->ref > 0)
-	{
-		kmt->spin_unlock(&ftable.lock);
+	if (ref > 0)
 		return;
-	}
 	ff = *f;
-	f->ref = 0;
 	f->type = FD_NONE;
-	kmt->spin_unlock(&ftable.lock);
+	file_push(f);
+	pmm->free(ff.path);
 
 	if (ff.type == FD_PIPE)
 	{
 		pipeclose((struct pipe *)ff.ptr, ff.writable);
 	}
-	else if (ff.type == FD_FILE)
+	else if (ff.fops)
 	{
-		ext4_fclose(ff.ptr);
-		pmm->free(ff.ptr);
+		ff.fops->close(&ff);
+		mount_put(ff.mnt);
 	}
-	else if (ff.type == FD_DIR)
+	else if (ff.type == FD_EPOLL)
 	{
-		ext4_dir_close(ff.ptr);
-		pmm->free(ff.ptr);
+		poll->epoll_release(ff.ptr);
 	}
 }
 
-static int filestat(struct file *f, struct stat *st)
+/**
+ * readiness of @f as POLL* bits, hooking @pt on the queue that will
+ * be woken when it changes; regular files and directories never block
+ */
+static int filepoll(struct file *f, struct poll_table *pt)
 {
-	if (f->type == FD_FILE)
+	int mask = 0;
+	if (f->type == FD_PIPE)
 	{
-
-		ext4_file *ef = (ext4_file *)f->ptr;
-		st->st_mode = S_IFREG;
-		st->st_ino = ef->inode;
-		st->st_size = ef->fsize;
-		st->st_nlink = ef->refctr;
-		return 0;
+		// read without the pipe lock, the wakers hold it
+		struct pipe *pi = (struct pipe *)f->ptr;
+		poll->wait(&pi->wq, pt);
+		if (f->readable && (pi->nread != pi->nwrite || !pi->writeopen))
+			mask |= POLLIN;
+		if (f->readable && !pi->writeopen)
+			mask |= POLLHUP;
+		if (f->writable && pi->nwrite != pi->nread + PIPESIZE)
+			mask |= POLLOUT;
+		if (f->writable && !pi->readopen)
+			mask |= POLLERR;
+		return mask;
 	}
-	else if (f->type == FD_DIR)
+	if (f->type == FD_EPOLL)
 	{
-		ext4_dir *d = (ext4_dir *)f->ptr;
-		st->st_mode = S_IFDIR;
-		st->st_ino = d->f.inode;
-		st->st_size = d->f.fsize;
-		st->st_nlink = 2; // Directories typically have a link count of at least 2 (., ..)
-		return 0;
+		return poll->epoll_poll(f, pt);
 	}
+	if (f->type == FD_DEVICE)
+	{
+		device_t *device = (device_t *)f->ptr;
+		if (device->ops->poll)
+			mask = device->ops->poll(device, pt);
+		else
+			mask = POLLIN | POLLOUT;
+		return mask & ((f->readable ? POLLIN : 0) | (f->writable ? POLLOUT : 0) | POLLERR | POLLHUP);
+	}
+	return (f->readable ? POLLIN : 0) | (f->writable ? POLLOUT : 0);
+}
+
+static int filestat(struct file *f, struct stat *st)
+{
+	if (f->fops && f->fops->stat)
+		return f->fops->stat(f, st);
 	return -1;
 }
 
+/**
+ * pack one entry as a variable-length dirent, refusing it once it
+ * no longer fits; @next_off is the cookie to resume after it
+ */
+int dir_emit(struct dir_context *ctx, const char *name, int len, uint32_t ino, uint8_t type, uint64_t next_off)
+{
+	size_t reclen = ROUNDUP(offsetof(struct dirent, d_name) + len + 1, 8);
+	if (reclen > ctx->left)
+		return 1;
+	struct dirent *d = ctx->pos;
+	d->d_ino = ino;
+	d->d_off = next_off;
+	d->d_reclen = reclen;
+	d->d_type = type;
+	memcpy(d->d_name, name, len);
+	d->d_name[len] = '\0';
+	ctx->pos = (char *)ctx->pos + reclen;
+	ctx->left -= reclen;
+	return 0;
+}
+
+/**
+ * getdents64 of directory @f, packed into a kernel copy first: a
+ * fault on @buf must not happen inside the file system
+ */
+static ssize_t filereaddir(struct file *f, void *buf, size_t n)
+{
+	void *kbuf = pmm->alloc(n);
+	if (kbuf == NULL)
+		return -1;
+	struct dir_context ctx = {.pos = kbuf, .left = n};
+	int more = f->fops->readdir(f, &ctx);
+	ssize_t r = more < 0 ? -1 : (char *)ctx.pos - (char *)kbuf;
+	if (r > 0)
+		memcpy(buf, kbuf, r);
+	pmm->free(kbuf);
+	if (r == 0 && more > 0)
+		return -1; // Buffer too small for the next entry
+	return r;
+}
+
 static ssize_t fileread(struct file *f, void *buf, size_t n)
 {
 	ssize_t r = -1;
 	if (!f->readable)
 		return -1;
-	if (f->type == FD_FILE)
+	if (f->fops)
 	{
-		size_t bytes_read;
-		if (ext4_fread((ext4_file *)f->ptr, buf, n, &bytes_read) == EOK)
-		{
-			r = bytes_read;
-		}
-	}
-	else if (f->type == FD_DIR)
-	{
-		// Directory reading logic
-		struct dirent *de = (struct dirent *)buf;
-		if (n < sizeof(*de))
-			return -1; // Buffer too small
-
-		ext4_dir *dir = (ext4_dir *)f->ptr;
-		const ext4_direntry *entry = ext4_dir_entry_next(dir);
-		if (!entry)
-			return 0; // End of directory
-		de->d_ino = entry->inode;
-		de->d_off = dir->next_off;
-		de->d_reclen = sizeof(struct dirent);
-		de->d_type = entry->inode_type;
-		strncpy(de->d_name, (const char *)entry->name, sizeof(de->d_name) - 1);
-		de->d_name[sizeof(de->d_name) - 1] = '\0';
-		r = sizeof(struct dirent);
+		if (f->fops->read)
+			r = f->fops->read(f, buf, n);
+		else if (f->fops->readdir)
+			r = filereaddir(f, buf, n);
 	}
 	else if (f->type == FD_DEVICE)
 	{
 		device_t *device = (device_t *)f->ptr;
-		int value = 0;
-		while (atomic_xchg(&value, ((tty_t *)(device->ptr))->cooked.value) == 0)
-			;
 		r = device->ops->read(device, 0, buf, n);
 	}
 	else
@@ -164,13 +243,10 @@ static ssize_t filewrite(struct file *f, const void *buf, size_t n)
 	if (!f->writable)
 		return -1;
 
-	if (f->type == FD_FILE)
+	if (f->fops)
 	{
-		size_t bytes_written;
-		if (ext4_fwrite((ext4_file *)f->ptr, buf, n, &bytes_written) == EOK)
-		{
-			r = bytes_written;
-		}
+		if (f->fops->write)
+			r = f->fops->write(f, buf, n);
 	}
 	else if (f->type == FD_DEVICE)
 	{
@@ -199,6 +275,7 @@ int pipealloc(struct file **f0, struct file **f1)
 	pi->nwrite = 0;
 	pi->nread = 0;
 	kmt->spin_init(&pi->lock, "pipe");
+	poll->queue_init(&pi->wq);
 	(*f0)->ref=1;
 	(*f0)->type = FD_PIPE;
 	(*f0)->readable = 1;
@@ -236,6 +313,7 @@ int pipewrite(struct pipe *pi, const void *buf, int n)
 		if (pi->nwrite == pi->nread + PIPESIZE)
 		{ // DOC: pipewrite-full
 			kmt->wakeup(&pi->nread);
+			poll->wake(&pi->wq);
 			kmt->sleep(&pi->nwrite, &pi->lock);
 		}
 		else
@@ -245,6 +323,7 @@ int pipewrite(struct pipe *pi, const void *buf, int n)
 		}
 	}
 	kmt->wakeup(&pi->nread);
+	poll->wake(&pi->wq);
 	kmt->spin_unlock(&pi->lock);
 	return i;
 }
@@ -266,168 +345,181 @@ int piperead(struct pipe *pi, const void *buf, int n)
 		((char *)buf)[i] = pi->data[pi->nread++ % PIPESIZE];
 	}
 	kmt->wakeup(&pi->nwrite); // DOC: piperead-wakeup
+	poll->wake(&pi->wq);
 	kmt->spin_unlock(&pi->lock);
 	return i;
 }
 
-int vfs_link(const char *oldpath, const char *newpath)
-{
-	for (size_t i = 0; i < NFILE; i++)
-	{
-		if (strcmp(ftable.file[i].path, oldpath) == 0)
-		{
-			ftable.file[i].ref++;
-			break;
-		}
-	}
-	int ret = ext4_flink(oldpath, newpath);
-	return (ret == EOK) ? VFS_SUCCESS : VFS_ERROR;
-}
-
-int vfs_unlink(const char *path)
+static const struct fs_ops *filesystems[] = {&ext4_fs_ops, &tmpfs_fs_ops};
+static struct mount mounts[VFS_MOUNTS];
+static spinlock_t mount_lock;
+static uint32_t mount_ids; // the id of the next mount
+
+/**
+ * the mount whose mount point is the longest prefix of @path ending
+ * on a component boundary, pinned until mount_put; @rel is left at
+ * the rest of @path, without its leading slash
+ */
+static struct mount *mount_get(const char *path, const char **rel)
 {
-	for (size_t i = 0; i < NFILE; i++)
-	{
-		if (strcmp(ftable.file[i].path, path) == 0)
-		{
-			ftable.file[i].ref--;
-			break;
-		}
+	struct mount *best = NULL;
+	kmt->spin_lock(&mount_lock);
+	for (int i = 0; i < VFS_MOUNTS; i++)
+	{
+		struct mount *m = &mounts[i];
+		if (m->path && (best == NULL || m->len > best->len) && strncmp(path, m->path, m->len) == 0 &&
+			(m->len == 1 || path[m->len] == '\0' || path[m->len] == '/'))
+			best = m;
+	}
+	if (best && best->going)
+		best = NULL;
+	if (best)
+		best->ref++;
+	kmt->spin_unlock(&mount_lock);
+	if (best)
+	{
+		for (*rel = path + best->len; **rel == '/'; (*rel)++)
+			;
 	}
-	int ret = ext4_fremove(path);
-	return (ret == EOK) ? VFS_SUCCESS : VFS_ERROR;
+	return best;
 }
 
-static struct ext4_blockdev_iface bi;
-static struct ext4_blockdev bd;
-static uint8_t block_buffer[4096];
-
-static int blockdev_open(struct ext4_blockdev *bdev) { return EOK; }
-static int blockdev_close(struct ext4_blockdev *bdev) { return EOK; }
-
-static int blockdev_bread(struct ext4_blockdev *bdev, void *buf, uint64_t blk_id, uint32_t blk_cnt)
+static void mount_put(struct mount *m)
 {
-	panic_on(!buf, "no buf");
-	size_t offset = blk_id * bdev->bdif->ph_bsize;
-	int count = blk_cnt * bdev->bdif->ph_bsize;
-	device_t *dev = (device_t *)bdev->bdif->p_user;
-	dev->ops->read(dev, offset, buf, count);
-	return EOK;
+	__sync_fetch_and_sub(&m->ref, 1);
 }
 
-static int blockdev_bwrite(struct ext4_blockdev *bdev, const void *buf, uint64_t blk_id, uint32_t blk_cnt)
+int vfs_link(const char *oldpath, const char *newpath)
 {
-	panic_on(!buf, "no buf");
-	size_t offset = blk_id * bdev->bdif->ph_bsize;
-	int count = blk_cnt * bdev->bdif->ph_bsize;
-	device_t *dev = (device_t *)bdev->bdif->p_user;
-	dev->ops->write(dev, offset, buf, count);
-	return EOK;
+	const char *orel, *nrel;
+	struct mount *om = mount_get(oldpath, &orel);
+	struct mount *nm = mount_get(newpath, &nrel);
+	// no links across filesystems
+	int ret = (om && om == nm && om->ops->iops->link) ? om->ops->iops->link(om, orel, nrel) : VFS_ERROR;
+	if (om)
+		mount_put(om);
+	if (nm)
+		mount_put(nm);
+	return ret < 0 ? VFS_ERROR : VFS_SUCCESS;
 }
 
-static int blockdev_lock(struct ext4_blockdev *bdev)
+int vfs_unlink(const char *path)
 {
-	return EOK;
+	const char *rel;
+	struct mount *m = mount_get(path, &rel);
+	if (m == NULL)
+		return VFS_ERROR;
+	int ret = m->ops->iops->unlink ? m->ops->iops->unlink(m, rel) : VFS_ERROR;
+	mount_put(m);
+	return ret < 0 ? VFS_ERROR : VFS_SUCCESS;
 }
-static int blockdev_unlock(struct ext4_blockdev *bdev) { return EOK; }
 
 void vfs_init(void)
 {
-	kmt->spin_init(&ftable.lock, "ftable");
-	device_t *sda = dev->lookup("sda");
-	bi.open = blockdev_open;
-	bi.close = blockdev_close;
-	bi.bread = blockdev_bread;
-	bi.bwrite = blockdev_bwrite;
-	bi.lock = blockdev_lock;
-	bi.unlock = blockdev_unlock;
-	bi.ph_bsize = 4096;
-	bi.ph_bbuf = block_buffer;
-	bi.ph_refctr = 1;
-	bi.p_user = sda;
-	bi.ph_bcnt = ((sd_t *)sda->ptr)->blkcnt / bi.ph_bsize * ((sd_t *)sda->ptr)->blksz;
-	bd.bdif = &bi;
-	bd.part_size = bd.bdif->ph_bcnt * (uint64_t)bd.bdif->ph_bsize;
-	vfs->mount("disk", "/", "ext4", 0, NULL);
+	kmt->spin_init(&mount_lock, "mount_lock");
+	for (int i = 0; i < sizeof(filesystems) / sizeof(filesystems[0]); i++)
+	{
+		if (filesystems[i]->init)
+			filesystems[i]->init();
+	}
+	dcache->init();
+	panic_on(vfs->mount("sda", "/", "ext4", 0, NULL) != VFS_SUCCESS, "Failed to mount ext4 filesystem");
+	if (vfs->mount("tmpfs", "/tmp", "tmpfs", 0, NULL) != VFS_SUCCESS)
+		printf("VFS: cannot mount tmpfs on /tmp\n");
 }
 
 int vfs_mkdir(const char *pathname)
 {
-	// in fact,its performance is not the same as the mkdir in linux
-	int ret = ext4_dir_mk(pathname);
-	return (ret == EOK) ? VFS_SUCCESS : VFS_ERROR;
+	const char *rel;
+	struct mount *m = mount_get(pathname, &rel);
+	if (m == NULL)
+		return VFS_ERROR;
+	int ret = m->ops->iops->mkdir ? m->ops->iops->mkdir(m, rel) : VFS_ERROR;
+	mount_put(m);
+	return ret < 0 ? VFS_ERROR : VFS_SUCCESS;
 }
 
+/**
+ * mount a filesystem of type @fs_type from @dev_name on @mount_point:
+ * the root when nothing is mounted yet, an existing directory that is
+ * not a mount point already otherwise
+ */
 int vfs_mount(const char *dev_name, const char *mount_point, const char *fs_type, int flags, void *data)
 {
-	int ret = ext4_device_register(&bd, dev_name);
-	panic_on(ret != EOK, "Failed to register ext4 device");
-	ret = ext4_mount(dev_name, mount_point, false);
-	panic_on(ret != EOK, "Failed to mount ext4 filesystem");
-	return VFS_SUCCESS;
-}
-
-struct file *vfs_open(const char *pathname, int flags)
-{
-	struct file *f;
-	ext4_file *ef;
-	ext4_dir *d;
-	if ((f = filealloc()) == NULL)
+	struct mount m = {.len = strlen(mount_point)};
+	for (int i = 0; i < sizeof(filesystems) / sizeof(filesystems[0]); i++)
 	{
-		return NULL;
+		if (strcmp(filesystems[i]->name, fs_type) == 0)
+			m.ops = filesystems[i];
 	}
-	d = pmm->alloc(sizeof(ext4_dir));
-	if (!d)
+	if (m.ops == NULL)
+		return VFS_ERROR;
+	if (strcmp(mount_point, "/") != 0)
 	{
-		fileclose(f);
-		return NULL;
+		struct file *f = vfs->open(mount_point, O_RDONLY | O_DIRECTORY);
+		bool isdir = f && f->type == FD_DIR;
+		if (f)
+			fileclose(f);
+		if (!isdir)
+			return VFS_ERROR;
 	}
-	if (ext4_dir_open(d, pathname) == EOK)
+	if ((m.path = pathdup(mount_point)) == NULL || m.ops->mount(&m, dev_name) != VFS_SUCCESS)
 	{
-		strcpy(f->path, pathname);
-		f->type = FD_DIR;
-		f->ptr = d;
-		f->readable = !(flags & O_WRONLY);
-		f->writable = (flags & O_WRONLY) || (flags & O_RDWR);
-		f->off = 0;
-		return f;
+		pmm->free(m.path);
+		return VFS_ERROR;
 	}
-	pmm->free(d);
-	const char *mode = "r";
-	if (flags & O_WRONLY)
+	struct mount *slot = NULL;
+	kmt->spin_lock(&mount_lock);
+	for (int i = 0; i < VFS_MOUNTS; i++)
 	{
-		mode = (flags & O_APPEND) ? "a" : "w";
+		if (mounts[i].path && strcmp(mounts[i].path, mount_point) == 0)
+		{
+			slot = NULL;
+			break;
+		}
+		if (mounts[i].path == NULL && slot == NULL)
+			slot = &mounts[i];
 	}
-	else if (flags & O_RDWR)
+	if (slot)
 	{
-		if (flags & O_APPEND)
-			mode = "a+";
-		else if (flags & O_TRUNC)
-			mode = "w+";
-		else
-			mode = "r+";
+		m.id = mount_ids++;
+		*slot = m;
 	}
+	kmt->spin_unlock(&mount_lock);
+	if (slot)
+		return VFS_SUCCESS;
+	m.ops->umount(&m);
+	pmm->free(m.path);
+	return VFS_ERROR;
+}
 
-	ef = pmm->alloc(sizeof(ext4_file));
-	if (!ef)
+struct file *vfs_open(const char *pathname, int flags)
+{
+	struct file *f;
+	const char *rel;
+	struct mount *m = mount_get(pathname, &rel);
+	if (m == NULL)
 	{
-		fileclose(f);
 		return NULL;
 	}
-	if (ext4_fopen(ef, pathname, mode) == EOK)
+	if ((f = filealloc()) == NULL)
 	{
-		strcpy(f->path, pathname);
-		f->ref = ef->refctr + 1;
-		f->type = FD_FILE;
-		f->ptr = ef;
-		f->readable = !(flags & O_WRONLY);
-		f->writable = (flags & O_WRONLY) || (flags & O_RDWR);
-		f->off = 0;
-		return f;
+		mount_put(m);
+		return NULL;
 	}
-	pmm->free(ef);
-	fileclose(f);
-	return NULL;
+	// the file keeps the mount pinned until it is closed
+	f->mnt = m;
+	if (m->ops->iops->open(m, f, rel, flags) != VFS_SUCCESS)
+	{
+		mount_put(m);
+		fileclose(f);
+		return NULL;
+	}
+	f->path = pathdup(pathname);
+	f->readable = !(flags & O_WRONLY);
+	f->writable = (flags & O_WRONLY) || (flags & O_RDWR);
+	f->off = 0;
+	return f;
 }
 
 void vfs_close(struct file *f)
@@ -435,17 +527,26 @@ void vfs_close(struct file *f)
 	fileclose(f);
 }
 
-ssize_t vfs_read(struct file *f, void *buf, size_t count)
+/**
+ * read into the kernel buffer @kbuf at the file position, under the
+ * file lock unless @f is a device
+ */
+static ssize_t kread(struct file *f, void *kbuf, size_t count)
 {
-	int nread;
+	ssize_t nread;
+	if (f->type == FD_DEVICE)
+	{
+		// the driver may block and has its own lock, the file has no state
+		return fileread(f, kbuf, count);
+	}
 	kmt->spin_lock(&f->lock);
-	if (f->type == FD_FILE || f->type == FD_DIR || f->type == FD_DEVICE)
+	if (f->fops || f->type == FD_EPOLL)
 	{
-		nread = fileread(f, buf, count);
+		nread = fileread(f, kbuf, count);
 	}
 	else if (f->type == FD_PIPE)
 	{
-		nread = piperead((struct pipe *)f->ptr, buf, count);
+		nread = piperead((struct pipe *)f->ptr, kbuf, count);
 	}
 	else
 	{
@@ -455,17 +556,17 @@ ssize_t vfs_read(struct file *f, void *buf, size_t count)
 	return nread;
 }
 
-ssize_t vfs_write(struct file *f, const void *buf, size_t count)
+static ssize_t kwrite(struct file *f, const void *kbuf, size_t count)
 {
-	int nwrite;
+	ssize_t nwrite;
 	kmt->spin_lock(&f->lock);
-	if (f->type == FD_FILE || f->type == FD_DIR || f->type == FD_DEVICE)
+	if (f->fops || f->type == FD_DEVICE || f->type == FD_EPOLL)
 	{
-		nwrite = filewrite(f, buf, count);
+		nwrite = filewrite(f, kbuf, count);
 	}
 	else if (f->type == FD_PIPE)
 	{
-		nwrite = pipewrite((struct pipe *)f->ptr, buf, count);
+		nwrite = pipewrite((struct pipe *)f->ptr, kbuf, count);
 	}
 	else
 	{
@@ -476,23 +577,233 @@ ssize_t vfs_write(struct file *f, const void *buf, size_t count)
 	return nwrite;
 }
 
+/**
+ * copy @n bytes between @kbuf and @iov, starting @skip bytes into it
+ */
+static void iov_copy(const struct iovec *iov, int iovcnt, size_t skip, void *kbuf, size_t n, bool to_iov)
+{
+	for (int i = 0; i < iovcnt && n > 0; i++)
+	{
+		if (skip >= iov[i].iov_len)
+		{
+			skip -= iov[i].iov_len;
+			continue;
+		}
+		size_t len = iov[i].iov_len - skip < n ? iov[i].iov_len - skip : n;
+		if (to_iov)
+			memcpy((char *)iov[i].iov_base + skip, kbuf, len);
+		else
+			memcpy(kbuf, (char *)iov[i].iov_base + skip, len);
+		kbuf = (char *)kbuf + len;
+		n -= len;
+		skip = 0;
+	}
+}
+
+static size_t iov_length(const struct iovec *iov, int iovcnt)
+{
+	size_t len = 0;
+	for (int i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	return len;
+}
+
+/**
+ * scatter into @iov, stopping at the first short transfer. the file
+ * is read into a kernel buffer, VFS_COPY_CHUNK at a time under the
+ * file lock, and copied out with the lock dropped: user memory may
+ * fault, and a fault may swap or reclaim
+ */
+ssize_t vfs_readv(struct file *f, const struct iovec *iov, int iovcnt)
+{
+	size_t len = iov_length(iov, iovcnt);
+	if (len == 0)
+		return 0;
+	char *kbuf = pmm->alloc(len < VFS_COPY_CHUNK ? len : VFS_COPY_CHUNK);
+	if (kbuf == NULL)
+		return -1;
+	ssize_t total = 0;
+	while (total < len)
+	{
+		size_t chunk = len - total < VFS_COPY_CHUNK ? len - total : VFS_COPY_CHUNK;
+		ssize_t n = kread(f, kbuf, chunk);
+		if (n < 0)
+		{
+			total = total ? total : n;
+			break;
+		}
+		iov_copy(iov, iovcnt, total, kbuf, n, true);
+		total += n;
+		if (n < chunk)
+			break;
+	}
+	pmm->free(kbuf);
+	return total;
+}
+
+/**
+ * gather from @iov like vfs_readv scatters into it
+ */
+ssize_t vfs_writev(struct file *f, const struct iovec *iov, int iovcnt)
+{
+	size_t len = iov_length(iov, iovcnt);
+	if (len == 0)
+		return 0;
+	char *kbuf = pmm->alloc(len < VFS_COPY_CHUNK ? len : VFS_COPY_CHUNK);
+	if (kbuf == NULL)
+		return -1;
+	ssize_t total = 0;
+	while (total < len)
+	{
+		size_t chunk = len - total < VFS_COPY_CHUNK ? len - total : VFS_COPY_CHUNK;
+		iov_copy(iov, iovcnt, total, kbuf, chunk, false);
+		ssize_t n = kwrite(f, kbuf, chunk);
+		if (n < 0)
+		{
+			total = total ? total : n;
+			break;
+		}
+		total += n;
+		if (n < chunk)
+			break;
+	}
+	pmm->free(kbuf);
+	return total;
+}
+
+/**
+ * read, bounced like vfs_readv
+ */
+ssize_t vfs_read(struct file *f, void *buf, size_t count)
+{
+	struct iovec iov = {.iov_base = buf, .iov_len = count};
+	return vfs_readv(f, &iov, 1);
+}
+
+ssize_t vfs_write(struct file *f, const void *buf, size_t count)
+{
+	struct iovec iov = {.iov_base = (void *)buf, .iov_len = count};
+	return vfs_writev(f, &iov, 1);
+}
+
+ssize_t vfs_pread(struct file *f, void *buf, size_t count, off_t offset)
+{
+	if (!f->readable || f->fops == NULL || f->fops->pread == NULL || offset < 0)
+		return VFS_ERROR;
+	return f->fops->pread(f, buf, count, offset);
+}
+
+ssize_t vfs_pwrite(struct file *f, const void *buf, size_t count, off_t offset)
+{
+	if (!f->writable || f->fops == NULL || f->fops->pwrite == NULL || offset < 0)
+		return VFS_ERROR;
+	return f->fops->pwrite(f, buf, count, offset);
+}
+
 off_t vfs_seek(struct file *f, off_t offset, int whence)
 {
+	if (f->fops == NULL || f->fops->seek == NULL)
+		return VFS_ERROR;
 	kmt->spin_lock(&f->lock);
-	if (f->type != FD_FILE)
+	off_t r = f->fops->seek(f, offset, whence);
+	kmt->spin_unlock(&f->lock);
+	return r;
+}
+
+/**
+ * move up to @count bytes from @in to @out inside the kernel. each
+ * side uses its file position, or the offset behind @in_off/@out_off
+ * (advanced, the position left alone) when one is given. returns
+ * the bytes moved, -1 when an error came before any data
+ */
+ssize_t vfs_copy(struct file *out, off_t *out_off, struct file *in, off_t *in_off, size_t count)
+{
+	char *buf = pmm->alloc(VFS_COPY_CHUNK);
+	if (buf == NULL)
+		return VFS_ERROR;
+	ssize_t total = 0;
+	while (total < count)
 	{
-		kmt->spin_unlock(&f->lock);
+		size_t chunk = count - total < VFS_COPY_CHUNK ? count - total : VFS_COPY_CHUNK;
+		ssize_t n = in_off ? vfs_pread(in, buf, chunk, *in_off) : kread(in, buf, chunk);
+		if (n <= 0)
+		{
+			total = total ? total : n;
+			break;
+		}
+		ssize_t w = out_off ? vfs_pwrite(out, buf, n, *out_off) : kwrite(out, buf, n);
+		if (w > 0)
+		{
+			if (in_off)
+				*in_off += w;
+			if (out_off)
+				*out_off += w;
+			total += w;
+		}
+		if (w != n)
+		{
+			// leave the unwritten tail to be read again through the file position
+			if (!in_off && in->type == FD_FILE)
+				vfs_seek(in, (w > 0 ? w : 0) - n, SEEK_CUR);
+			total = total ? total : w;
+			break;
+		}
+	}
+	pmm->free(buf);
+	return total;
+}
+
+int vfs_fsync(struct file *f)
+{
+	if (f->fops == NULL)
 		return VFS_ERROR;
+	if (f->fops->fsync == NULL)
+		return VFS_SUCCESS; // nothing of it is meant to reach a disk
+	return f->fops->fsync(f);
+}
+
+/**
+ * write back the page cache, then have every mounted filesystem
+ * flush what it buffers
+ */
+int vfs_sync(void)
+{
+	struct mount *pinned[VFS_MOUNTS];
+	int n = 0;
+	int r = pgcache->syncall();
+	kmt->spin_lock(&mount_lock);
+	for (int i = 0; i < VFS_MOUNTS; i++)
+	{
+		if (mounts[i].path && !mounts[i].going && mounts[i].ops->sync)
+		{
+			mounts[i].ref++;
+			pinned[n++] = &mounts[i];
+		}
 	}
-	ext4_file *ef = (ext4_file *)f->ptr;
-	if (ext4_fseek(ef, offset, whence) != EOK)
+	kmt->spin_unlock(&mount_lock);
+	for (int i = 0; i < n; i++)
 	{
-		kmt->spin_unlock(&f->lock);
-		return VFS_ERROR;
+		if (pinned[i]->ops->sync(pinned[i]) != VFS_SUCCESS)
+			r = -1;
+		mount_put(pinned[i]);
 	}
-	int r=ext4_ftell(ef);
-	kmt->spin_unlock(&f->lock);
-	return r;
+	return r < 0 ? VFS_ERROR : VFS_SUCCESS;
+}
+
+/**
+ * flush the filesystem @f lives on; files outside any mount
+ * (pipes, devices) have nothing to flush
+ */
+int vfs_syncfs(struct file *f)
+{
+	struct mount *m = f->mnt;
+	if (m == NULL)
+		return VFS_SUCCESS;
+	// the open file keeps the mount pinned
+	int r = pgcache->syncfs(m->id);
+	if (m->ops->sync && m->ops->sync(m) != VFS_SUCCESS)
+		r = -1;
+	return r < 0 ? VFS_ERROR : VFS_SUCCESS;
 }
 
 int vfs_stat(struct file *f, struct stat *stat)
@@ -500,38 +811,73 @@ int vfs_stat(struct file *f, struct stat *stat)
 	return filestat(f, stat);
 }
 
+/**
+ * unmount the filesystem on @mount_point, refused while it has open
+ * files or another filesystem is mounted inside it. the filesystem
+ * is taken down without mount_lock held, as that may write back a
+ * lot; the slot is marked going meanwhile, so nobody enters it
+ */
 int vfs_umount(const char *mount_point)
 {
-	// WARNING: This is not safe. It does not check for open files.
-	int ret = ext4_umount(mount_point);
-	if (ret != EOK)
-	{
-		printf("VFS: Failed to umount: %d\n", ret);
-		return VFS_ERROR;
+	struct mount *m = NULL;
+	int ret = VFS_ERROR;
+	kmt->spin_lock(&mount_lock);
+	for (int i = 0; i < VFS_MOUNTS; i++)
+	{
+		if (mounts[i].path && strcmp(mounts[i].path, mount_point) == 0)
+			m = &mounts[i];
+	}
+	for (int i = 0; m && i < VFS_MOUNTS; i++)
+	{
+		if (&mounts[i] != m && mounts[i].path && strncmp(mounts[i].path, m->path, m->len) == 0 &&
+			(m->len == 1 || mounts[i].path[m->len] == '/'))
+			m = NULL;
+	}
+	if (m && (m->ref != 0 || m->going))
+		m = NULL;
+	if (m)
+		m->going = true;
+	kmt->spin_unlock(&mount_lock);
+	if (m)
+	{
+		ret = m->ops->umount(m) == VFS_SUCCESS ? VFS_SUCCESS : VFS_ERROR;
+		kmt->spin_lock(&mount_lock);
+		if (ret == VFS_SUCCESS)
+		{
+			pmm->free(m->path);
+			m->path = NULL;
+		}
+		m->going = false;
+		kmt->spin_unlock(&mount_lock);
 	}
-	ext4_device_unregister("disk");
-	printf("VFS: Successfully umounted filesystem\n");
-	return VFS_SUCCESS;
+	if (ret != VFS_SUCCESS)
+		printf("VFS: Failed to umount %s\n", mount_point);
+	return ret;
 }
 
 int vfs_rmdir(const char *pathname)
 {
-	int ret = ext4_dir_rm(pathname);
-	return (ret == EOK) ? VFS_SUCCESS : VFS_ERROR;
+	const char *rel;
+	struct mount *m = mount_get(pathname, &rel);
+	if (m == NULL)
+		return VFS_ERROR;
+	int ret = m->ops->iops->rmdir ? m->ops->iops->rmdir(m, rel) : VFS_ERROR;
+	mount_put(m);
+	return ret < 0 ? VFS_ERROR : VFS_SUCCESS;
 }
 
 int vfs_rename(const char *oldpath, const char *newpath)
 {
-	for (size_t i = 0; i < NFILE; i++)
-	{
-		if (strcmp(ftable.file[i].path, oldpath) == 0)
-		{
-			strcpy(ftable.file[i].path, newpath);
-			break;
-		}
-	}
-	int ret = ext4_frename(oldpath, newpath);
-	return (ret == EOK) ? VFS_SUCCESS : VFS_ERROR;
+	const char *orel, *nrel;
+	struct mount *om = mount_get(oldpath, &orel);
+	struct mount *nm = mount_get(newpath, &nrel);
+	// no renames across filesystems
+	int ret = (om && om == nm && om->ops->iops->rename) ? om->ops->iops->rename(om, orel, nrel) : VFS_ERROR;
+	if (om)
+		mount_put(om);
+	if (nm)
+		mount_put(nm);
+	return ret < 0 ? VFS_ERROR : VFS_SUCCESS;
 }
 
 static struct file *vfs_dup(struct file *f)
@@ -559,6 +905,11 @@ MODULE_DEF(vfs) = {
 	.close = vfs_close,
 	.read = vfs_read,
 	.write = vfs_write,
+	.readv = vfs_readv,
+	.writev = vfs_writev,
+	.pread = vfs_pread,
+	.pwrite = vfs_pwrite,
+	.copy = vfs_copy,
 	.seek = vfs_seek,
 	.mkdir = vfs_mkdir,
 	.rmdir = vfs_rmdir,
@@ -566,5 +917,9 @@ MODULE_DEF(vfs) = {
 	.link = vfs_link,
 	.rename = vfs_rename,
 	.stat = vfs_stat,
+	.fsync = vfs_fsync,
+	.sync = vfs_sync,
+	.syncfs = vfs_syncfs,
+	.poll = filepoll,
 	.alloc = filealloc,
 	.pipe = vfs_pipe};
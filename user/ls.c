@@ -22,8 +22,8 @@ fmtname(char *path)
 void ls(char *path)
 {
   char buf[512], *p;
-  int fd;
-  struct dirent de;
+  char dents[2048];
+  int fd, n;
   struct stat st;
 
   if ((fd = openat(AT_FDCWD, path, O_DIRECTORY, 0)) < 0)
@@ -50,25 +50,29 @@ void ls(char *path)
     strcpy(buf, path);
     p = buf + strlen(buf);
     *p++ = '/';
-    while (read(fd, &de, sizeof(de)) == sizeof(de))
+    while ((n = getdents64(fd, (struct dirent *)dents, sizeof(dents))) > 0)
     {
-      if (de.d_ino == 0)
-        continue;
-      memmove(p, de.d_name, DIRSIZ);
-      p[DIRSIZ] = 0;
-      int tfd = openat(fd, buf, O_RDONLY, 0);
-      if (tfd < 0)
+      for (int off = 0; off < n;)
       {
-        printf("ls: cannot open %s\n", buf);
-        continue;
+        struct dirent *de = (struct dirent *)(dents + off);
+        off += de->d_reclen;
+        if (de->d_ino == 0 || p - buf + strlen(de->d_name) + 1 > sizeof buf)
+          continue;
+        strcpy(p, de->d_name);
+        int tfd = openat(fd, buf, O_RDONLY, 0);
+        if (tfd < 0)
+        {
+          printf("ls: cannot open %s\n", buf);
+          continue;
+        }
+        if (fstat(tfd, &st) < 0)
+        {
+          printf("ls: cannot stat %s\n", buf);
+          continue;
+        }
+        printf("%s %d %d %d\n", fmtname(buf), st.st_mode, st.st_ino, st.st_size);
+        close(tfd);
       }
-      if (fstat(tfd, &st) < 0)
-      {
-        printf("ls: cannot stat %s\n", buf);
-        continue;
-      }
-      printf("%s %d %d %d\n", fmtname(buf), st.st_mode, st.st_ino, st.st_size);
-      close(tfd);
     }
     break;
   default:
@@ -0,0 +1,18 @@
+#include "ulib.h"
+
+int
+main(int argc, char *argv[])
+{
+  if(argc != 4){
+    fprintf(2, "Usage: mount source dir fstype\n");
+    exit(1);
+  }
+
+  // source names the disk for ext4 and is ignored by tmpfs
+  if(mount(argv[1], argv[2], argv[3], 0, 0) < 0){
+    fprintf(2, "mount: cannot mount %s on %s\n", argv[1], argv[2]);
+    exit(1);
+  }
+
+  exit(0);
+}
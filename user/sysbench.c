@@ -0,0 +1,117 @@
+#include "ulib.h"
+
+#define ROUNDS 100000
+
+enum
+{
+  BENCH_INT,   // getpid through int $0x80
+  BENCH_FAST,  // getpid through syscall
+  BENCH_TIME,  // gettimeofday system call
+  BENCH_VDSO,  // clock_gettime on the clock page
+  BENCH_FSTAT, // fstat system call
+  BENCH_RING,  // fstat through the submission ring, RING_BATCH per enter
+};
+
+#define RING_BATCH 64
+
+static struct io_ring *ring;
+
+/**
+ * queue RING_BATCH fstat operations and submit them with one call
+ */
+static void ring_fstat(struct stat *st)
+{
+  struct io_sqe *sqes = IORING_SQES(ring);
+  struct io_cqe *cqes = IORING_CQES(ring, ring->entries);
+  uint32_t mask = ring->entries - 1;
+  for (int i = 0; i < RING_BATCH; i++)
+  {
+    struct io_sqe *sqe = &sqes[(ring->sq_tail + i) & mask];
+    sqe->opcode = IORING_OP_FSTAT;
+    sqe->fd = 1;
+    sqe->addr = (uint64_t)st;
+    sqe->user_data = i;
+  }
+  __atomic_store_n(&ring->sq_tail, ring->sq_tail + RING_BATCH, __ATOMIC_RELEASE);
+  io_uring_enter(RING_BATCH, RING_BATCH, 0);
+  while (ring->cq_head != __atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE))
+  {
+    if (cqes[ring->cq_head & mask].res < 0)
+    {
+      fprintf(2, "sysbench: ring fstat failed\n");
+      exit(1);
+    }
+    __atomic_store_n(&ring->cq_head, ring->cq_head + 1, __ATOMIC_RELEASE);
+  }
+}
+
+/**
+ * average cycles of one call of kind @kind
+ */
+static uint64_t bench(int kind, int rounds)
+{
+  struct timespec ts;
+  struct stat st;
+  uint64_t start = rdtsc();
+  for (int i = 0; i < rounds; i++)
+  {
+    switch (kind)
+    {
+    case BENCH_INT:
+      syscall_int(SYS_getpid, 0, 0, 0, 0);
+      break;
+    case BENCH_FAST:
+      syscall(SYS_getpid, 0, 0, 0, 0);
+      break;
+    case BENCH_TIME:
+      syscall(SYS_gettimeofday, (uint64_t)&ts, 0, 0, 0);
+      break;
+    case BENCH_VDSO:
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      break;
+    case BENCH_FSTAT:
+      fstat(1, &st);
+      break;
+    case BENCH_RING:
+      ring_fstat(&st);
+      break;
+    }
+  }
+  if (kind == BENCH_RING)
+  {
+    return (rdtsc() - start) / rounds / RING_BATCH;
+  }
+  return (rdtsc() - start) / rounds;
+}
+
+int main(int argc, char *argv[])
+{
+  int rounds = ROUNDS;
+  if (argc > 1)
+  {
+    rounds = atoi(argv[1]);
+    if (rounds <= 0)
+    {
+      fprintf(2, "usage: sysbench [rounds]\n");
+      exit(1);
+    }
+  }
+  ring = io_uring_setup(RING_BATCH);
+  if (ring == NULL)
+  {
+    fprintf(2, "sysbench: io_uring_setup failed\n");
+    exit(1);
+  }
+  // warm up every path before timing
+  for (int kind = BENCH_INT; kind <= BENCH_RING; kind++)
+  {
+    bench(kind, 1000);
+  }
+  printf("int $0x80:        %d cycles/call\n", (int)bench(BENCH_INT, rounds));
+  printf("syscall:          %d cycles/call\n", (int)bench(BENCH_FAST, rounds));
+  printf("gettimeofday:     %d cycles/call\n", (int)bench(BENCH_TIME, rounds));
+  printf("clock_gettime:    %d cycles/call\n", (int)bench(BENCH_VDSO, rounds));
+  printf("fstat:            %d cycles/call\n", (int)bench(BENCH_FSTAT, rounds));
+  printf("fstat (ring x%d): %d cycles/call\n", RING_BATCH, (int)bench(BENCH_RING, rounds / RING_BATCH + 1));
+  exit(0);
+}
@@ -0,0 +1,145 @@
+#include "ulib.h"
+
+#define TOP 10
+
+static struct syscall_stat stats[NR_SYSCALL];
+static struct strace_rec recs[64];
+
+static const char *names[NR_SYSCALL] = {
+    [SYS_kputc] = "kputc",
+    [SYS_fork] = "fork",
+    [SYS_sleep] = "sleep",
+    [SYS_getcwd] = "getcwd",
+    [SYS_pipe2] = "pipe2",
+    [SYS_dup] = "dup",
+    [SYS_dup3] = "dup3",
+    [SYS_chdir] = "chdir",
+    [SYS_openat] = "openat",
+    [SYS_close] = "close",
+    [SYS_getdents64] = "getdents64",
+    [SYS_read] = "read",
+    [SYS_write] = "write",
+    [SYS_readv] = "readv",
+    [SYS_writev] = "writev",
+    [SYS_pread64] = "pread64",
+    [SYS_pwrite64] = "pwrite64",
+    [SYS_sendfile] = "sendfile",
+    [SYS_splice] = "splice",
+    [SYS_linkat] = "linkat",
+    [SYS_unlinkat] = "unlinkat",
+    [SYS_mkdirat] = "mkdirat",
+    [SYS_umount2] = "umount2",
+    [SYS_mount] = "mount",
+    [SYS_fstat] = "fstat",
+    [SYS_sync] = "sync",
+    [SYS_fsync] = "fsync",
+    [SYS_fdatasync] = "fdatasync",
+    [SYS_syncfs] = "syncfs",
+    [SYS_clone] = "clone",
+    [SYS_execve] = "execve",
+    [SYS_wait4] = "wait4",
+    [SYS_exit] = "exit",
+    [SYS_getppid] = "getppid",
+    [SYS_getpid] = "getpid",
+    [SYS_sbrk] = "sbrk",
+    [SYS_munmap] = "munmap",
+    [SYS_mmap] = "mmap",
+    [SYS_mprotect] = "mprotect",
+    [SYS_madvise] = "madvise",
+    [SYS_times] = "times",
+    [SYS_uname] = "uname",
+    [SYS_sched_yield] = "sched_yield",
+    [SYS_gettimeofday] = "gettimeofday",
+    [SYS_nanosleep] = "nanosleep",
+    [SYS_getrlimit] = "getrlimit",
+    [SYS_setrlimit] = "setrlimit",
+    [SYS_copy_file_range] = "copy_file_range",
+    [SYS_io_uring_setup] = "io_uring_setup",
+    [SYS_io_uring_enter] = "io_uring_enter",
+    [SYS_sysstat] = "sysstat",
+    [SYS_strace] = "strace",
+    [SYS_strace_read] = "strace_read",
+};
+
+static const char *name(int nr)
+{
+  return names[nr] ? names[nr] : "?";
+}
+
+/**
+ * print the calls that took the most time in total, with the
+ * latency bucket most of their calls fell in
+ */
+static void top()
+{
+  int n = sysstat(stats, NR_SYSCALL);
+  char shown[NR_SYSCALL] = {0};
+  printf("%s %s %s %s %s %s\n", "syscall", "calls", "errors", "kcycles", "avg", "mode(2^n)");
+  for (int k = 0; k < TOP; k++)
+  {
+    int best = -1;
+    for (int nr = 0; nr < n; nr++)
+    {
+      if (!shown[nr] && stats[nr].count && (best < 0 || stats[nr].cycles > stats[best].cycles))
+        best = nr;
+    }
+    if (best < 0)
+      break;
+    shown[best] = 1;
+    struct syscall_stat *st = &stats[best];
+    int mode = 0;
+    for (int i = 1; i < SYSCALL_HIST; i++)
+    {
+      if (st->hist[i] > st->hist[mode])
+        mode = i;
+    }
+    printf("%s %d %d %d %d %d\n", name(best), (int)st->count, (int)st->errors,
+           (int)(st->cycles / 1000), (int)(st->cycles / st->count), mode);
+  }
+}
+
+/**
+ * run @argv with tracing on and print its calls as they drain
+ */
+static void trace(char *argv[])
+{
+  int pid = fork();
+  if (pid < 0)
+  {
+    fprintf(2, "sysstat: fork failed\n");
+    exit(1);
+  }
+  if (pid == 0)
+  {
+    char path[256];
+    strace(1);
+    strcpy(path, "/bin/");
+    strcat(path, argv[0]);
+    execve(path, argv, NULL);
+    execve(argv[0], argv, NULL);
+    fprintf(2, "sysstat: exec %s failed\n", argv[0]);
+    exit(1);
+  }
+  int status;
+  wait4(pid, &status, 0, NULL);
+  int n;
+  while ((n = strace_read(recs, sizeof(recs) / sizeof(recs[0]))) > 0)
+  {
+    for (int i = 0; i < n; i++)
+    {
+      struct strace_rec *r = &recs[i];
+      printf("[%d] %s(%p, %p, %p) = %d <%d cycles>\n", r->pid, name(r->nr),
+             r->args[0], r->args[1], r->args[2], (int)r->ret, (int)r->cycles);
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc > 1)
+  {
+    trace(argv + 1);
+  }
+  top();
+  exit(0);
+}
@@ -24,6 +24,23 @@ static inline long syscall(int num, long arg1, long arg2, long arg3, long arg4)
   register long a2 asm("rsi") = arg2;
   register long a3 asm("rdx") = arg3;
   register long a4 asm("r10") = arg4;
+  asm volatile("syscall"
+               : "+r"(a0)
+               : "r"(a1), "r"(a2), "r"(a3), "r"(a4)
+               : "memory", "rcx", "r8", "r9", "r11");
+  return a0;
+}
+
+/**
+ * the same call through the int $0x80 trap gate, kept for comparison
+ */
+static inline long syscall_int(int num, long arg1, long arg2, long arg3, long arg4)
+{
+  register long a0 asm("rax") = num;
+  register long a1 asm("rdi") = arg1;
+  register long a2 asm("rsi") = arg2;
+  register long a3 asm("rdx") = arg3;
+  register long a4 asm("r10") = arg4;
   asm volatile("int $0x80"
                : "+r"(a0)
                : "r"(a1), "r"(a2), "r"(a3), "r"(a4)
@@ -31,9 +48,50 @@ static inline long syscall(int num, long arg1, long arg2, long arg3, long arg4)
   return a0;
 }
 
+static inline long syscall6(int num, long arg1, long arg2, long arg3, long arg4, long arg5, long arg6)
+{
+  register long a0 asm("rax") = num;
+  register long a1 asm("rdi") = arg1;
+  register long a2 asm("rsi") = arg2;
+  register long a3 asm("rdx") = arg3;
+  register long a4 asm("r10") = arg4;
+  register long a5 asm("r8") = arg5;
+  register long a6 asm("r9") = arg6;
+  asm volatile("syscall"
+               : "+r"(a0)
+               : "r"(a1), "r"(a2), "r"(a3), "r"(a4), "r"(a5), "r"(a6)
+               : "memory", "rcx", "r11");
+  return a0;
+}
+
+static inline uint64_t rdtsc()
+{
+  uint32_t lo, hi;
+  asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+/**
+ * time since boot from the TSC and the calibration in the clock
+ * page the kernel maps at VDSO_ADDR, without entering the kernel
+ */
+static inline int clock_gettime(int clockid, struct timespec *ts)
+{
+  const volatile struct vdso_clock *clock = (const volatile struct vdso_clock *)VDSO_ADDR;
+  if ((clockid != CLOCK_REALTIME && clockid != CLOCK_MONOTONIC) || ts == NULL)
+  {
+    return -1;
+  }
+  uint64_t cycles = rdtsc() - clock->uptsc;
+  uint64_t us = cycles / clock->freq_mhz;
+  ts->tv_sec = us / 1000000;
+  ts->tv_nsec = (us % 1000000) * 1000 + (cycles % clock->freq_mhz) * 1000 / clock->freq_mhz;
+  return 0;
+}
+
 static inline int gettimeofday(struct timespec *ts)
 {
-  return syscall(SYS_gettimeofday, (uint64_t)ts, 0, 0, 0);
+  return clock_gettime(CLOCK_REALTIME, ts);
 }
 static inline int openat(int dirfd, const char *pathname, int flags, mode_t mode)
 {
@@ -61,6 +119,77 @@ static inline int write(int fd, const void *buf, size_t count)
 {
   return syscall(SYS_write, fd, (uint64_t)buf, count, 0);
 }
+static inline ssize_t readv(int fd, const struct iovec *iov, int iovcnt)
+{
+  return syscall(SYS_readv, fd, (uint64_t)iov, iovcnt, 0);
+}
+static inline ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
+{
+  return syscall(SYS_writev, fd, (uint64_t)iov, iovcnt, 0);
+}
+static inline ssize_t pread(int fd, void *buf, size_t count, off_t offset)
+{
+  return syscall(SYS_pread64, fd, (uint64_t)buf, count, offset);
+}
+static inline ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+  return syscall(SYS_pwrite64, fd, (uint64_t)buf, count, offset);
+}
+static inline ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
+{
+  return syscall(SYS_sendfile, out_fd, in_fd, (uint64_t)offset, count);
+}
+static inline ssize_t copy_file_range(int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len, unsigned flags)
+{
+  return syscall6(SYS_copy_file_range, fd_in, (uint64_t)off_in, fd_out, (uint64_t)off_out, len, flags);
+}
+static inline ssize_t splice(int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len, unsigned flags)
+{
+  return syscall6(SYS_splice, fd_in, (uint64_t)off_in, fd_out, (uint64_t)off_out, len, flags);
+}
+static inline int ppoll(struct pollfd *fds, int nfds, const struct timespec *timeout, const void *sigmask)
+{
+  return syscall(SYS_ppoll, (uint64_t)fds, nfds, (uint64_t)timeout, (uint64_t)sigmask);
+}
+// @timeout in milliseconds, negative waits forever
+static inline int poll(struct pollfd *fds, int nfds, int timeout)
+{
+  struct timespec ts = {timeout / 1000, (timeout % 1000) * 1000000};
+  return ppoll(fds, nfds, timeout < 0 ? NULL : &ts, NULL);
+}
+// @timeout NULL waits forever
+static inline int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timespec *timeout)
+{
+  return syscall6(SYS_pselect6, nfds, (uint64_t)readfds, (uint64_t)writefds, (uint64_t)exceptfds, (uint64_t)timeout, 0);
+}
+static inline int epoll_create1(int flags)
+{
+  return syscall(SYS_epoll_create1, flags, 0, 0, 0);
+}
+static inline int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+  return syscall(SYS_epoll_ctl, epfd, op, fd, (uint64_t)event);
+}
+static inline int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+  return syscall6(SYS_epoll_pwait, epfd, (uint64_t)events, maxevents, timeout, 0, 0);
+}
+static inline void sync(void)
+{
+  syscall(SYS_sync, 0, 0, 0, 0);
+}
+static inline int fsync(int fd)
+{
+  return syscall(SYS_fsync, fd, 0, 0, 0);
+}
+static inline int fdatasync(int fd)
+{
+  return syscall(SYS_fdatasync, fd, 0, 0, 0);
+}
+static inline int syncfs(int fd)
+{
+  return syscall(SYS_syncfs, fd, 0, 0, 0);
+}
 static inline int linkat(int olddirfd, const char *oldpath, int newdirfd, const char *newpath, int flags)
 {
   return syscall(SYS_linkat, olddirfd, (uint64_t)oldpath, newdirfd, (uint64_t)newpath);
@@ -85,6 +214,11 @@ static inline int fstat(int fd, struct stat *statbuf)
 {
   return syscall(SYS_fstat, fd, (uint64_t)statbuf, 0, 0);
 }
+// packs as many variable-length records as fit, walk them by d_reclen
+static inline int getdents64(int fd, struct dirent *dirp, size_t count)
+{
+  return syscall(SYS_getdents64, fd, (uint64_t)dirp, count, 0);
+}
 static inline int clone(int flags, void *stack, int *ptid, int *ctid, unsigned long newtls)
 {
   return syscall(SYS_clone, flags, (uint64_t)stack, (uint64_t)ptid, (uint64_t)ctid);
@@ -112,7 +246,49 @@ static inline int munmap(void *addr, size_t length)
 }
 static inline void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
 {
-  return (void *)syscall(SYS_mmap, (uint64_t)addr, length, prot, flags);
+  return (void *)syscall6(SYS_mmap, (uint64_t)addr, length, prot, flags, fd, offset);
+}
+
+/**
+ * map a submission/completion ring of at least @entries slots;
+ * returns NULL on failure
+ */
+static inline struct io_ring *io_uring_setup(unsigned entries)
+{
+  long ret = syscall(SYS_io_uring_setup, entries, 0, 0, 0);
+  return ret == -1 ? NULL : (struct io_ring *)ret;
+}
+static inline int io_uring_enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+  return syscall(SYS_io_uring_enter, to_submit, min_complete, flags, 0);
+}
+static inline int sysstat(struct syscall_stat *buf, size_t n)
+{
+  return syscall(SYS_sysstat, (uint64_t)buf, n, 0, 0);
+}
+static inline int strace(int on)
+{
+  return syscall(SYS_strace, on, 0, 0, 0);
+}
+static inline int strace_read(struct strace_rec *buf, size_t n)
+{
+  return syscall(SYS_strace_read, (uint64_t)buf, n, 0, 0);
+}
+static inline int mprotect(void *addr, size_t length, int prot)
+{
+  return syscall(SYS_mprotect, (uint64_t)addr, length, prot, 0);
+}
+static inline int madvise(void *addr, size_t length, int advice)
+{
+  return syscall(SYS_madvise, (uint64_t)addr, length, advice, 0);
+}
+static inline int getrlimit(int resource, struct rlimit *rlim)
+{
+  return syscall(SYS_getrlimit, resource, (uint64_t)rlim, 0, 0);
+}
+static inline int setrlimit(int resource, const struct rlimit *rlim)
+{
+  return syscall(SYS_setrlimit, resource, (uint64_t)rlim, 0, 0);
 }
 
 static inline clock_t times(struct tms *buf)
@@ -0,0 +1,21 @@
+#include "ulib.h"
+
+int
+main(int argc, char *argv[])
+{
+  int i;
+
+  if(argc < 2){
+    fprintf(2, "Usage: umount dirs...\n");
+    exit(1);
+  }
+
+  for(i = 1; i < argc; i++){
+    if(umount2(argv[i], 0) < 0){
+      fprintf(2, "umount: %s failed to unmount\n", argv[i]);
+      break;
+    }
+  }
+
+  exit(0);
+}